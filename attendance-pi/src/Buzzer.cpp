@@ -1,21 +1,128 @@
 #include "Buzzer.h"
 #include "ANSI.h"
 
+#include "Hal.h"
 #include <bcm2835.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
 
 #define BUZZER_PIN	RPI_V2_GPIO_P1_37
 
+///Most sounds that may be waiting to play
+#define BUZZER_QUEUE_SIZE	8
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The initialization process for the Buzzer allocates its GPIO pin and
+ * 	spawns the sequencer thread.
+ *
+ * 	@section sequencer	Sequencer Thread
+ *
+ * 	Sounds are played by a thread of their own, so that play() and buzz()
+ * 	return straight away and the Keypad and RFID threads can keep scanning
+ * 	while a tone is sounding.  Each named pattern is a table of durations in
+ * 	microseconds, alternating between on and off and ending with a zero.
+ * 	Sounds are queued and played one after another; if too many pile up,
+ * 	new ones are dropped rather than played long after the fact.
+ *
+ */
 namespace Buzzer {
 
+	//Pattern tables, alternating on and off times in microseconds
+	const int clickSteps[] = { 25000, 0 };
+	const int tapSteps[] = { 50000, 0 };
+	const int doubleBeepSteps[] = { 25000, 25000, 25000, 0 };
+	const int errorSteps[] = { 1000000, 0 };
+	const int mismatchSteps[] = { 100000, 100000, 100000, 0 };
+
+	/**
+	 * A sound waiting to be played
+	 * steps: The pattern table, or nullptr for a single tone
+	 * duration: Length of the single tone, in microseconds
+	 */
+	struct Sound {
+		const int* steps;
+		int duration;
+	};
+
+	///Sounds waiting to be played
+	std::deque<Sound> queue;
+
+	///Sequencer thread
+	std::thread sequencerThread;
+	///Thread termination condition
+	bool run = true;
+	std::mutex m;
+	std::condition_variable cv;
+
+	/*!	Pattern table lookup.
+	 */
+	const int* stepsFor(Pattern pattern) {
+		switch(pattern) {
+			case CLICK: return clickSteps;
+			case TAP: return tapSteps;
+			case DOUBLE_BEEP: return doubleBeepSteps;
+			case ERROR: return errorSteps;
+			case MISMATCH: return mismatchSteps;
+			default: return clickSteps;
+		}
+	}
+
+	/*!	Sequencer thread.
+	 *
+	 * 	Plays queued sounds one step at a time.  The waits between steps are
+	 * 	interrupted by destroy(), which leaves the buzzer off.
+	 */
+	void sequencer() {
+		std::unique_lock<std::mutex> lock(m);
+		while(run) {
+			if(queue.empty()) {
+				cv.wait(lock);
+				continue;
+			}
+			Sound sound = queue.front();
+			queue.pop_front();
+			int single[] = { sound.duration, 0 };
+			const int* steps = sound.steps != nullptr ? sound.steps : single;
+			for(int i = 0; steps[i] != 0 && run; i++) {
+				//Even steps are on, odd steps are off
+				Hal::gpio().write(BUZZER_PIN, i % 2 == 0);
+				cv.wait_for(lock, std::chrono::microseconds(steps[i]),
+					[] { return !run; });
+			}
+			//Turn off
+			Hal::gpio().write(BUZZER_PIN, false);
+		}
+	}
+
+	/*!	Queue a sound.
+	 */
+	void enqueue(const Sound& sound) {
+		{
+			std::lock_guard<std::mutex> lock(m);
+			if(queue.size() >= BUZZER_QUEUE_SIZE) {
+				return;
+			}
+			queue.push_back(sound);
+		}
+		cv.notify_one();
+	}
+
 	void init() {
 		//Initialize the Buzzer
 		printf(LOADING "Initializing Buzzer...");
 		fflush(stdout);
 
 		//Allocate the GPIO pin
-		bcm2835_gpio_fsel(BUZZER_PIN, BCM2835_GPIO_FSEL_OUTP);
+		Hal::gpio().output(BUZZER_PIN);
+
+		//Start the sequencer
+		sequencerThread = std::thread(sequencer);
 
 		//Success
 		printf(OKAY "\n");
@@ -26,18 +133,35 @@ namespace Buzzer {
 		printf(LOADING "Destroying Buzzer...");
 		fflush(stdout);
 
-		//Nothing to do here
+		//Stop the sequencer, cutting off whatever is playing
+		{
+			std::lock_guard<std::mutex> lock(m);
+			run = false;
+			queue.clear();
+		}
+		cv.notify_one();
+		sequencerThread.join();
 
 		//Success
 		printf(OKAY "\n");
 	}
 
+	/*!	Play a named pattern.
+	 *
+	 * 	Returns immediately, the pattern plays once everything queued before
+	 * 	it has finished.
+	 */
+	void play(Pattern pattern) {
+		enqueue({ stepsFor(pattern), 0 });
+	}
+
+	/*!	Play a single tone of @p duration microseconds.
+	 *
+	 * 	Returns immediately, like play().
+	 */
 	void buzz(int duration) {
-		//Turn on
-		bcm2835_gpio_write(BUZZER_PIN, HIGH);
-		//Wait
-		usleep(duration);
-		//Turn off
-		bcm2835_gpio_write(BUZZER_PIN, LOW);
+		if(duration > 0) {
+			enqueue({ nullptr, duration });
+		}
 	}
 }
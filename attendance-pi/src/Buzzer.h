@@ -2,8 +2,17 @@
 
 namespace Buzzer {
 
+	typedef enum {
+		CLICK,			///<Short click for a key press
+		TAP,			///<Slightly longer beep for a card tap
+		DOUBLE_BEEP,	///<Two short beeps for a rejected key
+		ERROR,			///<Long tone for an invalid PIN, tag or request
+		MISMATCH		///<Two beeps for a sign in corrected by the server
+	} Pattern;
+
 	void init();
 	void destroy();
 
+	void play(Pattern);
 	void buzz(int);
 }
@@ -0,0 +1,113 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "CardId.h"
+
+/*!	Empty UID constructor
+ */
+CardId::CardId() {
+	low = 0;
+	high = 0;
+}
+
+/*!	UID constructor
+ *
+ * 	Creates a UID from the first @p length bytes of @p bytes.  Anything past
+ * 	@p CARD_ID_MAX_BYTES is ignored.
+ */
+CardId::CardId(const uint8_t* bytes, size_t length) {
+	if(length > CARD_ID_MAX_BYTES) {
+		length = CARD_ID_MAX_BYTES;
+	}
+	low = 0;
+	high = (uint64_t) length << 56;
+	for(size_t i = 0; i < length; i++) {
+		if(i < 8) {
+			low |= (uint64_t) bytes[i] << (i * 8);
+		} else {
+			high |= (uint64_t) bytes[i] << ((i - 8) * 8);
+		}
+	}
+}
+
+/*!	Get the number of bytes in the UID.
+ */
+size_t CardId::length() const {
+	return (size_t) (high >> 56);
+}
+
+/*!	Get byte @p i of the UID.
+ */
+uint8_t CardId::byte(size_t i) const {
+	return i < 8 ? (uint8_t) (low >> (i * 8)) :
+		(uint8_t) (high >> ((i - 8) * 8));
+}
+
+/*!	Check if this is the empty UID.
+ */
+bool CardId::empty() const {
+	return length() == 0;
+}
+
+/*!	Get the first @p length bytes of the UID.
+ *
+ * 	Older versions of this program only ever read the first four bytes of
+ * 	a card, so tags stored by them are looked up by this prefix.
+ */
+CardId CardId::prefix(size_t length) const {
+	uint8_t bytes[CARD_ID_MAX_BYTES];
+	size_t n = length < this->length() ? length : this->length();
+	for(size_t i = 0; i < n; i++) {
+		bytes[i] = byte(i);
+	}
+	return CardId(bytes, n);
+}
+
+/*!	Write the UID as an upper case hex string.
+ */
+void CardId::toHex(char out[CARD_ID_HEX_LENGTH]) const {
+	static const char digits[] = "0123456789ABCDEF";
+	size_t n = length();
+	for(size_t i = 0; i < n; i++) {
+		uint8_t b = byte(i);
+		out[i * 2] = digits[b >> 4];
+		out[i * 2 + 1] = digits[b & 0x0F];
+	}
+	out[n * 2] = '\0';
+}
+
+/*!	Read a UID from a hex string.
+ *
+ * 	Either case is accepted.
+ *
+ * 	@returns	@p false if @p hex is empty, too long, of odd length or not hex
+ */
+bool CardId::fromHex(const char* hex, CardId& id) {
+	uint8_t bytes[CARD_ID_MAX_BYTES];
+	size_t n = 0;
+	for(; hex[n] != '\0'; n++) {
+		if(n >= CARD_ID_MAX_BYTES * 2) {
+			return false;
+		}
+		char c = hex[n];
+		int v;
+		if(c >= '0' && c <= '9') {
+			v = c - '0';
+		} else if(c >= 'a' && c <= 'f') {
+			v = c - 'a' + 10;
+		} else if(c >= 'A' && c <= 'F') {
+			v = c - 'A' + 10;
+		} else {
+			return false;
+		}
+		if(n % 2 == 0) {
+			bytes[n / 2] = (uint8_t) (v << 4);
+		} else {
+			bytes[n / 2] |= (uint8_t) v;
+		}
+	}
+	if(n == 0 || n % 2 != 0) {
+		return false;
+	}
+	id = CardId(bytes, n / 2);
+	return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+///Longest card UID, in bytes
+#define CARD_ID_MAX_BYTES	10
+///Room needed for a card UID as a hex string, with its terminator
+#define CARD_ID_HEX_LENGTH	(CARD_ID_MAX_BYTES * 2 + 1)
+
+/*!	Card UID value.
+ *
+ * 	Holds the 4, 7 or 10 byte UID of an RFID card in two 64-bit words, so
+ * 	that copying, comparing and hashing one never touches the heap and
+ * 	costs a couple of integer operations.  Bytes 0 to 7 of the UID live in
+ * 	@p low, bytes 8 and 9 in the bottom of @p high, and the length in the
+ * 	top byte of @p high, so UIDs of different lengths never compare equal.
+ *
+ * 	Cards are written as upper case hex strings, first byte first, only
+ * 	where they leave the program: in requests to the server and in logs.
+ */
+struct CardId {
+	uint64_t low;
+	uint64_t high;
+
+	CardId();
+	CardId(const uint8_t* bytes, size_t length);
+
+	size_t length() const;
+	uint8_t byte(size_t i) const;
+	bool empty() const;
+	CardId prefix(size_t length) const;
+
+	void toHex(char out[CARD_ID_HEX_LENGTH]) const;
+	static bool fromHex(const char* hex, CardId& id);
+
+	bool operator==(const CardId& other) const {
+		return low == other.low && high == other.high;
+	}
+	bool operator!=(const CardId& other) const {
+		return !(*this == other);
+	}
+};
+
+/**
+ * Hash functor for using CardId as an unordered_map key
+ */
+struct CardIdHash {
+	size_t operator()(const CardId& id) const {
+		//Mix both words, the low one holds most of the entropy
+		uint64_t h = id.low * 0x9E3779B97F4A7C15ULL;
+		h ^= (h >> 32) ^ id.high;
+		return (size_t) (h ^ (h >> 29));
+	}
+};
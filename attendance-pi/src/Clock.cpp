@@ -2,15 +2,15 @@
 
 #include "Clock.h"
 #include "LCD.h"
+#include "Screen.h"
 #include "State.h"
 #include "ANSI.h"
 #include "Utils.h"
+#include "Reactor.h"
 
 #include <stdio.h>
-#include <thread>
-#include <mutex>
-#include <chrono>
-#include <condition_variable>
+#include <stdexcept>
+#include <atomic>
 #include <ctime>
 #include <unistd.h>
 #include <string>
@@ -19,15 +19,16 @@
 namespace Clock {
 
 	//Private declarations
-	void clockThread();
+	void draw(uint32_t events, void* ctx);
 	std::string getDate();
+	void stateChanged(State::State from, State::State to, void* ctx);
 
-	///Clock thead
-	std::thread cThread;
-	std::mutex m;
-	///Clock thread termination condition
-	bool run = true;
-	std::condition_variable cv;
+	///Wall timer for the start of the next minute
+	int tick = -1;
+	///Event used by wakeup(), or -1 once the clock is destroyed
+	std::atomic<int> wake(-1);
+	///Status bar last handed to the screen
+	std::string shown;
 
 	bool needsInternetTimeSync = true;
 
@@ -36,8 +37,16 @@ namespace Clock {
 		printf(LOADING "Initializing Clock...");
 		fflush(stdout);
 
-		//Start clock thread
-		cThread = std::thread(clockThread);
+		//Redraw at every minute, and whenever the display is handed back
+		try {
+			tick = Reactor::wallTimer(draw, nullptr);
+			wake = Reactor::event(draw, nullptr);
+		} catch(const std::exception& e) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw;
+		}
+		State::subscribe(stateChanged, nullptr);
+		wakeup();
 
 		//Success
 		printf(OKAY "\n");
@@ -48,63 +57,62 @@ namespace Clock {
 		printf(LOADING "Destroy Clock...");
 		fflush(stdout);
 
-		//Instruct the thread to terminate
-		run = false;
-		cv.notify_one();
-		//Join the thread
-		cThread.join();
+		//Nothing may notify the event once it is closed
+		Reactor::remove(wake.exchange(-1));
+		Reactor::remove(tick);
 
 		//Success
 		printf(OKAY "\n");
 	}
 
-	void clockThread() {
-		//Current time variable
-		std::string date;
-
-		std::unique_lock<std::mutex> lk(m);
-
-		//Loop
-		while(run) {
-			//Check if allowed state
-			if(State::state != State::READY && State::state != State::NO_INTERNET) {
-				cv.wait_for(lk, std::chrono::seconds(1));
-				continue;
-			}
-			//Get formatted date
-			date = getDate();
-
-			//Write the message
-			std::string str;
-			str += date;
-			str += "  ";
-			if (State::haveEthernet && State::haveWifi) {
-				str += CHAR_ETH;
-				str += CHAR_WIFI;
-				needsInternetTimeSync = false;
-			} else if (State::haveEthernet) {
-				str += ' ';
-				str += CHAR_ETH;
-				needsInternetTimeSync = false;
-			} else if (State::haveWifi) {
-				str += ' ';
-				str += CHAR_WIFI;
-				needsInternetTimeSync = false;
+	/*!	Clock timer and event handler.
+	 *
+	 * 	Runs on the reactor thread, at the start of every minute and whenever
+	 * 	wakeup() is called, and sets the timer for the next minute.
+	 */
+	void draw(uint32_t events, void* ctx) {
+		//Check if allowed state, otherwise wait for the state to change
+		if(!State::showsClock(State::state)) {
+			Reactor::disarm(tick);
+			return;
+		}
+		//Get formatted date
+		std::string date = getDate();
+
+		//Write the message
+		std::string str;
+		str += date;
+		str += "  ";
+		if (State::haveEthernet && State::haveWifi) {
+			str += CHAR_ETH;
+			str += CHAR_WIFI;
+			needsInternetTimeSync = false;
+		} else if (State::haveEthernet) {
+			str += ' ';
+			str += CHAR_ETH;
+			needsInternetTimeSync = false;
+		} else if (State::haveWifi) {
+			str += ' ';
+			str += CHAR_WIFI;
+			needsInternetTimeSync = false;
+		} else {
+			if (needsInternetTimeSync) {
+				str = "               ";
+				str += CHAR_NO_NET;
 			} else {
-				if (needsInternetTimeSync) {
-					str = "               ";
-					str += CHAR_NO_NET;
-				} else {
-					str += ' ';
-					str += CHAR_NO_NET;
-				}
+				str += ' ';
+				str += CHAR_NO_NET;
 			}
-			
-			LCD::writeMessage(str, 1, 0);
-			//Delay
-			cv.wait_for(lk, std::chrono::seconds(10));
 		}
-		lk.release();
+
+		//Only redraw when the minute or the icon actually changed
+		if(str != shown) {
+			Screen::show(Screen::STATUS, str);
+			shown = str;
+		}
+		//Come back when the next minute starts
+		std::time_t now = std::time(0);
+		Reactor::armAt(tick, now - now % 60 + 60);
 	}
 
 	std::string getDate() {
@@ -119,7 +127,23 @@ namespace Clock {
 		return buf;
 	}
 
+	/*!	Redraw the clock line now.
+	 */
 	void wakeup() {
-		cv.notify_one();
+		int event = wake;
+		if(event >= 0) {
+			Reactor::notify(event);
+		}
+	}
+
+	/*!	State change listener.
+	 *
+	 * 	Redraws the clock when the display is handed to or taken from
+	 * 	it.
+	 */
+	void stateChanged(State::State from, State::State to, void* ctx) {
+		if(State::showsClock(from) != State::showsClock(to)) {
+			wakeup();
+		}
 	}
 }
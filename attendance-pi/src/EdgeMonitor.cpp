@@ -0,0 +1,159 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "EdgeMonitor.h"
+#include "Log.h"
+#include "ANSI.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <linux/gpio.h>
+
+///Default GPIO character device
+#define EDGE_MONITOR_DEFAULT_CHIP	"/dev/gpiochip0"
+
+/*!	Edge monitor constructor
+ *
+ * 	Nothing is opened until the first line is watched.
+ */
+EdgeMonitor::EdgeMonitor() {
+	chip = -1;
+	wake = -1;
+}
+
+EdgeMonitor::~EdgeMonitor() {
+	close();
+}
+
+/*!	Start watching a line.
+ *
+ * 	Requests both rising and falling edge events for @p line.  The line must
+ * 	already be configured as an input.
+ *
+ * 	@returns	@p false if the kernel cannot report events for the line, in
+ * 		which case the caller should fall back to polling it.
+ */
+bool EdgeMonitor::watch(int line) {
+	if(chip < 0) {
+		const char* path = getenv("GPIO_CHIP");
+		chip = open(path == nullptr ? EDGE_MONITOR_DEFAULT_CHIP : path,
+			O_RDONLY | O_CLOEXEC);
+		if(chip < 0) {
+			return false;
+		}
+	}
+	if(wake < 0) {
+		wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if(wake < 0) {
+			return false;
+		}
+	}
+	struct gpioevent_request request;
+	memset(&request, 0, sizeof(request));
+	request.lineoffset = line;
+	request.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	request.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+	strncpy(request.consumer_label, "attendance", sizeof(request.consumer_label) - 1);
+	if(ioctl(chip, GPIO_GET_LINEEVENT_IOCTL, &request) < 0) {
+		return false;
+	}
+	fds.push_back(request.fd);
+	lines.push_back(line);
+	return true;
+}
+
+/*!	Wait for edges.
+ *
+ * 	Sleeps until at least one watched line changes, @p timeout milliseconds
+ * 	pass, or wakeup() is called.  A negative @p timeout waits forever.
+ *
+ * 	@returns	The number of edges stored in @p edges, which is 0 after a
+ * 		timeout or wakeup, or -1 on error.
+ */
+int EdgeMonitor::wait(int timeout, Edge* edges, int max) {
+	std::vector<struct pollfd> pfds(fds.size() + 1);
+	for(size_t i = 0; i < fds.size(); i++) {
+		pfds[i].fd = fds[i];
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
+	}
+	pfds[fds.size()].fd = wake;
+	pfds[fds.size()].events = POLLIN;
+	pfds[fds.size()].revents = 0;
+
+	int ready = poll(pfds.data(), pfds.size(), timeout);
+	if(ready < 0) {
+		return errno == EINTR ? 0 : -1;
+	}
+	if(pfds[fds.size()].revents & POLLIN) {
+		uint64_t count;
+		if(read(wake, &count, sizeof(count)) < 0) {
+			//Nothing to do, the event is only used to interrupt poll()
+		}
+	}
+	int n = 0;
+	for(size_t i = 0; i < fds.size() && n < max; i++) {
+		if(!(pfds[i].revents & POLLIN)) {
+			continue;
+		}
+		//Read every event queued for this line, in order
+		struct gpioevent_data event;
+		while(n < max && read(fds[i], &event, sizeof(event)) ==
+				(ssize_t) sizeof(event)) {
+			edges[n].line = lines[i];
+			edges[n].rising = event.id == GPIOEVENT_EVENT_RISING_EDGE;
+			n++;
+			//Stop before blocking on an empty line
+			struct pollfd more = { fds[i], POLLIN, 0 };
+			if(poll(&more, 1, 0) <= 0) {
+				break;
+			}
+		}
+	}
+	return n;
+}
+
+/*!	Interrupt a wait() in progress on another thread.
+ */
+void EdgeMonitor::wakeup() {
+	if(wake >= 0) {
+		uint64_t one = 1;
+		if(write(wake, &one, sizeof(one)) < 0) {
+			Log::warn("Failed to wake the GPIO monitor\n");
+		}
+	}
+}
+
+/*!	Get the event file descriptor of every watched line.
+ *
+ * 	Each becomes readable when its line has edges waiting, which wait()
+ * 	then returns.  They stay owned by the monitor and are closed by close().
+ */
+const std::vector<int>& EdgeMonitor::descriptors() const {
+	return fds;
+}
+
+/*!	Stop watching every line and release the chip.
+ */
+void EdgeMonitor::close() {
+	for(size_t i = 0; i < fds.size(); i++) {
+		::close(fds[i]);
+	}
+	fds.clear();
+	lines.clear();
+	if(wake >= 0) {
+		::close(wake);
+		wake = -1;
+	}
+	if(chip >= 0) {
+		::close(chip);
+		chip = -1;
+	}
+}
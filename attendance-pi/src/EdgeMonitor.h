@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+
+///Most edges returned by a single EdgeMonitor::wait()
+#define EDGE_MONITOR_BATCH	16
+
+/*!	GPIO edge event monitor.
+ *
+ * 	This class asks the kernel's GPIO character device to report rising and
+ * 	falling edges on a set of lines, and lets a thread sleep until one of
+ * 	them changes, or hand the lines to the Reactor and read the edges with a
+ * 	zero timeout once it says they are ready.  Lines are numbered the same
+ * 	way as the bcm2835 pin constants, which are the line offsets of the
+ * 	SoC's GPIO chip.
+ *
+ * 	The chip used is @p /dev/gpiochip0, unless the @p GPIO_CHIP environment
+ * 	variable names another one.
+ */
+class EdgeMonitor {
+	public:
+		/**
+		 * A change seen on a line
+		 * line: The line that changed
+		 * rising: true if the line went high, false if it went low
+		 */
+		struct Edge {
+			int line;
+			bool rising;
+		};
+
+		EdgeMonitor();
+		~EdgeMonitor();
+
+		bool watch(int line);
+		int wait(int timeout, Edge* edges, int max);
+		void wakeup();
+		void close();
+		const std::vector<int>& descriptors() const;
+
+	private:
+		EdgeMonitor(const EdgeMonitor&);
+		EdgeMonitor& operator=(const EdgeMonitor&);
+
+		///The GPIO chip, opened on the first call to watch()
+		int chip;
+		///Event used by wakeup() to interrupt wait()
+		int wake;
+		///Event file descriptor for each watched line
+		std::vector<int> fds;
+		///Line number for each entry in @p fds
+		std::vector<int> lines;
+};
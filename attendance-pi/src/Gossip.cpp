@@ -0,0 +1,330 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Gossip.h"
+#include "UserHandler.h"
+#include "Log.h"
+#include "Reactor.h"
+#include "ANSI.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <ctime>
+#include <stdexcept>
+#include <atomic>
+#include <map>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+///Port used when GOSSIP_PORT isn't set
+#define GOSSIP_DEFAULT_PORT		5099
+///First four bytes of every packet
+#define GOSSIP_MAGIC			"ATGS"
+///Layout of the packet, bumped whenever it changes
+#define GOSSIP_FORMAT			1
+///Longest PIN a packet can carry
+#define GOSSIP_MAX_PIN			16
+///Age in seconds after which a sign in from another kiosk is ignored
+#define GOSSIP_MAX_AGE			60
+///Time between attempts to join the group while the network is down, in milliseconds
+#define GOSSIP_JOIN_RETRY		5000
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The gossip channel is only used if the @p GOSSIP_GROUP environment
+ * 	variable names an IPv4 multicast group, such as @p 239.255.42.99.  The
+ * 	initialization process then opens a UDP socket on @p GOSSIP_PORT, 5099
+ * 	by default, and hands it to the Reactor, which joins the group as soon
+ * 	as there is a network to join it on.  Every kiosk on the same LAN
+ * 	must use the same group and port.  It must run after the User Handler
+ * 	has been initialized.
+ *
+ * 	@section gossip	Gossip
+ *
+ * 	Each kiosk keeps its own idea of who is signed in, and without this
+ * 	only learns what another kiosk did at the next update from the server.
+ * 	A student who signed in at one door and taps out at another would be
+ * 	greeted with hello, and then corrected once the server had replied.
+ * 	Instead, every sign in or out is also sent to the group as a small
+ * 	packet, and every other kiosk flips the user's flag in its own copy of
+ * 	the user table straight away.  The server stays in charge: each kiosk
+ * 	still tells it about its own taps, and its replies still win.
+ *
+ * 	A packet is a @p Packet header followed by the PIN, with every number in
+ * 	network byte order.  It carries a number picked at random by the kiosk
+ * 	when it starts, and a sequence number that goes up by one for every
+ * 	packet that kiosk sends.  If the sequence number from a kiosk skips
+ * 	ahead, some of its packets were lost, and the user table is brought up
+ * 	to date from the server instead of guessing what they said.
+ *
+ */
+namespace Gossip {
+
+	/**
+	 * Fixed part of a packet, followed by @p pinLength bytes of PIN
+	 * magic: GOSSIP_MAGIC
+	 * format: GOSSIP_FORMAT
+	 * signedin: 1 if the user is now signed in, 0 if they are signed out
+	 * pinLength: Length of the PIN that follows
+	 * kiosk: Number the sending kiosk picked when it started
+	 * sequence: Position of this packet among those sent by the kiosk
+	 * time: When it happened, in seconds since the epoch
+	 */
+	struct Packet {
+		char magic[4];
+		uint8_t format;
+		uint8_t signedin;
+		uint8_t pinLength;
+		uint8_t reserved;
+		uint32_t kiosk;
+		uint32_t sequence;
+		uint32_t time;
+		char pin[GOSSIP_MAX_PIN];
+	} __attribute__((packed));
+
+	//Private declarations
+	void onPacket(uint32_t events, void* ctx);
+	void onRetry(uint32_t events, void* ctx);
+
+	///UDP socket, or -1 if gossip is turned off
+	int sock = -1;
+	///Timer for attempts to join the group
+	int retry = -1;
+	///The multicast group and port
+	struct sockaddr_in group;
+	///Whether the socket has joined the group
+	bool joined = false;
+
+	///Number identifying this kiosk until it restarts
+	uint32_t kiosk = 0;
+	///Sequence number of the last packet sent
+	std::atomic<uint32_t> sequence(0);
+	///Sequence number of the last packet received from each kiosk
+	std::map<uint32_t, uint32_t> peers;
+
+	/*!	Check whether gossip is turned on.
+	 */
+	bool enabled() {
+		return sock >= 0;
+	}
+
+	/*!	Tell the other kiosks about a sign in or out.
+	 *
+	 * 	Can be called from any thread, and never blocks.  A packet that
+	 * 	can't be sent still uses up its sequence number, so the other kiosks
+	 * 	notice the gap and ask the server instead.
+	 */
+	void announce(const std::string& pin, bool signedin) {
+		if(sock < 0) {
+			return;
+		}
+		if(pin.length() > GOSSIP_MAX_PIN) {
+			Log::warn("PIN is too long to tell the other kiosks about\n");
+			return;
+		}
+		Packet packet = {};
+		memcpy(packet.magic, GOSSIP_MAGIC, sizeof(packet.magic));
+		packet.format = GOSSIP_FORMAT;
+		packet.signedin = signedin ? 1 : 0;
+		packet.pinLength = (uint8_t) pin.length();
+		packet.kiosk = htonl(kiosk);
+		packet.sequence = htonl(++sequence);
+		packet.time = htonl((uint32_t) std::time(0));
+		memcpy(packet.pin, pin.data(), pin.length());
+		if(sendto(sock, &packet, offsetof(Packet, pin) + pin.length(),
+				MSG_DONTWAIT, (struct sockaddr*) &group, sizeof(group)) < 0) {
+			//Not on a network right now, the server still hears about it
+		}
+	}
+
+	/*!	Join the multicast group.
+	 *
+	 * 	This fails until an interface with a route for the group is up.
+	 */
+	void join() {
+		struct ip_mreq request = {};
+		request.imr_multiaddr = group.sin_addr;
+		request.imr_interface.s_addr = htonl(INADDR_ANY);
+		if(setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request,
+				sizeof(request)) == 0 || errno == EADDRINUSE) {
+			joined = true;
+			Log::info("Joined gossip group %s\n", inet_ntoa(group.sin_addr));
+		}
+	}
+
+	/*!	Handle one packet.
+	 *
+	 * 	@returns	@p true if packets from its sender were missed
+	 */
+	bool handle(const Packet& packet, ssize_t length) {
+		//Check that it is one of ours
+		if(length < (ssize_t) offsetof(Packet, pin) ||
+				memcmp(packet.magic, GOSSIP_MAGIC, sizeof(packet.magic)) != 0 ||
+				packet.format != GOSSIP_FORMAT ||
+				packet.pinLength > GOSSIP_MAX_PIN ||
+				length != (ssize_t) (offsetof(Packet, pin) + packet.pinLength)) {
+			return false;
+		}
+		uint32_t from = ntohl(packet.kiosk);
+		uint32_t seq = ntohl(packet.sequence);
+		if(from == kiosk) {
+			return false;
+		}
+		//Check for duplicates and gaps
+		bool missed = false;
+		auto peer = peers.find(from);
+		if(peer != peers.end()) {
+			if((int32_t) (seq - peer->second) <= 0) {
+				return false;
+			}
+			missed = seq != peer->second + 1;
+			peer->second = seq;
+		} else {
+			//Whatever it sent before we were listening is in the server's table
+			peers[from] = seq;
+		}
+		//A sign in from long ago may have been undone since
+		int32_t age = (int32_t) ((uint32_t) std::time(0) - ntohl(packet.time));
+		if(age > GOSSIP_MAX_AGE || age < -GOSSIP_MAX_AGE) {
+			return missed;
+		}
+		UserHandler::applyRemote(std::string(packet.pin, packet.pinLength),
+			packet.signedin != 0);
+		return missed;
+	}
+
+	/*!	Read and handle every packet waiting on the socket.
+	 */
+	void receive() {
+		bool missed = false;
+		while(true) {
+			Packet packet;
+			ssize_t length = recv(sock, &packet, sizeof(packet), MSG_DONTWAIT);
+			if(length < 0) {
+				break;
+			}
+			missed = handle(packet, length) || missed;
+		}
+		if(missed) {
+			Log::warn("Missed sign ins from another kiosk, updating the users\n");
+			UserHandler::requestUpdate();
+		}
+	}
+
+	/*!	Socket handler.
+	 *
+	 * 	Runs on the reactor thread whenever a packet has arrived.
+	 */
+	void onPacket(uint32_t events, void* ctx) {
+		receive();
+	}
+
+	/*!	Join timer handler.
+	 *
+	 * 	Runs on the reactor thread every few seconds until the group has been
+	 * 	joined.
+	 */
+	void onRetry(uint32_t events, void* ctx) {
+		join();
+		if(joined) {
+			Reactor::disarm(retry);
+		}
+	}
+
+	/*!	Gossip Initialization Method.
+	 *
+	 * 	This method opens the socket and hands it to the reactor, if
+	 * 	@p GOSSIP_GROUP is set.
+	 */
+	void init() {
+		//Initialize gossip
+		printf(LOADING "Initializing Gossip...");
+		fflush(stdout);
+
+		const char* address = getenv("GOSSIP_GROUP");
+		if(address == nullptr) {
+			//Turned off
+			printf(OKAY "\n");
+			return;
+		}
+		group = {};
+		group.sin_family = AF_INET;
+		group.sin_port = htons(GOSSIP_DEFAULT_PORT);
+		const char* port = getenv("GOSSIP_PORT");
+		if(port != nullptr && atoi(port) > 0 && atoi(port) < 65536) {
+			group.sin_port = htons(atoi(port));
+		}
+		if(inet_pton(AF_INET, address, &group.sin_addr) != 1 ||
+				!IN_MULTICAST(ntohl(group.sin_addr.s_addr))) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("GOSSIP_GROUP is not a multicast address");
+		}
+
+		sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+		if(sock < 0) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to open the gossip socket");
+		}
+		//Every kiosk listens on the same port, and only on this LAN
+		int yes = 1, no = 0, ttl = 1;
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+		setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, &no, sizeof(no));
+		struct sockaddr_in local = {};
+		local.sin_family = AF_INET;
+		local.sin_port = group.sin_port;
+		local.sin_addr.s_addr = htonl(INADDR_ANY);
+		if(bind(sock, (struct sockaddr*) &local, sizeof(local)) < 0) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to bind the gossip socket");
+		}
+		//Tell this run apart from the last one
+		std::random_device random;
+		kiosk = random();
+
+		//Start listening, and keep trying to join until there is a network
+		if(!Reactor::watch(sock, EPOLLIN, onPacket, nullptr)) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to watch the gossip socket");
+		}
+		try {
+			retry = Reactor::timer(onRetry, nullptr);
+		} catch(const std::exception& e) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw;
+		}
+		Reactor::arm(retry, 0, GOSSIP_JOIN_RETRY);
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/*!	Gossip Destruction Method.
+	 *
+	 * 	This method takes the socket back from the reactor and closes it.
+	 */
+	void destroy() {
+		//Destroy gossip
+		printf(LOADING "Destroying Gossip...");
+		fflush(stdout);
+
+		if(sock >= 0) {
+			Reactor::remove(retry);
+			Reactor::remove(sock);
+			int closing = sock;
+			sock = -1;
+			close(closing);
+		}
+
+		//Success
+		printf(OKAY "\n");
+	}
+}
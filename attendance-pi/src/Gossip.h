@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+namespace Gossip {
+
+	void init();
+	void destroy();
+
+	void announce(const std::string& pin, bool signedin);
+	bool enabled();
+}
@@ -0,0 +1,132 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Hal.h"
+
+#include <bcm2835.h>
+
+namespace Hal {
+
+	/**
+	 * GPIO pins through the bcm2835 library
+	 */
+	class Bcm2835Gpio : public Gpio {
+		public:
+			void input(uint8_t pin, Pull pull) {
+				bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_INPT);
+				bcm2835_gpio_set_pud(pin, pull == PULL_UP ? BCM2835_GPIO_PUD_UP :
+					pull == PULL_DOWN ? BCM2835_GPIO_PUD_DOWN : BCM2835_GPIO_PUD_OFF);
+			}
+			void output(uint8_t pin) {
+				bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_OUTP);
+			}
+			void write(uint8_t pin, bool high) {
+				bcm2835_gpio_write(pin, high ? HIGH : LOW);
+			}
+			bool read(uint8_t pin) {
+				return bcm2835_gpio_lev(pin) == HIGH;
+			}
+	};
+
+	/**
+	 * I2C master through the bcm2835 library
+	 */
+	class Bcm2835I2c : public I2c {
+		public:
+			bool begin() {
+				return bcm2835_i2c_begin();
+			}
+			void end() {
+				bcm2835_i2c_end();
+			}
+			void setAddress(uint8_t address) {
+				bcm2835_i2c_setSlaveAddress(address);
+			}
+			void setBaudrate(uint32_t baud) {
+				bcm2835_i2c_set_baudrate(baud);
+			}
+			uint8_t write(const char* data, uint32_t length) {
+				uint8_t reason = bcm2835_i2c_write(data, length);
+				return reason == BCM2835_I2C_REASON_OK ? I2C_OK : reason;
+			}
+	};
+
+	/**
+	 * SPI master through the bcm2835 library
+	 */
+	class Bcm2835Spi : public Spi {
+		public:
+			bool begin() {
+				if(!bcm2835_spi_begin()) {
+					return false;
+				}
+				bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);
+				bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);
+				return true;
+			}
+			void end() {
+				bcm2835_spi_end();
+			}
+			void setClockDivider(uint16_t divider) {
+				bcm2835_spi_setClockDivider(divider);
+			}
+			void chipSelect(uint8_t cs) {
+				bcm2835_spi_chipSelect(cs);
+				bcm2835_spi_setChipSelectPolarity(cs, LOW);
+			}
+			uint8_t transfer(uint8_t value) {
+				return bcm2835_spi_transfer(value);
+			}
+			void transfern(char* data, uint32_t length) {
+				bcm2835_spi_transfern(data, length);
+			}
+	};
+
+	Bcm2835Gpio realGpio;
+	Bcm2835I2c realI2c;
+	Bcm2835Spi realSpi;
+
+	///Installed implementations
+	Gpio* currentGpio = &realGpio;
+	I2c* currentI2c = &realI2c;
+	Spi* currentSpi = &realSpi;
+	///Whether the real implementations are in use
+	bool real = true;
+
+	/*!	Open the hardware.
+	 *
+	 * 	Only does anything while the real implementations are installed.
+	 */
+	bool init() {
+		return !real || bcm2835_init();
+	}
+
+	/*!	Close the hardware.
+	 */
+	bool close() {
+		return !real || bcm2835_close();
+	}
+
+	Gpio& gpio() {
+		return *currentGpio;
+	}
+
+	I2c& i2c() {
+		return *currentI2c;
+	}
+
+	Spi& spi() {
+		return *currentSpi;
+	}
+
+	/*!	Install other implementations.
+	 *
+	 * 	Must be called before any module is initialized.  Once anything has
+	 * 	been replaced the bcm2835 library is no longer opened or closed.
+	 */
+	void install(Gpio* g, I2c* i, Spi* s) {
+		currentGpio = g;
+		currentI2c = i;
+		currentSpi = s;
+		real = false;
+	}
+}
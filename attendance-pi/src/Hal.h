@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+
+/*!	Hardware access.
+ *
+ * 	Every module reaches the GPIO pins, the I2C bus and the SPI bus through
+ * 	these interfaces rather than calling the bcm2835 library directly.  The
+ * 	real implementations are installed by default; another implementation,
+ * 	such as the recording fakes in HalFake.h, can be installed before the
+ * 	modules are initialized so they can run without the hardware.
+ */
+namespace Hal {
+
+	typedef enum {
+		PULL_OFF,
+		PULL_DOWN,
+		PULL_UP
+	} Pull;
+
+	///Result of an I2C write that went through
+	const uint8_t I2C_OK = 0;
+
+	/**
+	 * GPIO pins, numbered as the bcm2835 library does
+	 */
+	class Gpio {
+		public:
+			virtual ~Gpio() {}
+			virtual void input(uint8_t pin, Pull pull) = 0;
+			virtual void output(uint8_t pin) = 0;
+			virtual void write(uint8_t pin, bool high) = 0;
+			virtual bool read(uint8_t pin) = 0;
+	};
+
+	/**
+	 * I2C master
+	 */
+	class I2c {
+		public:
+			virtual ~I2c() {}
+			virtual bool begin() = 0;
+			virtual void end() = 0;
+			virtual void setAddress(uint8_t address) = 0;
+			virtual void setBaudrate(uint32_t baud) = 0;
+			///Returns @p I2C_OK, or the reason the write failed
+			virtual uint8_t write(const char* data, uint32_t length) = 0;
+	};
+
+	/**
+	 * SPI master, in mode 0 with the most significant bit first
+	 */
+	class Spi {
+		public:
+			virtual ~Spi() {}
+			virtual bool begin() = 0;
+			virtual void end() = 0;
+			virtual void setClockDivider(uint16_t divider) = 0;
+			virtual void chipSelect(uint8_t cs) = 0;
+			virtual uint8_t transfer(uint8_t value) = 0;
+			///Sends @p length bytes from @p data, replacing them with the reply
+			virtual void transfern(char* data, uint32_t length) = 0;
+	};
+
+	bool init();
+	bool close();
+
+	Gpio& gpio();
+	I2c& i2c();
+	Spi& spi();
+
+	void install(Gpio*, I2c*, Spi*);
+}
@@ -0,0 +1,196 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "HalFake.h"
+
+namespace Hal {
+
+	void FakeGpio::input(uint8_t pin, Pull pull) {
+		std::lock_guard<std::mutex> guard(lock);
+		//Pins float to wherever they are pulled
+		levels[pin] = pull == PULL_UP;
+	}
+
+	void FakeGpio::output(uint8_t pin) {
+		std::lock_guard<std::mutex> guard(lock);
+		levels[pin] = false;
+	}
+
+	void FakeGpio::write(uint8_t pin, bool high) {
+		std::lock_guard<std::mutex> guard(lock);
+		levels[pin] = high;
+		written.push_back({ pin, high });
+	}
+
+	bool FakeGpio::read(uint8_t pin) {
+		std::lock_guard<std::mutex> guard(lock);
+		return levels[pin];
+	}
+
+	/*!	Drive an input pin, as a key or a reader would.
+	 */
+	void FakeGpio::set(uint8_t pin, bool high) {
+		std::lock_guard<std::mutex> guard(lock);
+		levels[pin] = high;
+	}
+
+	/*!	Get every write made to an output pin so far.
+	 */
+	std::vector<FakeGpio::Write> FakeGpio::writes() {
+		std::lock_guard<std::mutex> guard(lock);
+		return written;
+	}
+
+	FakeI2c::FakeI2c() {
+		failure = I2C_OK;
+		total = 0;
+	}
+
+	bool FakeI2c::begin() {
+		return true;
+	}
+
+	void FakeI2c::end() {}
+
+	void FakeI2c::setAddress(uint8_t address) {}
+
+	void FakeI2c::setBaudrate(uint32_t baud) {}
+
+	uint8_t FakeI2c::write(const char* data, uint32_t length) {
+		std::lock_guard<std::mutex> guard(lock);
+		sent.push_back(std::string(data, length));
+		total += length;
+		return failure;
+	}
+
+	/*!	Make every following write fail with @p reason, or succeed again if
+	 * 	it is @p I2C_OK.
+	 */
+	void FakeI2c::failWith(uint8_t reason) {
+		std::lock_guard<std::mutex> guard(lock);
+		failure = reason;
+	}
+
+	/*!	Get every transfer made so far.
+	 */
+	std::vector<std::string> FakeI2c::transfers() {
+		std::lock_guard<std::mutex> guard(lock);
+		return sent;
+	}
+
+	/*!	Get the number of bytes written so far.
+	 */
+	size_t FakeI2c::bytes() {
+		std::lock_guard<std::mutex> guard(lock);
+		return total;
+	}
+
+	FakeSpi::FakeSpi() {
+		responder = nullptr;
+		context = nullptr;
+	}
+
+	bool FakeSpi::begin() {
+		return true;
+	}
+
+	void FakeSpi::end() {}
+
+	void FakeSpi::setClockDivider(uint16_t divider) {}
+
+	void FakeSpi::chipSelect(uint8_t cs) {}
+
+	uint8_t FakeSpi::transfer(uint8_t value) {
+		std::lock_guard<std::mutex> guard(lock);
+		bytes.push_back(value);
+		return responder == nullptr ? 0 : responder(value, context);
+	}
+
+	void FakeSpi::transfern(char* data, uint32_t length) {
+		std::lock_guard<std::mutex> guard(lock);
+		for(uint32_t i = 0; i < length; i++) {
+			uint8_t value = (uint8_t) data[i];
+			bytes.push_back(value);
+			data[i] = (char) (responder == nullptr ? 0 : responder(value, context));
+		}
+	}
+
+	/*!	Answer every following transfer with @p responder.
+	 */
+	void FakeSpi::respond(Responder r, void* c) {
+		std::lock_guard<std::mutex> guard(lock);
+		responder = r;
+		context = c;
+	}
+
+	/*!	Get every byte sent so far.
+	 */
+	std::vector<uint8_t> FakeSpi::sent() {
+		std::lock_guard<std::mutex> guard(lock);
+		return bytes;
+	}
+
+	/*!	Answer a request with the canned response for its URL.
+	 *
+	 * 	URLs that have not been given a response can't be connected to.
+	 */
+	CURLcode FakeHttp::perform(const char* url, const std::string& etag,
+			bool headOnly, const std::string* body, Http::Sink sink,
+			void* context, Http::Response& response) {
+		Answer answer;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			requested.push_back(url);
+			if(body != nullptr) {
+				posted.push_back(*body);
+			}
+			auto it = answers.find(url);
+			if(it == answers.end()) {
+				return CURLE_COULDNT_CONNECT;
+			}
+			answer = it->second;
+		}
+		if(answer.result != CURLE_OK) {
+			return answer.result;
+		}
+		response.status = answer.status;
+		if(headOnly) {
+			return CURLE_OK;
+		}
+		bool success = answer.status >= 200 && answer.status < 300;
+		if(sink == nullptr || !success) {
+			response.body = answer.body;
+		} else if(!sink(answer.body.data(), answer.body.size(), context)) {
+			return CURLE_WRITE_ERROR;
+		}
+		return CURLE_OK;
+	}
+
+	/*!	Answer @p url with @p status and @p body from now on.
+	 */
+	void FakeHttp::respond(const std::string& url, long status,
+			const std::string& body) {
+		std::lock_guard<std::mutex> guard(lock);
+		answers[url] = { CURLE_OK, status, body };
+	}
+
+	/*!	Fail requests for @p url with @p result from now on.
+	 */
+	void FakeHttp::fail(const std::string& url, CURLcode result) {
+		std::lock_guard<std::mutex> guard(lock);
+		answers[url] = { result, 0, "" };
+	}
+
+	/*!	Get the URL of every request made so far.
+	 */
+	std::vector<std::string> FakeHttp::requests() {
+		std::lock_guard<std::mutex> guard(lock);
+		return requested;
+	}
+
+	/*!	Get the body of every post made so far.
+	 */
+	std::vector<std::string> FakeHttp::bodies() {
+		std::lock_guard<std::mutex> guard(lock);
+		return posted;
+	}
+}
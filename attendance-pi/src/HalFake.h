@@ -0,0 +1,129 @@
+#pragma once
+
+#include "Hal.h"
+#include "Http.h"
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*!	Recording fakes for the hardware and the server.
+ *
+ * 	Each fake remembers everything done to it and answers with whatever it
+ * 	has been told to, so that the modules can be driven and timed on a
+ * 	machine with no display, reader, keypad or server.  Install them with
+ * 	Hal::install() and Http::install() before initializing the modules.
+ */
+namespace Hal {
+
+	/**
+	 * GPIO pins that read back whatever they were set to
+	 */
+	class FakeGpio : public Gpio {
+		public:
+			/**
+			 * A write to an output pin
+			 */
+			struct Write {
+				uint8_t pin;
+				bool high;
+			};
+
+			void input(uint8_t pin, Pull pull);
+			void output(uint8_t pin);
+			void write(uint8_t pin, bool high);
+			bool read(uint8_t pin);
+
+			void set(uint8_t pin, bool high);
+			std::vector<Write> writes();
+
+		private:
+			std::mutex lock;
+			std::map<uint8_t, bool> levels;
+			std::vector<Write> written;
+	};
+
+	/**
+	 * I2C master that keeps every transfer
+	 */
+	class FakeI2c : public I2c {
+		public:
+			FakeI2c();
+
+			bool begin();
+			void end();
+			void setAddress(uint8_t address);
+			void setBaudrate(uint32_t baud);
+			uint8_t write(const char* data, uint32_t length);
+
+			void failWith(uint8_t reason);
+			std::vector<std::string> transfers();
+			size_t bytes();
+
+		private:
+			std::mutex lock;
+			uint8_t failure;
+			size_t total;
+			std::vector<std::string> sent;
+	};
+
+	/**
+	 * SPI master that keeps every byte sent, and answers from a function
+	 */
+	class FakeSpi : public Spi {
+		public:
+			///Works out the reply to @p value, the last byte sent
+			typedef uint8_t (*Responder)(uint8_t value, void* context);
+
+			FakeSpi();
+
+			bool begin();
+			void end();
+			void setClockDivider(uint16_t divider);
+			void chipSelect(uint8_t cs);
+			uint8_t transfer(uint8_t value);
+			void transfern(char* data, uint32_t length);
+
+			void respond(Responder responder, void* context);
+			std::vector<uint8_t> sent();
+
+		private:
+			std::mutex lock;
+			Responder responder;
+			void* context;
+			std::vector<uint8_t> bytes;
+	};
+
+	/**
+	 * Server that answers every URL with a canned response
+	 */
+	class FakeHttp : public Http::Transport {
+		public:
+			CURLcode perform(const char* url, const std::string& etag,
+				bool headOnly, const std::string* body, Http::Sink sink,
+				void* context, Http::Response& response);
+
+			void respond(const std::string& url, long status,
+				const std::string& body);
+			void fail(const std::string& url, CURLcode result);
+			std::vector<std::string> requests();
+			std::vector<std::string> bodies();
+
+		private:
+			/**
+			 * What a URL is answered with
+			 */
+			struct Answer {
+				CURLcode result;
+				long status;
+				std::string body;
+			};
+
+			std::mutex lock;
+			std::map<std::string, Answer> answers;
+			std::vector<std::string> requested;
+			std::vector<std::string> posted;
+	};
+}
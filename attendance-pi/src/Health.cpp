@@ -0,0 +1,197 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Health.h"
+#include "Http.h"
+#include "Log.h"
+#include "ANSI.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <string>
+
+///Shortest time between two probes, in milliseconds
+#define HEALTH_MIN_INTERVAL			1000
+///Default longest time between two probes while offline, in seconds
+#define HEALTH_DEFAULT_MAX_BACKOFF	300
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The initialization process for the health checker reads its settings.
+ * 	It must run after the HTTP client has been initialized.
+ *
+ * 	@section probe	Probe
+ *
+ * 	Finding out whether the server can be reached used to mean downloading
+ * 	the whole of @p API_BASEURL, once a second, for as long as the server
+ * 	was down.  The probe is a head request instead, to @p HEALTH_URL if it
+ * 	is set and to @p API_BASEURL otherwise, made over a pooled connection
+ * 	so that once the server is back the following requests reuse it.  Any
+ * 	reply at all counts as reachable.  Anything that keeps a request from
+ * 	getting a reply counts as a failure, TLS errors included, the same way
+ * 	Http::outcome() judges every other request.
+ *
+ * 	@section backoff	Backoff
+ *
+ * 	After each consecutive failure, whether of a probe or of a request the
+ * 	caller reports with reportFailure(), the time until the next probe is
+ * 	allowed doubles, up to @p HEALTH_MAX_BACKOFF seconds.  Each wait is
+ * 	then picked at random between half and all of that, so that a room of
+ * 	kiosks which lost the server at the same moment don't all come back to
+ * 	it at the same moment.  When a network link comes up the schedule is
+ * 	reset, since that is the most likely time for the server to be back.
+ *
+ */
+namespace Health {
+
+	///Guards everything below
+	std::mutex lock;
+
+	///URL probed
+	std::string url;
+	///Longest time between two probes, in milliseconds
+	long maxBackoff = HEALTH_DEFAULT_MAX_BACKOFF * 1000L;
+
+	///Time the next probe is allowed
+	std::chrono::steady_clock::time_point nextProbe;
+	///Number of failures since the last success
+	int failureCount = 0;
+	///Round trip time of the last successful probe, in milliseconds
+	double rtt = -1;
+
+	///Jitter source
+	std::minstd_rand random;
+
+	/*!	Schedule the next probe after a failure.
+	 *
+	 * 	Must be called with @p lock held.
+	 *
+	 * 	@returns	The wait, in milliseconds
+	 */
+	long backOff() {
+		failureCount++;
+		long wait = HEALTH_MIN_INTERVAL;
+		for(int i = 1; i < failureCount && wait < maxBackoff; i++) {
+			wait *= 2;
+		}
+		if(wait > maxBackoff) {
+			wait = maxBackoff;
+		}
+		//Pick somewhere between half and all of it
+		wait = wait / 2 + (long) (random() % (unsigned long) (wait / 2 + 1));
+		nextProbe = std::chrono::steady_clock::now() +
+			std::chrono::milliseconds(wait);
+		return wait;
+	}
+
+	/*!	Check whether a probe is allowed yet.
+	 */
+	bool ready() {
+		std::lock_guard<std::mutex> guard(lock);
+		return std::chrono::steady_clock::now() >= nextProbe;
+	}
+
+	/*!	Probe the server.
+	 *
+	 * 	Records the round trip time on success, and backs off on failure.
+	 *
+	 * 	@returns	@p true if the server answered
+	 */
+	bool probe() {
+		Http::Response response;
+		CURLcode result = Http::head(url.c_str(), response);
+		//The same test the requests themselves go by
+		bool reachable = Http::outcome(result) == Http::REACHED;
+
+		std::lock_guard<std::mutex> guard(lock);
+		if(!reachable) {
+			long wait = backOff();
+			Log::warn("Server unreachable (CURL error %i, %d in a row), "
+				"next try in %ld ms\n", result, failureCount, wait);
+			return false;
+		}
+		rtt = response.time * 1000.0;
+		if(failureCount > 0) {
+			Log::info("Server reachable after %d failures, RTT %.0f ms\n",
+				failureCount, rtt);
+		}
+		failureCount = 0;
+		nextProbe = std::chrono::steady_clock::now() +
+			std::chrono::milliseconds(HEALTH_MIN_INTERVAL);
+		return true;
+	}
+
+	/*!	Report that a request failed even though the probe succeeded.
+	 *
+	 * 	Backs off just like a failed probe, so that a server which answers
+	 * 	but can't serve requests isn't asked again every second.
+	 */
+	void reportFailure() {
+		std::lock_guard<std::mutex> guard(lock);
+		long wait = backOff();
+		Log::warn("Request failed (%d in a row), next try in %ld ms\n",
+			failureCount, wait);
+	}
+
+	/*!	Allow a probe straight away.
+	 *
+	 * 	Called by the network monitor when a link comes up.
+	 */
+	void linkUp() {
+		std::lock_guard<std::mutex> guard(lock);
+		nextProbe = std::chrono::steady_clock::now();
+	}
+
+	/*!	Get the round trip time of the last successful probe.
+	 *
+	 * 	@returns	The time in milliseconds, or -1 if no probe has succeeded
+	 */
+	double lastRtt() {
+		std::lock_guard<std::mutex> guard(lock);
+		return rtt;
+	}
+
+	/*!	Get the number of failures since the last success.
+	 */
+	int failures() {
+		std::lock_guard<std::mutex> guard(lock);
+		return failureCount;
+	}
+
+	/*!	Health Initialization Method.
+	 *
+	 * 	This method reads the probe URL and backoff limit.
+	 */
+	void init() {
+		//Initialize the health checker
+		printf(LOADING "Initializing Health...");
+		fflush(stdout);
+
+		const char* health = getenv("HEALTH_URL");
+		const char* base = getenv("API_BASEURL");
+		url = health != nullptr ? health : base != nullptr ? base : "";
+		const char* backoff = getenv("HEALTH_MAX_BACKOFF");
+		if(backoff != nullptr && atol(backoff) > 0) {
+			maxBackoff = atol(backoff) * 1000L;
+		}
+		random.seed((unsigned long) time(nullptr) ^ (unsigned long) getpid());
+		nextProbe = std::chrono::steady_clock::now();
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/*!	Health Destruction Method.
+	 */
+	void destroy() {
+		//Destroy the health checker
+		printf(LOADING "Destroying Health...");
+		fflush(stdout);
+
+		//Success
+		printf(OKAY "\n");
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+namespace Health {
+
+	void init();
+	void destroy();
+
+	bool ready();
+	bool probe();
+	void reportFailure();
+	void linkUp();
+
+	double lastRtt();
+	int failures();
+}
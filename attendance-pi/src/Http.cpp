@@ -0,0 +1,431 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Http.h"
+#include "ANSI.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <stdexcept>
+#include <vector>
+#include <mutex>
+
+///Default time allowed for connecting to the server, in seconds
+#define HTTP_DEFAULT_CONNECT_TIMEOUT	5
+///Default time allowed for a whole request, in seconds
+#define HTTP_DEFAULT_TIMEOUT			15
+///Number of idle handles kept around for reuse
+#define HTTP_POOL_SIZE					4
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The initialization process for the HTTP client performs the global curl
+ * 	initialization and creates the share object used by every request.  It
+ * 	must run before any other module talks to the server.
+ *
+ * 	@section conn_reuse	Connection Reuse
+ *
+ * 	Opening a new connection to the server means a DNS lookup, a TCP
+ * 	handshake and a TLS handshake, which on a Pi adds up to several hundred
+ * 	milliseconds.  Instead of creating and destroying a curl handle for every
+ * 	request, finished handles are returned to a small pool and reused, which
+ * 	keeps their connection to the server alive between requests.  All handles
+ * 	also use a common share object, so that the DNS cache, TLS sessions and
+ * 	open connections are shared between threads: a request made by the
+ * 	Sender can reuse the connection opened by the last roster update.
+ *
+ * 	The connect and total request timeouts can be changed with the
+ * 	@p HTTP_CONNECT_TIMEOUT and @p HTTP_TIMEOUT environment variables, both
+ * 	in seconds.
+ *
+ * 	@section http_blocking	Blocking Requests
+ *
+ * 	Every request blocks the calling thread until it has finished or timed
+ * 	out.  Requests are made from the Sender's thread and from jobs handed
+ * 	to the Reactor's worker, never from the reactor thread itself, and
+ * 	the event loop knows nothing about their sockets.
+ *
+ * 	@section transport	Transport
+ *
+ * 	Requests are carried out by a @p Transport, which is the pooled curl
+ * 	one unless another has been installed with install(), so that the
+ * 	modules talking to the server can be run against a fake one.
+ *
+ */
+namespace Http {
+
+	///Share object holding the DNS cache, TLS sessions and connections
+	CURLSH* share;
+	///Locks protecting each kind of shared data
+	std::mutex shareLocks[CURL_LOCK_DATA_LAST];
+
+	///Idle handles ready for reuse
+	std::vector<CURL*> pool;
+	std::mutex poolLock;
+
+	///Request timeouts, in seconds
+	long connectTimeout = HTTP_DEFAULT_CONNECT_TIMEOUT;
+	long timeout = HTTP_DEFAULT_TIMEOUT;
+
+	void lockShare(CURL* handle, curl_lock_data data, curl_lock_access access,
+			void* userptr) {
+		shareLocks[data].lock();
+	}
+
+	void unlockShare(CURL* handle, curl_lock_data data, void* userptr) {
+		shareLocks[data].unlock();
+	}
+
+	/**
+	 * Where a body goes
+	 * sink, context: The receiver passed to stream(), or null to collect the
+	 *  body in @p response
+	 * response: Collects the body instead if the request failed
+	 * handle: The handle performing the request
+	 * decided: Whether the status code has been checked yet
+	 * streaming: Whether the body is being passed to the sink
+	 */
+	struct StreamTarget {
+		Sink sink;
+		void* context;
+		Response* response;
+		CURL* handle;
+		bool decided;
+		bool streaming;
+	};
+
+	/*! Request callback method
+	 *
+	 * 	This method passes data read by curl straight to the sink.  Error pages
+	 * 	are not something the sink can make sense of, so unless the status is a
+	 * 	success they are collected in the response body instead, as is every
+	 * 	body when there is no sink.
+	 */
+	size_t writeCallback(char *ptr, size_t size, size_t nmemb,
+			StreamTarget* target) {
+		size_t realsize = size * nmemb;
+		if(target->sink == nullptr) {
+			target->response->body.append(ptr, realsize);
+			return realsize;
+		}
+		if(!target->decided) {
+			long status = 0;
+			curl_easy_getinfo(target->handle, CURLINFO_RESPONSE_CODE, &status);
+			target->streaming = status >= 200 && status < 300;
+			target->decided = true;
+		}
+		if(!target->streaming) {
+			target->response->body.append(ptr, realsize);
+			return realsize;
+		}
+		//Returning less than was given makes curl abort the transfer
+		return target->sink(ptr, realsize, target->context) ? realsize : 0;
+	}
+
+	/*! Header callback method
+	 *
+	 * 	This method is called by curl for every header line of the response,
+	 * 	and picks out the ETag.
+	 */
+	size_t headerCallback(char *ptr, size_t size, size_t nmemb,
+			Response* response) {
+		size_t realsize = size * nmemb;
+		if(realsize > 5 && strncasecmp(ptr, "ETag:", 5) == 0) {
+			std::string value(ptr + 5, realsize - 5);
+			//Trim the whitespace and line ending
+			size_t start = value.find_first_not_of(" \t");
+			size_t end = value.find_last_not_of(" \t\r\n");
+			response->etag = start == std::string::npos ?
+				"" : value.substr(start, end - start + 1);
+		}
+		return realsize;
+	}
+
+	/*!	Read a timeout from the environment.
+	 */
+	long envTimeout(const char* name, long fallback) {
+		const char* value = getenv(name);
+		if(value == nullptr) {
+			return fallback;
+		}
+		long t = atol(value);
+		return t > 0 ? t : fallback;
+	}
+
+	/*!	Handle factory.
+	 *
+	 * 	Creates a new curl handle with all of the options that are common to
+	 * 	every request made to the server.
+	 */
+	CURL* createHandle() {
+		CURL* handle = curl_easy_init();
+		if(handle == nullptr) {
+			return nullptr;
+		}
+		//Share caches and connections with the other handles
+		curl_easy_setopt(handle, CURLOPT_SHARE, share);
+		//Never use signals, this is used from several threads
+		curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+		//Set the timeouts
+		curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, connectTimeout);
+		curl_easy_setopt(handle, CURLOPT_TIMEOUT, timeout);
+		//Keep idle connections from being silently dropped
+		curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(handle, CURLOPT_TCP_KEEPIDLE, 30L);
+		curl_easy_setopt(handle, CURLOPT_TCP_KEEPINTVL, 15L);
+		//Enable authentication
+		curl_easy_setopt(handle, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+		//Set the username
+		curl_easy_setopt(handle, CURLOPT_USERNAME, getenv("HTTP_USERNAME"));
+		//Set the password
+		curl_easy_setopt(handle, CURLOPT_PASSWORD, getenv("HTTP_PASSWORD"));
+		curl_easy_setopt(handle, CURLOPT_USE_SSL, CURLUSESSL_TRY);
+		//Set the header callback, the body callback is set per request
+		curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, Http::headerCallback);
+		return handle;
+	}
+
+	/*!	Take a handle from the pool, or create one if it is empty.
+	 */
+	CURL* acquire() {
+		{
+			std::lock_guard<std::mutex> lock(poolLock);
+			if(!pool.empty()) {
+				CURL* handle = pool.back();
+				pool.pop_back();
+				return handle;
+			}
+		}
+		return createHandle();
+	}
+
+	/*!	Return a handle to the pool, or destroy it if the pool is full.
+	 */
+	void release(CURL* handle) {
+		{
+			std::lock_guard<std::mutex> lock(poolLock);
+			if(pool.size() < HTTP_POOL_SIZE) {
+				pool.push_back(handle);
+				return;
+			}
+		}
+		curl_easy_cleanup(handle);
+	}
+
+	/*!	HTTP Initialization Method.
+	 *
+	 * 	This method performs the global curl initialization and sets up the
+	 * 	share object.
+	 */
+	void init() {
+		//Initialize the HTTP client
+		printf(LOADING "Initializing HTTP...");
+		fflush(stdout);
+
+		//Perform global CURL initialization
+		if(curl_global_init(CURL_GLOBAL_SSL) != CURLE_OK) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to initialize curl");
+		}
+
+		//Read the timeouts
+		connectTimeout = envTimeout("HTTP_CONNECT_TIMEOUT",
+			HTTP_DEFAULT_CONNECT_TIMEOUT);
+		timeout = envTimeout("HTTP_TIMEOUT", HTTP_DEFAULT_TIMEOUT);
+
+		//Create the share object
+		share = curl_share_init();
+		curl_share_setopt(share, CURLSHOPT_LOCKFUNC, Http::lockShare);
+		curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, Http::unlockShare);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/*!	HTTP Destruction Method.
+	 *
+	 * 	This method closes every pooled connection and performs the global
+	 * 	curl cleanup.  No requests may be in progress.
+	 */
+	void destroy() {
+		//Destroy the HTTP client
+		printf(LOADING "Destroying HTTP...");
+		fflush(stdout);
+
+		for(size_t i = 0; i < pool.size(); i++) {
+			curl_easy_cleanup(pool[i]);
+		}
+		pool.clear();
+		curl_share_cleanup(share);
+		curl_global_cleanup();
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/**
+	 * Transport carrying requests out with pooled curl handles
+	 */
+	class CurlTransport : public Transport {
+		public:
+			/*!	Request method.
+			 *
+			 * 	This method performs a get request with a pooled handle.  If
+			 * 	@p headOnly is set, a head request is made instead and there is
+			 * 	no body.  If @p body is given, it is posted as JSON instead.
+			 */
+			CURLcode perform(const char* url, const std::string& etag,
+					bool headOnly, const std::string* body, Sink sink, void* context,
+					Response& response) {
+				CURL* handle = acquire();
+				if(handle == nullptr) {
+					return CURLE_FAILED_INIT;
+				}
+				StreamTarget target = {sink, context, &response, handle, false, false};
+				//Set the url
+				curl_easy_setopt(handle, CURLOPT_URL, url);
+				curl_easy_setopt(handle, CURLOPT_HTTPGET, 1L);
+				//Setting HTTPGET clears this, so a pooled handle goes back to a get
+				if(headOnly) {
+					curl_easy_setopt(handle, CURLOPT_NOBODY, 1L);
+				}
+				//So does a post, which curl reads straight from the string
+				if(body != nullptr) {
+					curl_easy_setopt(handle, CURLOPT_POSTFIELDS, body->data());
+					curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE, (long) body->size());
+				}
+				//Tell curl where to write the response
+				curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION,
+					(curl_write_callback) Http::writeCallback);
+				curl_easy_setopt(handle, CURLOPT_WRITEDATA, &target);
+				curl_easy_setopt(handle, CURLOPT_HEADERDATA, &response);
+				//Add the condition, if any
+				struct curl_slist* headers = nullptr;
+				if(!etag.empty()) {
+					headers = curl_slist_append(headers,
+						("If-None-Match: " + etag).c_str());
+				}
+				if(body != nullptr) {
+					headers = curl_slist_append(headers,
+						"Content-Type: application/json");
+				}
+				curl_easy_setopt(handle, CURLOPT_HTTPHEADER, headers);
+				//Perform the ritual sacrifice / get request
+				CURLcode result = curl_easy_perform(handle);
+				curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &response.status);
+				curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &response.time);
+				//Don't leave the header list behind in the pooled handle
+				curl_easy_setopt(handle, CURLOPT_HTTPHEADER, (struct curl_slist*) nullptr);
+				curl_easy_setopt(handle, CURLOPT_POSTFIELDS, (const char*) nullptr);
+				curl_slist_free_all(headers);
+				release(handle);
+				return result;
+			}
+	};
+
+	CurlTransport curlTransport;
+	///Transport in use
+	Transport* transport = &curlTransport;
+
+	/*!	Install another transport.
+	 *
+	 * 	Must be called before any request is made.
+	 */
+	void install(Transport* t) {
+		transport = t;
+	}
+
+	/*!	Perform a request with the installed transport.
+	 */
+	CURLcode perform(const char* url, Response& response,
+			const std::string& etag, bool headOnly, const std::string* body,
+			Sink sink, void* context) {
+		response.status = 0;
+		response.body.clear();
+		response.etag.clear();
+		response.time = 0;
+		return transport->perform(url, etag, headOnly, body, sink, context,
+			response);
+	}
+
+	/*!	GET request method.
+	 *
+	 * 	This method sends a get request to the URL passed in @p url using a
+	 * 	pooled handle, and stores the server's reply in @p response.  It is
+	 * 	safe to call from any thread.
+	 *
+	 * 	If @p etag is given, the request is made conditional on it, and an
+	 * 	unchanged resource is answered with status 304 and an empty body.
+	 *
+	 * 	@returns	The curl result code, @p CURLE_OK on success
+	 */
+	CURLcode get(const char* url, Response& response, const std::string& etag) {
+		return perform(url, response, etag, false, nullptr, nullptr, nullptr);
+	}
+
+	/*!	HEAD request method.
+	 *
+	 * 	This method works like get(), except that only the status and headers
+	 * 	are asked for.  It is meant for finding out cheaply whether the server
+	 * 	can be reached, over a connection that can then be reused.
+	 *
+	 * 	@returns	The curl result code, @p CURLE_OK on success
+	 */
+	CURLcode head(const char* url, Response& response) {
+		return perform(url, response, "", true, nullptr, nullptr, nullptr);
+	}
+
+	/*!	POST request method.
+	 *
+	 * 	This method works like get(), except that @p body is posted to the
+	 * 	server as JSON.
+	 *
+	 * 	@returns	The curl result code, @p CURLE_OK on success
+	 */
+	CURLcode post(const char* url, const std::string& body, Response& response) {
+		return perform(url, response, "", false, &body, nullptr, nullptr);
+	}
+
+	/*!	Streaming GET request method.
+	 *
+	 * 	This method works like get(), except that a successful response body is
+	 * 	passed to @p sink piece by piece as it arrives instead of being stored
+	 * 	in @p response.  If the sink returns @p false the transfer is aborted
+	 * 	and @p CURLE_WRITE_ERROR is returned.  The bodies of unsuccessful
+	 * 	responses are still stored in @p response so they can be reported.
+	 *
+	 * 	@returns	The curl result code, @p CURLE_OK on success
+	 */
+	CURLcode stream(const char* url, Response& response, Sink sink,
+			void* context, const std::string& etag) {
+		return perform(url, response, etag, false, nullptr, sink, context);
+	}
+
+	/*!	Request outcome method.
+	 *
+	 * 	Tells what the result of a request says about the server, so that the
+	 * 	health probe and the requests themselves agree on when it is down.
+	 * 	Failing to resolve, connect or set up TLS all happen before the
+	 * 	request is sent.  Anything else, a timeout in particular, may have
+	 * 	come after.
+	 *
+	 * 	@returns	The outcome of a request that ended with @p result
+	 */
+	Outcome outcome(CURLcode result) {
+		switch(result) {
+			case CURLE_OK:
+				return REACHED;
+			case CURLE_COULDNT_RESOLVE_PROXY:
+			case CURLE_COULDNT_RESOLVE_HOST:
+			case CURLE_COULDNT_CONNECT:
+			case CURLE_SSL_CONNECT_ERROR:
+			case CURLE_PEER_FAILED_VERIFICATION:
+				return NOT_SENT;
+			default:
+				return NO_REPLY;
+		}
+	}
+}
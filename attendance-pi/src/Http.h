@@ -0,0 +1,64 @@
+#pragma once
+
+#include <curl/curl.h>
+#include <string>
+
+namespace Http {
+
+	/**
+	 * The result of an HTTP request
+	 * status: The HTTP status code, or 0 if no response was received
+	 * body: The body of the response
+	 * etag: The ETag header sent by the server, if any
+	 * time: How long the request took, in seconds
+	 */
+	struct Response {
+		long status;
+		std::string body;
+		std::string etag;
+		double time;
+	};
+
+	/**
+	 * What a request's curl result says about the server
+	 */
+	typedef enum {
+		REACHED,		///< The server replied, whatever it said
+		NOT_SENT,		///< The connection never came up, so it saw nothing
+		NO_REPLY		///< It may have seen the request, but no reply came
+	} Outcome;
+
+	/**
+	 * Receiver for a streamed response body, returns false to abort
+	 */
+	typedef bool (*Sink)(const char* data, size_t length, void* context);
+
+	/**
+	 * Carries out requests for the functions below.  A curl transport is used
+	 * unless another one is installed.
+	 */
+	class Transport {
+		public:
+			virtual ~Transport() {}
+			/*!	Perform a get, a head request if @p headOnly is set, or a post
+			 * 	of the JSON in @p body if it isn't null.  A successful body is
+			 * 	passed to @p sink, or stored in @p response if @p sink is null;
+			 * 	any other body is stored in @p response.
+			 */
+			virtual CURLcode perform(const char* url, const std::string& etag,
+				bool headOnly, const std::string* body, Sink sink, void* context,
+				Response& response) = 0;
+	};
+
+	void init();
+	void destroy();
+	void install(Transport*);
+
+	CURLcode get(const char*, Response&, const std::string& etag = "");
+	CURLcode head(const char*, Response&);
+	CURLcode post(const char*, const std::string& body, Response&);
+	CURLcode stream(const char*, Response&, Sink, void* context,
+		const std::string& etag = "");
+
+	Outcome outcome(CURLcode);
+}
@@ -0,0 +1,246 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Input.h"
+#include "Keypad.h"
+#include "UserHandler.h"
+#include "Buzzer.h"
+#include "Clock.h"
+#include "State.h"
+#include "Metrics.h"
+#include "RFID.h"
+#include "Log.h"
+#include "ANSI.h"
+#include "Ring.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include <atomic>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+///Number of events the queue can hold, must be a power of two
+#define INPUT_QUEUE_SIZE	64
+///Time a second tap of the same card is ignored for
+#define INPUT_CARD_REPEAT	std::chrono::seconds(1)
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The initialization process for the Input bus creates the wakeup event
+ * 	and spawns the dispatcher thread.  It runs after every module the
+ * 	dispatcher calls into has been initialized.
+ *
+ * 	@section event_queue	Event Queue
+ *
+ * 	The RFID thread, and the Keypad and network monitor handlers on the
+ * 	Reactor thread, don't act on what they see themselves.  They post an
+ * 	@p Event to a bounded queue and go straight back to watching their
+ * 	device, and a single dispatcher thread takes the events off in order
+ * 	and hands them to the Keypad handler and the User Handler.  Posting
+ * 	never blocks and never takes a lock, since the queue is a @p Ring.  If
+ * 	the queue is ever full the new event is dropped.
+ *
+ * 	@section dispatcher	Dispatcher Thread
+ *
+ * 	Messages such as a greeting are left on the display for a moment by the
+ * 	Screen, which takes them down again on its own, so the dispatcher never
+ * 	waits for one.  A card goes straight back to READY once it has been
+ * 	handled, so a queue of students tapping one after another is served
+ * 	back-to-back, each greeting replacing the last, and a key pressed
+ * 	during a greeting is handled straight away.
+ *
+ * 	A card is ignored if the same reader saw it less than a second ago.
+ * 	Each reader is remembered separately, so taps on another reader in
+ * 	between don't let a card that is still being held get counted twice.
+ *
+ */
+namespace Input {
+
+	///The event queue, taken from by the dispatcher
+	Ring<Event, INPUT_QUEUE_SIZE> queue;
+
+	///Event used to wake the dispatcher
+	int wake = -1;
+
+	///Dispatcher thread
+	std::thread dispatcherThread;
+	///Thread termination condition
+	std::atomic<bool> run(true);
+
+	///UID of last card read on each reader - used to prevent reading same card multiple times
+	CardId lastUID[RFID_MAX_READERS];
+	///Time the last card was read on each reader - used to override @p lastUID condition
+	std::chrono::steady_clock::time_point lastCardTime[RFID_MAX_READERS];
+
+	/*!	Post an event.
+	 *
+	 * 	Can be called from any thread, and never blocks.
+	 *
+	 * 	@returns	@p false if the queue is full and the event was dropped
+	 */
+	bool post(const Event& event) {
+		if(!queue.push(event)) {
+			//The dispatcher hasn't caught up
+			Log::warn("Input queue is full, dropping an event\n");
+			return false;
+		}
+		//Wake the dispatcher
+		uint64_t one = 1;
+		if(write(wake, &one, sizeof(one)) < 0) {
+			//Not running yet, the event is picked up when it starts
+		}
+		return true;
+	}
+
+	/*!	Post a card tap.
+	 */
+	bool postCard(const CardId& uid, int reader) {
+		Event event;
+		event.type = CARD;
+		event.time = std::chrono::steady_clock::now();
+		event.uid = uid;
+		event.reader = reader;
+		event.key = '\0';
+		return post(event);
+	}
+
+	/*!	Post a key press.
+	 */
+	bool postKey(char key) {
+		Event event;
+		event.type = KEY;
+		event.time = std::chrono::steady_clock::now();
+		event.key = key;
+		return post(event);
+	}
+
+	/*!	Post a change in the network connections.
+	 */
+	bool postNetwork(bool wifi, bool ethernet) {
+		Event event;
+		event.type = NETWORK;
+		event.time = std::chrono::steady_clock::now();
+		event.key = '\0';
+		event.wifi = wifi;
+		event.ethernet = ethernet;
+		return post(event);
+	}
+
+	/*!	Card tap handler.
+	 */
+	void handleCard(const Event& event) {
+		//Ignore the same card being seen again straight away by the same reader
+		int reader = event.reader;
+		if(event.uid == lastUID[reader] &&
+				event.time - lastCardTime[reader] < INPUT_CARD_REPEAT) {
+			return;
+		}
+		lastUID[reader] = event.uid;
+		lastCardTime[reader] = event.time;
+		if(!State::takesCards(State::state)) {
+			Log::warn("Card tapped during illegal state\n");
+			return;
+		}
+
+		if (State::state == State::READ_ASSIGN_RFID) {
+			UserHandler::assignRfidToPin(State::assignRfidPin, event.uid);
+		} else {
+			//Trigger the event
+			UserHandler::triggerRfid(event.uid);
+			Metrics::record(Metrics::TAP_TO_GREETING,
+				std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - event.time).count());
+		}
+		//Beep
+		Buzzer::play(Buzzer::TAP);
+		//Drop any PIN that was half typed when the card came
+		Keypad::reset();
+		//The message stays up on its own
+		State::changeState(State::READY);
+	}
+
+	/*!	Event handler.
+	 */
+	void dispatch(const Event& event) {
+		switch(event.type) {
+			case CARD:
+				handleCard(event);
+				break;
+			case KEY:
+				Keypad::handle(event.key);
+				break;
+			case NETWORK:
+				State::haveWifi = event.wifi;
+				State::haveEthernet = event.ethernet;
+				//Redraw the connection icon
+				Clock::wakeup();
+				break;
+		}
+	}
+
+	/*!	Dispatcher thread.
+	 *
+	 * 	Handles every queued event, then sleeps until the next one is posted.
+	 */
+	void dispatcher() {
+		struct pollfd pfd = { wake, POLLIN, 0 };
+		while(run) {
+			Event event;
+			while(queue.take(event)) {
+				dispatch(event);
+			}
+			if(poll(&pfd, 1, -1) > 0) {
+				uint64_t count;
+				if(read(wake, &count, sizeof(count)) < 0) {
+					//Nothing to do, the event is only used to interrupt poll()
+				}
+			}
+		}
+	}
+
+	/*!	Input Initialization Method.
+	 *
+	 * 	This method sets up the queue and spawns the dispatcher thread.
+	 */
+	void init() {
+		//Initialize the input bus
+		printf(LOADING "Initializing Input...");
+		fflush(stdout);
+
+		wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if(wake < 0) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to create the input event");
+		}
+
+		//Start the dispatcher
+		dispatcherThread = std::thread(dispatcher);
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/*!	Input Destruction Method.
+	 *
+	 * 	This method stops the dispatcher.  Events still in the queue are
+	 * 	dropped.
+	 */
+	void destroy() {
+		//Destroy the input bus
+		printf(LOADING "Destroying Input...");
+		fflush(stdout);
+
+		run = false;
+		uint64_t one = 1;
+		if(write(wake, &one, sizeof(one)) < 0) {
+			Log::warn("Failed to wake the dispatcher\n");
+		}
+		dispatcherThread.join();
+
+		//Success
+		printf(OKAY "\n");
+	}
+}
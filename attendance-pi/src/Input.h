@@ -0,0 +1,41 @@
+#pragma once
+
+#include "CardId.h"
+
+#include <chrono>
+
+namespace Input {
+
+	typedef enum {
+		CARD,
+		KEY,
+		NETWORK
+	} EventType;
+
+	/**
+	 * Something that happened on one of the input devices
+	 * type: What happened
+	 * time: When it happened
+	 * uid: For CARD, the UID of the card that was tapped
+	 * reader: For CARD, the reader it was tapped on
+	 * key: For KEY, the key that was pressed
+	 * wifi, ethernet: For NETWORK, the connections that are now up
+	 */
+	struct Event {
+		EventType type;
+		std::chrono::steady_clock::time_point time;
+		CardId uid;
+		int reader;
+		char key;
+		bool wifi;
+		bool ethernet;
+	};
+
+	void init();
+	void destroy();
+
+	bool post(const Event&);
+	bool postCard(const CardId& uid, int reader);
+	bool postKey(char key);
+	bool postNetwork(bool wifi, bool ethernet);
+}
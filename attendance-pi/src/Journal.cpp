@@ -0,0 +1,317 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Journal.h"
+#include "Log.h"
+#include "ANSI.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include <fstream>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+///Default location of the journal file, relative to the working directory
+#define JOURNAL_DEFAULT_FILE	"journal.log"
+///Number of unsynced records that forces an early sync
+#define JOURNAL_SYNC_BATCH		16
+///Longest time a record may sit in the page cache before it is synced
+#define JOURNAL_SYNC_INTERVAL	std::chrono::seconds(1)
+///Size above which a fully acknowledged journal is truncated
+#define JOURNAL_TRUNCATE_SIZE	4096
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The initialization process for the Journal reads back the journal file
+ * 	left behind by the previous run, keeps every event that was never
+ * 	acknowledged by the server, and rewrites the file so that it contains
+ * 	only those events.  It then spawns the sync thread.
+ *
+ * 	@section file_format	File Format
+ *
+ * 	The journal is an append-only text file with one record per line.  An
+ * 	event record has the form <tt>E seq type time pin rfid</tt>, with @p rfid
+ * 	written as @p - when the event has none.  Once the server has accepted an
+ * 	event, an acknowledgement record <tt>A seq</tt> is appended.  A line that
+ * 	was only partly written when the power went out is simply ignored.
+ *
+ * 	@section sync_thread	Sync Thread
+ *
+ * 	Records are written to the file as soon as they are created, but are
+ * 	only flushed to the SD card by the sync thread, either once a second or
+ * 	once @p JOURNAL_SYNC_BATCH records have piled up, whichever comes first.
+ * 	This keeps a burst of taps from turning into a burst of card writes, at
+ * 	the cost of possibly losing the last second of events on power loss.
+ *
+ */
+namespace Journal {
+
+	///Journal file descriptor
+	int fd = -1;
+	///Journal file path
+	std::string path;
+
+	///Events that have not been acknowledged yet, in order
+	std::deque<Sender::Event> pending;
+	///Sequence number to give to the next event
+	unsigned long nextSeq = 1;
+	///Number of records written since the last sync
+	int unsynced = 0;
+
+	///Sync thread
+	std::thread syncThread;
+	///Thread termination condition
+	bool run = true;
+	std::mutex m;
+	std::condition_variable cv;
+
+	/*!	Journal record writer.
+	 *
+	 * 	Appends a single line to the journal file.  The caller must hold @p m.
+	 */
+	void writeRecord(const char* line, size_t length) {
+		if(::write(fd, line, length) != (ssize_t) length) {
+			Log::warn("Failed to write to journal %s\n", path.c_str());
+		}
+		unsynced++;
+		if(unsynced >= JOURNAL_SYNC_BATCH) {
+			cv.notify_one();
+		}
+	}
+
+	/*!	Event record formatter.
+	 *
+	 * 	@returns	The length of the record written into @p buf
+	 */
+	size_t formatEvent(char* buf, size_t size, const Sender::Event& event) {
+		return snprintf(buf, size, "E %lu %i %ld %s %s\n", event.seq,
+			(int) event.type, (long) event.time, event.pin.c_str(),
+			event.rfid.empty() ? "-" : event.rfid.c_str());
+	}
+
+	/*!	Journal loader.
+	 *
+	 * 	Reads the journal file and returns every event that has not been
+	 * 	acknowledged, in order.
+	 */
+	std::map<unsigned long, Sender::Event> load() {
+		std::map<unsigned long, Sender::Event> events;
+		std::ifstream file(path);
+		std::string line;
+		while(std::getline(file, line)) {
+			unsigned long seq = 0;
+			int type;
+			long time;
+			char pin[32];
+			char rfid[32];
+			if(sscanf(line.c_str(), "E %lu %i %ld %31s %31s",
+					&seq, &type, &time, pin, rfid) == 5) {
+				Sender::Event event;
+				event.type = (Sender::EventType) type;
+				event.pin = pin;
+				event.rfid = std::string(rfid) == "-" ? "" : rfid;
+				event.seq = seq;
+				event.time = time;
+				events[seq] = event;
+			} else if(sscanf(line.c_str(), "A %lu", &seq) == 1) {
+				events.erase(seq);
+			}
+			//Anything else is a torn write, skip it
+			if(seq >= nextSeq) {
+				nextSeq = seq + 1;
+			}
+		}
+		return events;
+	}
+
+	/*!	Journal compaction.
+	 *
+	 * 	Replaces the journal file with one that only contains the pending
+	 * 	events.  The new file is fully written and synced before it replaces
+	 * 	the old one, so a power cut during compaction loses nothing.
+	 */
+	void compact() {
+		std::string tmp = path + ".tmp";
+		int tfd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(tfd < 0) {
+			throw std::runtime_error("Failed to create journal " + tmp);
+		}
+		char buf[128];
+		for(size_t i = 0; i < pending.size(); i++) {
+			size_t length = formatEvent(buf, sizeof(buf), pending[i]);
+			if(::write(tfd, buf, length) != (ssize_t) length) {
+				close(tfd);
+				throw std::runtime_error("Failed to write journal " + tmp);
+			}
+		}
+		fdatasync(tfd);
+		close(tfd);
+		if(rename(tmp.c_str(), path.c_str()) != 0) {
+			throw std::runtime_error("Failed to replace journal " + path);
+		}
+	}
+
+	/*!	Sync thread.
+	 *
+	 * 	This method is spawned as a new thread by the Journal initialization
+	 * 	process, and periodically flushes written records to the disk.
+	 */
+	void thread() {
+		std::unique_lock<std::mutex> lk(m);
+		while(run) {
+			cv.wait_for(lk, JOURNAL_SYNC_INTERVAL);
+			if(unsynced == 0) {
+				continue;
+			}
+			unsynced = 0;
+			//Writers may keep appending while the sync is in progress
+			lk.unlock();
+			fdatasync(fd);
+			lk.lock();
+		}
+	}
+
+	/*!	Journal Initialization Method.
+	 *
+	 * 	This method recovers the events left unacknowledged by the previous
+	 * 	run, compacts the journal file, and spawns the sync thread.
+	 */
+	void init() {
+		//Initialize the journal
+		printf(LOADING "Initializing Journal...");
+		fflush(stdout);
+
+		//Find the file
+		path = getenv("JOURNAL_FILE") != nullptr ?
+			getenv("JOURNAL_FILE") : JOURNAL_DEFAULT_FILE;
+
+		//Recover the events that never made it to the server
+		std::map<unsigned long, Sender::Event> events = load();
+		for(auto it = events.begin(); it != events.end(); ++it) {
+			pending.push_back(it->second);
+		}
+		compact();
+
+		//Open the file for appending
+		fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+		if(fd < 0) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to open journal " + path);
+		}
+
+		//Start the sync thread
+		syncThread = std::thread(thread);
+
+		//Success
+		printf(OKAY "\n");
+		if(!pending.empty()) {
+			Log::info("Recovered %i unsent events from the journal\n",
+				(int) pending.size());
+		}
+	}
+
+	/*!	Journal Destruction Method.
+	 *
+	 * 	This method stops the sync thread, flushes anything still unsynced
+	 * 	and closes the journal file.
+	 */
+	void destroy() {
+		//Destroy the journal
+		printf(LOADING "Destroying Journal...");
+		fflush(stdout);
+
+		//Instruct the thread to terminate
+		{
+			std::lock_guard<std::mutex> lk(m);
+			run = false;
+		}
+		cv.notify_one();
+		//Join the thread
+		syncThread.join();
+
+		//Flush and close the file
+		fdatasync(fd);
+		close(fd);
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/*!	Record a new event.
+	 *
+	 * 	This method assigns the event its sequence number and appends it to
+	 * 	the journal.  The event stays pending until it is acknowledged.
+	 *
+	 * 	@returns	The sequence number of the event
+	 */
+	unsigned long append(const Sender::Event& event) {
+		std::lock_guard<std::mutex> lk(m);
+		Sender::Event e = event;
+		e.seq = nextSeq++;
+		char buf[128];
+		size_t length = formatEvent(buf, sizeof(buf), e);
+		writeRecord(buf, length);
+		pending.push_back(e);
+		return e.seq;
+	}
+
+	/*!	Acknowledge an event.
+	 *
+	 * 	This method marks the event with the given sequence number as handled
+	 * 	by the server, so that it will not be replayed.  Once nothing is
+	 * 	pending anymore, the journal file is emptied.
+	 */
+	void ack(unsigned long seq) {
+		std::lock_guard<std::mutex> lk(m);
+		for(auto it = pending.begin(); it != pending.end(); ++it) {
+			if(it->seq == seq) {
+				pending.erase(it);
+				break;
+			}
+		}
+		//Throw away the history once everything has been sent
+		struct stat st;
+		if(pending.empty() && fstat(fd, &st) == 0 &&
+				st.st_size > JOURNAL_TRUNCATE_SIZE) {
+			if(ftruncate(fd, 0) == 0) {
+				fdatasync(fd);
+				unsynced = 0;
+				return;
+			}
+		}
+		char buf[32];
+		size_t length = snprintf(buf, sizeof(buf), "A %lu\n", seq);
+		writeRecord(buf, length);
+	}
+
+	/*!	Get pending events.
+	 *
+	 * 	@returns	Up to @p max pending events with a sequence number greater
+	 * 		than @p seq, oldest first.
+	 */
+	std::vector<Sender::Event> pendingAfter(unsigned long seq, size_t max) {
+		std::lock_guard<std::mutex> lk(m);
+		std::vector<Sender::Event> events;
+		for(size_t i = 0; i < pending.size() && events.size() < max; i++) {
+			if(pending[i].seq > seq) {
+				events.push_back(pending[i]);
+			}
+		}
+		return events;
+	}
+
+	/*!	Get the number of pending events.
+	 */
+	size_t pendingCount() {
+		std::lock_guard<std::mutex> lk(m);
+		return pending.size();
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "Sender.h"
+
+#include <vector>
+
+namespace Journal {
+
+	void init();
+	void destroy();
+
+	unsigned long append(const Sender::Event&);
+	void ack(unsigned long);
+	std::vector<Sender::Event> pendingAfter(unsigned long, size_t);
+	size_t pendingCount();
+}
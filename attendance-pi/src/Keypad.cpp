@@ -1,17 +1,30 @@
 #include "Keypad.h"
+#include "Log.h"
 #include "ANSI.h"
 #include "Main.h"
 #include "State.h"
-#include "LCD.h"
+#include "Screen.h"
 #include "Buzzer.h"
 #include "UserHandler.h"
 #include "Utils.h"
+#include "EdgeMonitor.h"
+#include "Input.h"
+#include "Reactor.h"
 
 #include <stdio.h>
 #include <stdexcept>
+#include "Hal.h"
 #include <bcm2835.h>
-#include <thread>
-#include <unistd.h>
+#include <chrono>
+#include <vector>
+#include <sys/epoll.h>
+
+///Time a key must stay put before its new state is believed
+#define KEYPAD_DEBOUNCE		std::chrono::milliseconds(20)
+///Time * and # must be held together to restart the program
+#define KEYPAD_RESTART_HOLD	std::chrono::seconds(4)
+///Time between scans when the keys have to be polled, in milliseconds
+#define KEYPAD_POLL_INTERVAL	2
 
 /*!	@section mod_init	Module Initialization
  *
@@ -23,11 +36,23 @@
  *
  * 	@image html keypad_flow.png
  *
- * 	@section poll_thread	Polling Thread
+ * 	@section poll_thread	Key Monitoring
+ *
+ * 	The keypad watches the 12 GPIO pins assigned to keys on the keypad for a
+ * 	positive change, and if detected, posts the key to the Input bus, whose
+ * 	dispatcher thread calls the event handler method.  It has no thread of
+ * 	its own; everything below runs on the Reactor.
+ *
+ * 	Where the kernel can report edges on the pins, the EdgeMonitor's lines
+ * 	are handed to the reactor, and nothing happens at all until one of them
+ * 	changes.  A timer then comes back once the key has had time to settle.
+ * 	On systems where the kernel can't, the timer instead fires every 2
+ * 	milliseconds and every pin is read.
  *
- * 	The polling thread continuously monitors the 12 GPIO pins assigned to keys
- * 	on the keypad for a positive change, and if detected, trigger the
- * 	appropriate event handler method.
+ * 	Either way, a key only counts as pressed or released once it has stayed
+ * 	that way for @p KEYPAD_DEBOUNCE, so contact bounce is never seen as a
+ * 	second press.  Holding * and # together for @p KEYPAD_RESTART_HOLD
+ * 	restarts the program.
  *
  * 	@image html keypad_threadflow.png
  *
@@ -35,12 +60,11 @@
 namespace Keypad {
 
 	//Private declarations
-	void handle(char);
-	void thread();
+	void onEdges(uint32_t events, void* ctx);
+	void onTimer(uint32_t events, void* ctx);
+	void stopEvents();
 	char codeToChar(int);
-
-	///Thread termination condition
-	bool run = true;
+	void stateChanged(State::State from, State::State to, void* ctx);
 
 	/*!	Key release state.
 	 *
@@ -51,8 +75,23 @@ namespace Keypad {
 	 */
 	int keystate[] { LOW,LOW,LOW,LOW,LOW,LOW,LOW,LOW,LOW,LOW,LOW,LOW };
 
-	///Polling thread
-	std::thread pollThread;
+	///Last level actually seen on each key, which may still be bouncing
+	int rawstate[] { LOW,LOW,LOW,LOW,LOW,LOW,LOW,LOW,LOW,LOW,LOW,LOW };
+	///When each key last changed level
+	std::chrono::steady_clock::time_point changedAt[12];
+
+	///Whether * and # are both held
+	bool holding = false;
+	///When * and # were both pressed
+	std::chrono::steady_clock::time_point holdStart;
+
+	///Edge events for the keys, if the kernel supports them
+	EdgeMonitor monitor;
+	///Whether the keys are watched by @p monitor rather than polled
+	bool useEvents = false;
+
+	///Debounce timer, or the scan timer while the keys are polled
+	int timer = -1;
 
 	///Key map.
 	int keymap[] {
@@ -78,8 +117,8 @@ namespace Keypad {
 	/*!	Keypad Initialization Method.
 	 *
 	 * 	This method initializes the keypad by first configuring the GPIO pin
-	 * 	associated with each individual key, and then spawning the pin polling
-	 * 	thread.
+	 * 	associated with each individual key, and then handing its edge events,
+	 * 	or a polling timer, to the reactor.
 	 *
 	 */
 	void init() {
@@ -89,23 +128,44 @@ namespace Keypad {
 
 		//Configure each key
 		for(int i = 0; i < 12; i++) {
-			//Set to input
-			bcm2835_gpio_fsel(keymap[i], BCM2835_GPIO_FSEL_INPT);
-			//Set to pull-down
-			bcm2835_gpio_set_pud(keymap[i], BCM2835_GPIO_PUD_DOWN);
+			//Set to input, with a pull-down
+			Hal::gpio().input(keymap[i], Hal::PULL_DOWN);
+		}
+
+		//Ask for edge events, or poll if they aren't available
+		useEvents = true;
+		for(int i = 0; i < 12 && useEvents; i++) {
+			useEvents = monitor.watch(keymap[i]);
+		}
+		try {
+			timer = Reactor::timer(onTimer, nullptr);
+		} catch(const std::exception& e) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw;
+		}
+		const std::vector<int>& fds = monitor.descriptors();
+		for(size_t i = 0; i < fds.size() && useEvents; i++) {
+			useEvents = Reactor::watch(fds[i], EPOLLIN, onEdges, nullptr);
+		}
+		if(!useEvents) {
+			stopEvents();
+			Reactor::arm(timer, KEYPAD_POLL_INTERVAL, KEYPAD_POLL_INTERVAL);
 		}
 
-		//Start the GPIO monitor thread
-		pollThread = std::thread(thread);
+		//Take the PIN field down whenever typing is over
+		State::subscribe(stateChanged, nullptr);
 
 		//Success
 		printf(OKAY "\n");
+		if(!useEvents) {
+			Log::warn("GPIO edge events unavailable, polling the keypad\n");
+		}
 	}
 
 	/*!	Keypad Destruction Method.
 	 *
-	 * 	This method instructs the GPIO polling thread to terminate and then
-	 * 	rejoins it with the main thread to facilitate a clean shutdown.
+	 * 	This method takes the keypad's timer and edge events back from the
+	 * 	reactor, which must already have stopped.
 	 *
 	 */
 	void destroy() {
@@ -113,59 +173,155 @@ namespace Keypad {
 		printf(LOADING "Destroying Keypad...");
 		fflush(stdout);
 
-		//Instruct the thread to terminate
-		run = false;
-		//Join the thread
-		pollThread.join();
+		stopEvents();
+		Reactor::remove(timer);
 
 		//Success
 		printf(OKAY "\n");
 	}
 
-	/*!	Keypad polling thread.
+	/*!	Key level sampler.
 	 *
-	 * 	This method is spawned as a new thread by the keypad initialization
-	 * 	process, and handles the dirty work of listening for when a user has
-	 * 	pressed one of the keys by continuously polling the GPIO pins.
+	 * 	This method is given the current level of key @p i, and invokes the
+	 * 	handler once a press has lasted for the debounce time.
+	 */
+	void sample(int i, int level, std::chrono::steady_clock::time_point now) {
+		if(level != rawstate[i]) {
+			//Still moving, start the debounce over
+			rawstate[i] = level;
+			changedAt[i] = now;
+			return;
+		}
+		if(level == keystate[i] || now - changedAt[i] < KEYPAD_DEBOUNCE) {
+			return;
+		}
+		//Set key state
+		keystate[i] = level;
+		if(level == HIGH) {
+			//Hand the key to the dispatcher
+			Input::postKey(codeToChar(i));
+		}
+	}
+
+	/*!	Restart combination checker.
 	 *
+	 * 	@returns	The time left until the program restarts, or a negative
+	 * 		duration if * and # are not both held.
 	 */
-	void thread() {
-		int resetKeyIterations = 0;
-		//Loop
-		while(run) {
-			//Iterate over each input
-			for(int i = 0; i < 12; i++) {
-				//Get the pin state
-				if(bcm2835_gpio_lev(keymap[i]) == HIGH) {
-					//Check the key state
-					if(keystate[i] == HIGH) { continue; } //Already registered
-					//Invoke the handler
-					handle(codeToChar(i));
-					//Set key state
-					keystate[i] = HIGH;
-				} else {
-					//Set state to low
-					keystate[i] = LOW;
+	std::chrono::steady_clock::duration checkHold(
+			std::chrono::steady_clock::time_point now) {
+		if(keystate[11] != HIGH || keystate[10] != HIGH) {
+			holding = false;
+			return std::chrono::steady_clock::duration(-1);
+		}
+		if(!holding) {
+			holding = true;
+			holdStart = now;
+		}
+		if(now - holdStart >= KEYPAD_RESTART_HOLD) {
+			Utils::restartProgram();
+		}
+		return holdStart + KEYPAD_RESTART_HOLD - now;
+	}
+
+	/*!	Stop using edge events.
+	 */
+	void stopEvents() {
+		const std::vector<int>& fds = monitor.descriptors();
+		for(size_t i = 0; i < fds.size(); i++) {
+			Reactor::remove(fds[i]);
+		}
+		monitor.close();
+	}
+
+	/*!	Debounce check.
+	 *
+	 * 	Confirms any key that has settled, then sets the timer for when the
+	 * 	next one will have, or for when the restart hold is up.
+	 */
+	void settle() {
+		std::chrono::steady_clock::time_point now =
+			std::chrono::steady_clock::now();
+		std::chrono::steady_clock::duration next =
+			std::chrono::steady_clock::duration(-1);
+		for(int i = 0; i < 12; i++) {
+			sample(i, rawstate[i], now);
+			if(rawstate[i] != keystate[i]) {
+				std::chrono::steady_clock::duration left =
+					changedAt[i] + KEYPAD_DEBOUNCE - now;
+				if(next.count() < 0 || left < next) {
+					next = left;
 				}
 			}
-			if (keystate[11] == HIGH && keystate[10] == HIGH) {
-				resetKeyIterations++;
-				if (resetKeyIterations > 2000) {
-					Utils::restartProgram();
+		}
+		std::chrono::steady_clock::duration hold = checkHold(now);
+		if(hold.count() >= 0 && (next.count() < 0 || hold < next)) {
+			next = hold;
+		}
+		if(next.count() < 0) {
+			Reactor::disarm(timer);
+		} else {
+			Reactor::arm(timer, (long)
+				std::chrono::duration_cast<std::chrono::milliseconds>(next)
+				.count() + 1);
+		}
+	}
+
+	/*!	Edge event handler.
+	 *
+	 * 	Runs on the reactor thread when one of the key lines has changed.
+	 */
+	void onEdges(uint32_t events, void* ctx) {
+		if(!useEvents) {
+			return;
+		}
+		EdgeMonitor::Edge edges[EDGE_MONITOR_BATCH];
+		int n = monitor.wait(0, edges, EDGE_MONITOR_BATCH);
+		if(n < 0) {
+			Log::warn("Lost GPIO edge events, polling the keypad\n");
+			useEvents = false;
+			stopEvents();
+			Reactor::arm(timer, KEYPAD_POLL_INTERVAL, KEYPAD_POLL_INTERVAL);
+			return;
+		}
+		std::chrono::steady_clock::time_point now =
+			std::chrono::steady_clock::now();
+		for(int e = 0; e < n; e++) {
+			for(int i = 0; i < 12; i++) {
+				if(keymap[i] == edges[e].line) {
+					//Every edge starts the debounce over
+					rawstate[i] = edges[e].rising ? HIGH : LOW;
+					changedAt[i] = now;
 				}
-			} else {
-				resetKeyIterations = 0;
 			}
-			//Give the processor a bit of time
-			usleep(2000);
 		}
+		settle();
+	}
+
+	/*!	Timer handler.
+	 *
+	 * 	Runs on the reactor thread, either once a key should have settled or,
+	 * 	while the keys are polled, every @p KEYPAD_POLL_INTERVAL.
+	 */
+	void onTimer(uint32_t events, void* ctx) {
+		if(useEvents) {
+			settle();
+			return;
+		}
+		//Iterate over each input
+		std::chrono::steady_clock::time_point now =
+			std::chrono::steady_clock::now();
+		for(int i = 0; i < 12; i++) {
+			sample(i, Hal::gpio().read(keymap[i]) ? HIGH : LOW, now);
+		}
+		checkHold(now);
 	}
 
 	/*!	Keypad event handle method.
 	 *
-	 * 	This method is called by the keypad polling thread whenever it detects
-	 * 	that a key has been pressed, and passes the the respective key as an
-	 * 	argument.
+	 * 	This method is called by the Input dispatcher whenever the keypad
+	 * 	thread has seen a key being pressed, and passes the the respective key
+	 * 	as an argument.
 	 *
 	 * 	@todo Create a nifty diagram
 	 *
@@ -177,79 +333,82 @@ namespace Keypad {
 	 */
 	void handle(char key) {
 		//Check the state
-		if(State::state == State::READY) {
-			//Change the state
-			State::changeState(State::INPUT);
-			//Clear the first line of the display
-			LCD::writeMessage("                ",0,0);
-		} else if(State::state != State::INPUT && State::state != State::INPUT_ASSIGN_RFID) {
+		if(!State::takesKeys(State::state)) {
 			//Not allowed
-			printf(WARN "Input received during illegal state\n");
+			Log::warn("Input received during illegal state\n");
 			return;
 		}
+		if(State::state == State::READY) {
+			//Change the state
+			if(!State::changeState(State::INPUT)) {
+				return;
+			}
+			//Clear the first line of the display, and any greeting on it
+			Screen::clear(Screen::MESSAGE, Screen::NORMAL);
+			Screen::show(Screen::MESSAGE, "");
+		}
 
 		if(key == '*') {	//Check if this is the reset command
 			//Clear the display
 			reset();
 			//Beep
-			Buzzer::buzz(25000);
-			usleep(25000);
-			Buzzer::buzz(25000);
-			printf(INFO "Cleared the display\n");
+			Buzzer::play(Buzzer::DOUBLE_BEEP);
+			Log::info("Cleared the display\n");
 			State::changeState(State::READY);
 			return;
 		} else if(key == '#') {	//Check if this is the submit command
 			//Check he number of digits
 			if(ipos < 4) {
 				//Not enough digits
-				printf(WARN "Not enough digits\n");
+				Log::warn("Not enough digits\n");
 				//Beep
-				Buzzer::buzz(25000);
-				usleep(25000);
-				Buzzer::buzz(25000);
+				Buzzer::play(Buzzer::DOUBLE_BEEP);
 			} else {
 				if (std::string(input) == std::string("0999")) {
-					LCD::writeMessage("Shutting down...", 0, 0);
+					Screen::show(Screen::MESSAGE, "Shutting down...", Screen::ALERT);
 					Utils::shutdownPi();
 					return;
 				} else if (std::string(input) == std::string("0001")) {
-					Buzzer::buzz(25000);
+					Buzzer::play(Buzzer::CLICK);
 					reset();
-					LCD::writeMessage("Loading users...", 0, 0);
-					UserHandler::update();
 					State::changeState(State::READY);
+					Screen::show(Screen::MESSAGE, "Loading users...", Screen::NORMAL);
+					//Downloads on the worker, so taps keep coming in while
+					//keys wait for the table like during the nightly update
+					UserHandler::reload();
 					return;
 				} else if(std::string(input) == std::string("0002")) {
 					std::vector<Utils::ConnectionState> states = Utils::getConnectionState();
-					int row = 0;
-					for (auto it = states.begin(); it != states.end(); ++it) {
-						LCD::writeMessage(it->ip, row, 0);
-						row++;
+					//Cover both lines, clock included, for long enough to read
+					const Screen::Region rows[] = { Screen::MESSAGE, Screen::STATUS };
+					for (int row = 0; row < 2; row++) {
+						Screen::show(rows[row], (size_t) row < states.size() ?
+							states[row].ip : "", Screen::ALERT, SCREEN_DIAGNOSTIC_TIME);
 					}
+					reset();
+					State::changeState(State::READY);
 					return;
 				} else if (std::string(input) == std::string("0000")) {
-					Buzzer::buzz(25000);
+					Buzzer::play(Buzzer::CLICK);
 					State::changeState(State::INPUT_ASSIGN_RFID);
 					reset();
-					LCD::writeMessage("PIN:  ", 0, 0);
+					Screen::show(Screen::MESSAGE, "PIN:  ");
 				} else if (State::state == State::INPUT_ASSIGN_RFID) {
 					State::changeState(State::READ_ASSIGN_RFID);
 					for (int i = 0; i < sizeof(input) / sizeof(char); i++) {
 						State::assignRfidPin[i] = input[i];
 					}
 					reset();
-					LCD::writeMessage("Tap RFID  ", 0, 0);
+					Screen::show(Screen::MESSAGE, "Tap RFID  ");
 					return;
 				} else {
 					//Trigger the event
 					UserHandler::triggerPin(input);
 					//Beep
-					Buzzer::buzz(25000);
-					//Sleep for 1 second
-					usleep(1000000);
-					//Clear the display
+					Buzzer::play(Buzzer::CLICK);
+					//Clear the input
 					reset();
-					//Change the state back to ready
+					//The message stays up on its own
 					State::changeState(State::READY);
 					//Return
 					return;
@@ -257,15 +416,12 @@ namespace Keypad {
 			}
 		} else if(ipos > 3) {	//Check the number of digits
 			//Not allowed - too many digits
-			printf(WARN "Too many digits\n");
+			Log::warn("Too many digits\n");
 			//Beep
-			Buzzer::buzz(25000);
-			usleep(25000);
-			Buzzer::buzz(25000);
-			usleep(25000);
+			Buzzer::play(Buzzer::DOUBLE_BEEP);
 		} else {
 			//Beep
-			Buzzer::buzz(25000);
+			Buzzer::play(Buzzer::CLICK);
 			//Set the character
 			input[ipos] = key;
 			//Increment the input position counter
@@ -273,8 +429,19 @@ namespace Keypad {
 		}
 
 		//Update the display
-		LCD::writeMessage(input,0,6);
+		Screen::show(Screen::INPUT, input, Screen::NORMAL);
+
+	}
 
+	/*!	State change listener.
+	 *
+	 * 	Takes the PIN field off the display once the state no longer takes a
+	 * 	PIN, whichever way it got there.
+	 */
+	void stateChanged(State::State from, State::State to, void* ctx) {
+		if(to != State::INPUT && to != State::INPUT_ASSIGN_RFID) {
+			Screen::clear(Screen::INPUT, Screen::NORMAL);
+		}
 	}
 
 	/*!	Input buffer reset method.
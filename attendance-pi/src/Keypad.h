@@ -6,5 +6,6 @@ namespace Keypad {
 	void destroy();
 
 	void reset();
+	void handle(char);
 
 }
@@ -1,9 +1,13 @@
 #include "LCD.h"
+#include "Log.h"
 #include "ANSI.h"
 #include "State.h"
+#include "Metrics.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdexcept>
+#include "Hal.h"
 #include <bcm2835.h>
 #include <unistd.h>
 #include <string>
@@ -20,6 +24,19 @@
 #define MODE_CHARACTER	true
 #define LCD_SETCGRAMADDR 0x40
 
+///Default I2C clock, the fastest the PCF8574 is rated for
+#define LCD_DEFAULT_I2C_BAUD	100000
+///Largest number of expander states sent in a single I2C transfer
+#define LCD_BATCH_SIZE			64
+
+///Waits after the function sets that reset the controller, in microseconds
+#define LCD_RESET_WAIT_FIRST	4100
+#define LCD_RESET_WAIT			100
+///Wait after the clear command, which takes the controller 1.52ms
+#define LCD_CLEAR_WAIT			2000
+///Shadow value for a cell in an unknown state, which encodeChar() never returns
+#define LCD_UNKNOWN_CELL		0x7F
+
 /*!	@section mod_init Module Initialization
  *
  * 	The initialization process for the LCD module first attempts to initialize
@@ -69,6 +86,36 @@
  *	<a href="https://www.sparkfun.com/datasheets/LCD/GDM1602K-Extended.pdf">
  *	here</a>
  *
+ *	@section lcd_shadow	Shadow Framebuffer
+ *
+ *	Every character sent to the display costs two expander writes, so
+ *	resending text that is already on screen is expensive.  The module keeps
+ *	a copy of what the display currently shows, and writeMessage() only
+ *	updates that copy and then sends the cells that actually changed.  The
+ *	cursor is only moved when the next changed cell is not the one it
+ *	already points at, so a changed run of characters costs a single
+ *	address command.  Text falling outside the 2x16 visible area is
+ *	dropped rather than written to the hidden part of the display memory.
+ *	If a transfer fails, the copy is thrown away and every cell is sent
+ *	again on the next update, since there is no telling which ones the
+ *	display actually received.
+ *
+ *	@section lcd_batch	Batched Transfers
+ *
+ *	Rather than sending each expander state in its own I2C transaction and
+ *	sleeping in between, the states for a whole message are collected in a
+ *	buffer and sent in as few transfers as possible.  At I2C speeds a single
+ *	byte takes far longer than the controller needs to latch a nibble or run
+ *	a character command, so no extra delays are needed between them.  Each
+ *	nibble is sent as two states, with ENABLE high and then low, and the
+ *	controller latches it on the falling edge.  When the register select
+ *	changes, one extra state with ENABLE low is sent first so that RS is
+ *	settled before ENABLE goes high.  Only the clear and home commands,
+ *	which take the controller over a millisecond, are followed by a wait.
+ *
+ *	The I2C clock can be changed with the @p LCD_I2C_BAUD environment
+ *	variable, in Hz.
+ *
  *	@todo Implement thread safe checking
  */
 namespace LCD {
@@ -77,8 +124,11 @@ namespace LCD {
 	void writeDisplay(char);		//Writes a byte to the DISPLAY
 	void writeExpander(char);		//Writes a byte to the EXPANDER
 	char encodeChar(char);			//Encodes character to display format
-	int writeRaw(char);
+	void writeRaw(char);
+	void transmit();
+	void forgetShadow();
 	void setMode(bool mode);		//Sets the target register
+	void reset();
 
 	///Weather or not the LCD backlight is on. true = on, false = off.
 	bool backlight = true;
@@ -90,16 +140,119 @@ namespace LCD {
 	///Locking mutex
 	std::mutex lmux;
 
+	///What the display should show
+	char frame[LCD_ROWS][LCD_COLS];
+	///What the display is currently showing
+	char shadow[LCD_ROWS][LCD_COLS];
+	///Display memory address the cursor points at, or -1 if unknown
+	int cursor = -1;
+
+	///Expander states waiting to be sent
+	char batch[LCD_BATCH_SIZE];
+	///Number of states in @p batch
+	int batchLength = 0;
+	///Register selected by the last state queued, or -1 if unknown
+	int lastRegSelect = -1;
+
+	/*!	Forget what is on the display.
+	 *
+	 * 	Called after the display has been cleared, which blanks every cell and
+	 * 	moves the cursor home.  The caller must hold @p lmux.
+	 */
+	void resetShadow() {
+		for(int row = 0; row < LCD_ROWS; row++) {
+			for(int col = 0; col < LCD_COLS; col++) {
+				frame[row][col] = ' ';
+				shadow[row][col] = ' ';
+			}
+		}
+		cursor = 0;
+	}
+
+	/*!	Mark every cell as unknown.
+	 *
+	 * 	Called after a failed transfer, when the display may be showing
+	 * 	anything.  No frame cell ever matches a marked one, so the next flush()
+	 * 	sends every cell again, along with the address to start at.  The
+	 * 	caller must hold @p lmux.
+	 */
+	void forgetShadow() {
+		for(int row = 0; row < LCD_ROWS; row++) {
+			for(int col = 0; col < LCD_COLS; col++) {
+				shadow[row][col] = LCD_UNKNOWN_CELL;
+			}
+		}
+		cursor = -1;
+	}
+
+	/*!	Send the changed cells to the display.
+	 *
+	 * 	Compares the frame with the shadow and sends only the differences,
+	 * 	moving the cursor only where a run of unchanged cells is skipped.  The
+	 * 	caller must hold @p lmux.
+	 */
+	void flush() {
+		for(int row = 0; row < LCD_ROWS; row++) {
+			for(int col = 0; col < LCD_COLS; col++) {
+				if(frame[row][col] == shadow[row][col]) {
+					continue;
+				}
+				int offset = (row * 64) + col;
+				if(cursor != offset) {
+					//Jump over the unchanged cells
+					setMode(MODE_COMMAND);
+					writeDisplay((offset & 0b01111111) | 0b10000000);
+					setMode(MODE_CHARACTER);
+				}
+				//Recorded first, so a failed send below can still forget it
+				shadow[row][col] = frame[row][col];
+				cursor = offset + 1;
+				writeDisplay(frame[row][col]);
+			}
+		}
+		transmit();
+	}
+
 	void createChar(char ascii, char data[8]) {
 		setMode(MODE_COMMAND);
 		char location = ascii & 0x7;
 		writeDisplay(LCD_SETCGRAMADDR | (location << 3));
-		usleep(50000);
 		setMode(MODE_CHARACTER);
 		for (int i = 0; i < 8; i++) {
 			writeDisplay(data[i]);
-			usleep(50000);
 		}
+		transmit();
+		//The address counter now points into CGRAM
+		cursor = -1;
+	}
+
+	/*!	Put the controller in a known state.
+	 *
+	 * 	Follows the initialization by instruction in the HD44780 datasheet,
+	 * 	which doesn't depend on the mode the controller was left in.  Three
+	 * 	8-bit function sets get it out of 4-bit mode even if it was halfway
+	 * 	through a byte, and the fourth switches it to 4-bit mode.  From then
+	 * 	on each command takes under 40 microseconds, less than one expander
+	 * 	write at I2C speeds, so only the resets and the clear are waited for.
+	 * 	The caller must hold @p lmux.
+	 */
+	void reset() {
+		setMode(MODE_COMMAND);
+		writeExpander(0b0011);		//Function set, 8-bit
+		transmit();
+		usleep(LCD_RESET_WAIT_FIRST);
+		writeExpander(0b0011);		//Function set, 8-bit
+		transmit();
+		usleep(LCD_RESET_WAIT);
+		writeExpander(0b0011);		//Function set, 8-bit
+		writeExpander(0b0010);		//Function set, 4-bit, in 4-bit mode from here on
+		writeDisplay(0b00101000);	//Set mode to 4-bit 2 line 5x8 character
+		writeDisplay(0b00001100);	//Set display on, cursor off, blink off
+		writeDisplay(0b00000110);	//Set cursor to increment right, don't shift
+		writeDisplay(0b00000001);	//Clear the display
+		transmit();
+		usleep(LCD_CLEAR_WAIT);
+		resetShadow();
 	}
 
 	/*!	LCD Initialization Method.
@@ -113,42 +266,23 @@ namespace LCD {
 		fflush(stdout);
 
 		//Initialize the I2C connection
-		if(!bcm2835_i2c_begin()) {
+		if(!Hal::i2c().begin()) {
 			//Failed to initialize I2C
 			printf("\r[" RED "FAIL\n" RESET);
 			throw std::runtime_error("Failed to initialize I2C");
 		}
 
 		//Set the display slave address
-		bcm2835_i2c_setSlaveAddress(I2C_SLAVE_ADDRESS);
-
-		/*	Bug - The initialization data must be sent twice, and at some point
-		 * 	during the process a message must be written to the display. I have
-		 * 	absolutely no idea why this is, but I've spent about 5 hours trying
-		 * 	to figure it out to no avail. This works for whatever reason, so it
-		 * 	should probably work well enough to sort of leave it the way it is.
-		 */
-		for(int i = 0; i < 2; i++) {
-			//Set display mode
-			setMode(MODE_COMMAND);
-			writeDisplay(0b00101000);	//Set mode to 4-bit 2 line 5x8 character
-			usleep(10000);
-			writeDisplay(0b00101000);	//Set mode to 4-bit 2 line 5x8 character
-			usleep(10000);
-			writeDisplay(0b00101000);	//Set mode to 4-bit 2 line 5x8 character
-			usleep(10000);
-
-			writeDisplay(0b00001100);	//Set display on, cursor off, blink off
-			usleep(10000);
-
-			writeDisplay(0b00000110);	//Set cursor to increment right, don't shift
-			usleep(10000);
-
-			writeDisplay(0b00000001);	//Clear the display
-			usleep(10000);
-
-			//Write an empty message
-			writeMessage("!",0,0);
+		Hal::i2c().setAddress(I2C_SLAVE_ADDRESS);
+		//Set the bus speed
+		const char* baud = getenv("LCD_I2C_BAUD");
+		Hal::i2c().setBaudrate(baud != nullptr && atol(baud) > 0 ?
+			atol(baud) : LCD_DEFAULT_I2C_BAUD);
+
+		//Reset by instruction, which works whatever mode the controller is in
+		{
+			std::lock_guard<std::mutex> lock(lmux);
+			reset();
 		}
 
 		writeMessage("   Loading...", 0, 0);
@@ -207,7 +341,7 @@ namespace LCD {
 			writeMessage("then pull power ", 1, 0);
 		}
 
-		bcm2835_i2c_end();
+		Hal::i2c().end();
 
 		//Success
 		printf(OKAY "\n");
@@ -218,9 +352,10 @@ namespace LCD {
 	 * 	@warning This method should never be called directly, as doing so may
 	 * 	result in i2c message synchronization issues.
 	 *
-	 * 	This method converts a 4-bit nybble destined for the LCD into a properly
-	 * 	formatted 8-bit message which includes necessary bits for identifying
-	 * 	the target register and weather or not the backlight should be enabled.
+	 * 	This method converts a 4-bit nybble destined for the LCD into properly
+	 * 	formatted 8-bit messages which include the necessary bits for
+	 * 	identifying the target register and weather or not the backlight
+	 * 	should be enabled, and queues them for the next transmit().
 	 *
 	 * 	@param byte	Byte to write to the LCD.  Note that the 4 higher order bits
 	 * 		will be ignored.
@@ -234,22 +369,16 @@ namespace LCD {
 		//Set the register select bit
 		if(regSelect) { byte += REGSELECT_BIT; }
 
-		//Write low
-		int r1 = writeRaw(byte);
-		usleep(100);
+		//Settle the register select before raising enable
+		if(lastRegSelect != (int) regSelect) {
+			writeRaw(byte & ~0xF0);
+			lastRegSelect = regSelect;
+		}
 
 		//Write high
-		int r2 = writeRaw(byte | ENABLE_BIT);
-		usleep(100);
-
-		//Write low
-		int r3 = writeRaw(byte);
-		usleep(100);
-
-		//Check for error
-		if(r1 + r2 + r3 > 0) {
-			printf(WARN "Write error: %i %i %i\n", r1, r2, r3);
-		}
+		writeRaw(byte | ENABLE_BIT);
+		//Write low, latching the nybble
+		writeRaw(byte);
 	}
 
 	/*!	Character write method.
@@ -359,51 +488,69 @@ namespace LCD {
 	*/
 	}
 
-	/*!	Write a raw byte to the IO expander.
+	/*!	Queue a raw byte for the IO expander.
 	 *
-	 * 	This method writes an 8-bit message directly to the IO expander on the
-	 * 	back of the LCD module.
+	 * 	This method adds an 8-bit message for the IO expander on the back of
+	 * 	the LCD module to the batch, sending the batch first if it is full.
 	 *
 	 * 	@param byte	The byte to write to the IO expander.
 	 */
-	int writeRaw(char byte) {
-		//Convert to character array
-		char message[] { byte };
+	void writeRaw(char byte) {
+		if(batchLength == LCD_BATCH_SIZE) {
+			transmit();
+		}
+		batch[batchLength++] = byte;
+	}
+
+	/*!	Send the queued bytes to the IO expander.
+	 *
+	 * 	This method writes every queued message to the IO expander in a single
+	 * 	I2C transfer.
+	 */
+	void transmit() {
+		if(batchLength == 0) {
+			return;
+		}
 		//Send message
-		return bcm2835_i2c_write(message, 1);
+		uint8_t reason = Hal::i2c().write(batch, batchLength);
+		batchLength = 0;
+		//Check for error
+		if(reason != Hal::I2C_OK) {
+			Log::warn("Write error: %i\n", reason);
+			Metrics::add(Metrics::I2C_ERRORS);
+			//The expander may not have seen the register select change
+			lastRegSelect = -1;
+			//Nor any of the cells or the cursor move, so repaint them all
+			forgetShadow();
+		}
 	}
 
 	/*! Sets cursor position and writes message to display.
 	 *
 	 * 	This message writes @message to the display starting at the coordinates
-	 * 	specified by the variables @p row and @p col.
+	 * 	specified by the variables @p row and @p col.  Only the characters that
+	 * 	differ from what is already on the display are actually sent, and any
+	 * 	part of the message past the end of the row is dropped.
 	 *
 	 * 	@param message	Null-terminated string to display
 	 * 	@param row	The row to write the message to
 	 * 	@param col	The column to write the message to
 	 */
 	void writeMessage(std::string message, int row, int col) {
+		uint64_t start = Metrics::now();
 		//Lock thread to prevent simultaneous LCD operations
 		std::lock_guard<std::mutex> lock (lmux);
 
-		//Set the mode to comand
-		setMode(MODE_COMMAND);
-		//Calculate raw offset
-		int offset = (row * 64) + col;
-		//Create the command byte
-		char cmd = (offset & 0b01111111) | 0b10000000;
-		//Send the command
-		writeDisplay(cmd);
-
-		//Set mode to char
-		setMode(MODE_CHARACTER);
-		//printf(INFO "Printing message \"%s\" of length %i\n", message.c_str(), message.size());
-		//Encode the message
-		for (unsigned int i = 0; i < message.size(); i++) {
-			//Write encoded character
-			writeDisplay(encodeChar(message.c_str()[i]));
+		if(row < 0 || row >= LCD_ROWS || col < 0) {
+			return;
+		}
+		//Encode the message into the frame
+		for (unsigned int i = 0; i < message.size() && col + i < LCD_COLS; i++) {
+			frame[row][col + i] = encodeChar(message.c_str()[i]);
 		}
-		//printf(INFO "Finished printing message\n");
+		//Send whatever changed
+		flush();
+		Metrics::since(Metrics::LCD_WRITE, start);
 	}
 
 	/*!	Clear the display.
@@ -419,6 +566,10 @@ namespace LCD {
 		setMode(MODE_COMMAND);
 		//Send the command
 		writeDisplay(0b00000001);
+		transmit();
+		//Clearing takes the controller a while
+		usleep(LCD_CLEAR_WAIT);
+		resetShadow();
 	}
 
 	/*!	Return cursor to home.
@@ -433,6 +584,10 @@ namespace LCD {
 		setMode(MODE_COMMAND);
 		//Send the command
 		writeDisplay(0b00000010);
+		transmit();
+		//Going home takes the controller a while
+		usleep(LCD_CLEAR_WAIT);
+		cursor = 0;
 	}
 
 	/*!	Character encoder.
@@ -6,6 +6,10 @@
 #define CHAR_ETH 0x01
 #define CHAR_WIFI 0x02
 
+///Visible size of the display
+#define LCD_ROWS		2
+#define LCD_COLS		16
+
 namespace LCD {
 
 	void init();
@@ -0,0 +1,430 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Log.h"
+#include "ANSI.h"
+#include "Ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <stdexcept>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+///Number of messages the queue can hold, must be a power of two
+#define LOG_QUEUE_SIZE				256
+///Longest message kept, longer ones are cut short
+#define LOG_LINE_SIZE				192
+///Time between two passes of the writer over the queue, in milliseconds
+#define LOG_DRAIN_INTERVAL			100
+///Size of the buffer of lines waiting to go to the file
+#define LOG_BUFFER_SIZE				16384
+///Number of rotated files kept next to the log
+#define LOG_BACKUPS					2
+///Default log file, relative to the working directory
+#define LOG_DEFAULT_FILE			"attendance.log"
+///Default size at which the log file is rotated, in bytes
+#define LOG_DEFAULT_MAX_SIZE		1048576
+///Default longest time lines wait before going to the file, in seconds
+#define LOG_DEFAULT_FLUSH_INTERVAL	5
+///Default most bytes written to the file per second, on average
+#define LOG_DEFAULT_MAX_RATE		4096
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The initialization process for the logger opens the log file and
+ * 	starts the writer thread.  It runs before every other module, and is
+ * 	destroyed after all of them; until then, and afterwards, messages are
+ * 	simply printed straight away.
+ *
+ * 	@section log_queue	Message Queue
+ *
+ * 	Messages are logged from the RFID, Keypad, dispatcher, Sender and
+ * 	network threads, some of them in the middle of handling a tap.  Logging
+ * 	a message formats it into a cell of a bounded queue, the same @p Ring
+ * 	as the Input bus uses, and returns; it never takes a lock, never makes
+ * 	a system call and never waits for the console or the SD card.  If the
+ * 	queue is full the message is dropped and counted, and the count is
+ * 	logged once there is room again.  Messages below @p LOG_LEVEL, which is
+ * 	one of @p debug, @p info, @p warn or @p fail and @p info by default,
+ * 	are thrown away before they are even formatted.
+ *
+ * 	@section log_writer	Writer Thread
+ *
+ * 	The writer thread empties the queue every 100 milliseconds and prints
+ * 	each message to the console as before.  It also adds the message,
+ * 	with the time and level, to a buffer, which is written to
+ * 	@p LOG_FILE (@p attendance.log by default) in a single write once it
+ * 	is half full, or after @p LOG_FLUSH_INTERVAL seconds.  Setting
+ * 	@p LOG_FILE to an empty string keeps the log on the console only.
+ *
+ * 	To spare the SD card during an outage, no more than @p LOG_MAX_RATE
+ * 	bytes a second go to the file on average.  Lines past that are only
+ * 	printed, and the file gets a note saying how many were left out.  Once
+ * 	the file grows past @p LOG_MAX_SIZE bytes it is renamed with a @p .1
+ * 	suffix, pushing the older one to @p .2, and a new file is started.
+ *
+ */
+namespace Log {
+
+	/**
+	 * One logged message
+	 * level: How serious it is
+	 * time: When it was logged
+	 * text: The message, without a trailing newline
+	 */
+	struct Entry {
+		Level level;
+		struct timespec time;
+		char text[LOG_LINE_SIZE];
+	};
+
+	///The message queue, taken from by the writer
+	Ring<Entry, LOG_QUEUE_SIZE> queue;
+	///Messages dropped because the queue was full
+	std::atomic<unsigned long> dropped(0);
+
+	///Least serious level that is logged
+	std::atomic<int> minLevel(LEVEL_INFO);
+	///Whether the writer thread is taking messages
+	std::atomic<bool> active(false);
+
+	///Console prefix for each level
+	const char* const prefixes[] = {
+		"\r" RESET "[" MAGENTA "DBUG" RESET "] ", INFO, OKAY, WARN, FAIL
+	};
+	///File name for each level
+	const char* const names[] = { "DEBUG", "INFO", "OKAY", "WARN", "FAIL" };
+
+	///Log file name, or empty if there is no file
+	std::string path;
+	///Log file, or -1
+	int fd = -1;
+	///Size of the log file so far
+	off_t fileSize = 0;
+	///Size at which the file is rotated
+	long maxSize = LOG_DEFAULT_MAX_SIZE;
+	///Longest time lines wait in @p buffer, in milliseconds
+	long flushInterval = LOG_DEFAULT_FLUSH_INTERVAL * 1000L;
+	///Most bytes written to the file per second
+	long maxRate = LOG_DEFAULT_MAX_RATE;
+
+	///Lines waiting to be written to the file
+	std::string buffer;
+	///Bytes that may still be added to @p buffer under the rate limit
+	double allowance = 0;
+	///Lines left out of the file since the last note
+	unsigned long unwritten = 0;
+
+	///Event used to wake the writer thread
+	int wake = -1;
+	///Writer thread
+	std::thread wThread;
+	///Thread termination condition
+	std::atomic<bool> run(true);
+
+	/*!	Log a message.
+	 *
+	 * 	Can be called from any thread, and never blocks.
+	 */
+	void vwrite(Level level, const char* format, va_list args) {
+		if(level < minLevel.load(std::memory_order_relaxed)) {
+			return;
+		}
+		if(!active.load(std::memory_order_acquire)) {
+			//Nobody to hand it to, print it now
+			fputs(prefixes[level], stdout);
+			vprintf(format, args);
+			return;
+		}
+		//Format straight into the cell, it's a sizable copy otherwise
+		size_t pos;
+		Entry* slot = queue.claim(pos);
+		if(slot == nullptr) {
+			//The writer hasn't caught up
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		Entry& entry = *slot;
+		entry.level = level;
+		clock_gettime(CLOCK_REALTIME, &entry.time);
+		vsnprintf(entry.text, sizeof(entry.text), format, args);
+		//The line break is added back when it is written
+		size_t length = strlen(entry.text);
+		if(length > 0 && entry.text[length - 1] == '\n') {
+			entry.text[length - 1] = '\0';
+		}
+		queue.publish(pos);
+	}
+
+	void write(Level level, const char* format, ...) {
+		va_list args;
+		va_start(args, format);
+		vwrite(level, format, args);
+		va_end(args);
+	}
+
+	void debug(const char* format, ...) {
+		va_list args;
+		va_start(args, format);
+		vwrite(LEVEL_DEBUG, format, args);
+		va_end(args);
+	}
+
+	void info(const char* format, ...) {
+		va_list args;
+		va_start(args, format);
+		vwrite(LEVEL_INFO, format, args);
+		va_end(args);
+	}
+
+	void okay(const char* format, ...) {
+		va_list args;
+		va_start(args, format);
+		vwrite(LEVEL_OKAY, format, args);
+		va_end(args);
+	}
+
+	void warn(const char* format, ...) {
+		va_list args;
+		va_start(args, format);
+		vwrite(LEVEL_WARN, format, args);
+		va_end(args);
+	}
+
+	void fail(const char* format, ...) {
+		va_list args;
+		va_start(args, format);
+		vwrite(LEVEL_FAIL, format, args);
+		va_end(args);
+	}
+
+	/*!	Open the log file.
+	 */
+	void openFile() {
+		fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		struct stat st;
+		fileSize = fd >= 0 && fstat(fd, &st) == 0 ? st.st_size : 0;
+	}
+
+	/*!	Start a new log file, keeping the last few.
+	 */
+	void rotate() {
+		close(fd);
+		for(int i = LOG_BACKUPS; i > 0; i--) {
+			std::string from = i > 1 ? path + "." + std::to_string(i - 1) : path;
+			rename(from.c_str(), (path + "." + std::to_string(i)).c_str());
+		}
+		openFile();
+	}
+
+	/*!	Write the buffered lines to the file.
+	 */
+	void flush() {
+		if(fd >= 0 && !buffer.empty()) {
+			if(fileSize > 0 && fileSize + (off_t) buffer.size() > maxSize) {
+				rotate();
+			}
+			if(fd >= 0 && ::write(fd, buffer.data(), buffer.size()) > 0) {
+				fileSize += buffer.size();
+			}
+		}
+		buffer.clear();
+	}
+
+	/*!	Add a line to the file buffer, if the rate limit allows it.
+	 */
+	void buffered(const Entry& entry) {
+		char line[LOG_LINE_SIZE + 64];
+		struct tm local;
+		localtime_r(&entry.time.tv_sec, &local);
+		size_t length = strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S", &local);
+		if(unwritten > 0) {
+			//Say what was left out before carrying on
+			int note = snprintf(line + length, sizeof(line) - length,
+				".%03ld %s %lu lines were left out\n",
+				entry.time.tv_nsec / 1000000, names[LEVEL_WARN], unwritten);
+			if(allowance < length + note) {
+				unwritten++;
+				return;
+			}
+			buffer.append(line, length + note);
+			allowance -= length + note;
+			unwritten = 0;
+		}
+		length += snprintf(line + length, sizeof(line) - length,
+			".%03ld %-4s %s\n", entry.time.tv_nsec / 1000000,
+			names[entry.level], entry.text);
+		if(length > sizeof(line) - 1) {
+			length = sizeof(line) - 1;
+			line[length - 1] = '\n';
+		}
+		if(allowance < length) {
+			unwritten++;
+			return;
+		}
+		allowance -= length;
+		buffer.append(line, length);
+	}
+
+	/*!	Print every queued message and buffer it for the file.
+	 */
+	void drain() {
+		Entry entry;
+		bool printed = false;
+		while(queue.take(entry)) {
+			printf("%s%s\n", prefixes[entry.level], entry.text);
+			if(fd >= 0) {
+				buffered(entry);
+			}
+			printed = true;
+		}
+		unsigned long lost = dropped.exchange(0, std::memory_order_relaxed);
+		if(lost > 0) {
+			printf(WARN "Log queue was full, %lu messages were dropped\n", lost);
+			printed = true;
+		}
+		if(printed) {
+			fflush(stdout);
+		}
+	}
+
+	/*!	Writer thread.
+	 *
+	 * 	Empties the queue every @p LOG_DRAIN_INTERVAL milliseconds, and
+	 * 	writes to the file when the buffer fills up or has waited long enough.
+	 */
+	void writerThread() {
+		struct pollfd pfd = { wake, POLLIN, 0 };
+		std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point nextFlush =
+			last + std::chrono::milliseconds(flushInterval);
+		while(true) {
+			bool stopping = !run;
+			//Top up the rate limit, allowing no more than one flush's worth
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			allowance += maxRate * std::chrono::duration<double>(now - last).count();
+			if(allowance > maxRate * flushInterval / 1000.0) {
+				allowance = maxRate * flushInterval / 1000.0;
+			}
+			last = now;
+
+			drain();
+			if(buffer.size() >= LOG_BUFFER_SIZE / 2 || now >= nextFlush || stopping) {
+				flush();
+				nextFlush = now + std::chrono::milliseconds(flushInterval);
+			}
+			if(stopping) {
+				break;
+			}
+			if(poll(&pfd, 1, LOG_DRAIN_INTERVAL) > 0) {
+				uint64_t count;
+				if(read(wake, &count, sizeof(count)) < 0) {
+					//Nothing to do, the event is only used to interrupt poll()
+				}
+			}
+		}
+	}
+
+	/*!	Log Initialization Method.
+	 *
+	 * 	This method reads the settings, opens the log file and starts the
+	 * 	writer thread.
+	 */
+	void init() {
+		//Initialize the logger
+		printf(LOADING "Initializing Log...");
+		fflush(stdout);
+
+		const char* level = getenv("LOG_LEVEL");
+		if(level != nullptr) {
+			if(strcasecmp(level, "debug") == 0) {
+				minLevel = LEVEL_DEBUG;
+			} else if(strcasecmp(level, "warn") == 0) {
+				minLevel = LEVEL_WARN;
+			} else if(strcasecmp(level, "fail") == 0) {
+				minLevel = LEVEL_FAIL;
+			}
+		}
+		const char* size = getenv("LOG_MAX_SIZE");
+		if(size != nullptr && atol(size) > 0) {
+			maxSize = atol(size);
+		}
+		const char* interval = getenv("LOG_FLUSH_INTERVAL");
+		if(interval != nullptr && atol(interval) > 0) {
+			flushInterval = atol(interval) * 1000L;
+		}
+		const char* rate = getenv("LOG_MAX_RATE");
+		if(rate != nullptr && atol(rate) > 0) {
+			maxRate = atol(rate);
+		}
+		allowance = maxRate * flushInterval / 1000.0;
+
+		const char* file = getenv("LOG_FILE");
+		path = file != nullptr ? file : LOG_DEFAULT_FILE;
+		if(!path.empty()) {
+			openFile();
+		}
+		buffer.reserve(LOG_BUFFER_SIZE);
+
+		wake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if(wake < 0) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to create the log event");
+		}
+
+		//Start taking messages
+		active = true;
+		wThread = std::thread(writerThread);
+
+		//Success
+		printf(OKAY "\n");
+		if(!path.empty() && fd < 0) {
+			warn("Failed to open the log file %s\n", path.c_str());
+		}
+	}
+
+	/*!	Log Destruction Method.
+	 *
+	 * 	This method writes out every message still queued, stops the writer
+	 * 	thread and closes the file.  Messages logged afterwards are printed
+	 * 	straight away.
+	 */
+	void destroy() {
+		//Destroy the logger
+		printf(LOADING "Destroying Log...");
+		fflush(stdout);
+
+		if(wake >= 0) {
+			active = false;
+			run = false;
+			uint64_t one = 1;
+			if(::write(wake, &one, sizeof(one)) < 0) {
+				printf("\r[" YELLOW "WARN\n" RESET);
+				printf("  Failed to wake the log writer");
+				return;
+			}
+			wThread.join();
+			close(wake);
+			wake = -1;
+		}
+		if(fd >= 0) {
+			close(fd);
+			fd = -1;
+		}
+
+		//Success
+		printf(OKAY "\n");
+	}
+}
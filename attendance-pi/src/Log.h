@@ -0,0 +1,24 @@
+#pragma once
+
+namespace Log {
+
+	///How serious a message is, in increasing order
+	typedef enum {
+		LEVEL_DEBUG,
+		LEVEL_INFO,
+		LEVEL_OKAY,
+		LEVEL_WARN,
+		LEVEL_FAIL
+	} Level;
+
+	void init();
+	void destroy();
+
+	void write(Level, const char* format, ...)
+		__attribute__((format(printf, 2, 3)));
+	void debug(const char* format, ...) __attribute__((format(printf, 1, 2)));
+	void info(const char* format, ...) __attribute__((format(printf, 1, 2)));
+	void okay(const char* format, ...) __attribute__((format(printf, 1, 2)));
+	void warn(const char* format, ...) __attribute__((format(printf, 1, 2)));
+	void fail(const char* format, ...) __attribute__((format(printf, 1, 2)));
+}
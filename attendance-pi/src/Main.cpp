@@ -7,57 +7,177 @@
 #include "RFID.h"
 #include "Clock.h"
 #include "UserHandler.h"
+#include "Sender.h"
+#include "Journal.h"
 #include "Utils.h"
+#include "Http.h"
+#include "Input.h"
+#include "NetMonitor.h"
+#include "Health.h"
+#include "Metrics.h"
+#include "Hal.h"
+#include "Gossip.h"
+#include "Log.h"
+#include "Screen.h"
+#include "Reactor.h"
 
 #include "State.h"
 #include "ANSI.h"
 
 #include <stdio.h>
 #include <stdexcept>
-#include <bcm2835.h>
 #include <unistd.h>
 #include <string>
 #include <fstream>
 #include <streambuf>
-#include <signal.h>
+#include <atomic>
 #include <thread>
-#include <mutex>
-#include <condition_variable>
+#include <ctime>
+#include <time.h>
 
-std::mutex m;
-std::condition_variable cv;
-bool running = true;
+///Time between two looks at the connection, in milliseconds
+#define MAIN_POLL_INTERVAL	1000
 
-void catch_signal(int signum) {
-	// notify main thread to die
-	running = false;
-	cv.notify_one();
+//Once the users are loaded, taps keep working without a connection
+std::atomic<bool> haveUsers(false);
+//Whether the users have been refreshed from the server since boot
+bool synced = false;
+//Whether serverWork() is waiting for the worker or running on it
+std::atomic<bool> workPending(false);
+//When main() started, from Metrics::now()
+uint64_t bootStart = 0;
+//Whether the kiosk has been READY since it started
+std::atomic<bool> bootDone(false);
+
+/*!	Boot time listener.
+ *
+ * 	Records how long it took to get to READY the first time, both from the
+ * 	program starting and from the system booting, which after a power blip
+ * 	is how long the kiosk was out.
+ */
+void bootReady(State::State from, State::State to, void* ctx) {
+	if (to != State::READY || bootDone.exchange(true)) {
+		return;
+	}
+	uint64_t ready = (Metrics::now() - bootStart) / 1000;
+	Metrics::set(Metrics::BOOT_READY, ready);
+	struct timespec uptime;
+	if (clock_gettime(CLOCK_BOOTTIME, &uptime) == 0) {
+		uint64_t sinceBoot = (uint64_t) uptime.tv_sec * 1000 + uptime.tv_nsec / 1000000;
+		Metrics::set(Metrics::BOOT_UPTIME_READY, sinceBoot);
+		Log::okay("Ready %llu ms after starting, %llu ms after booting\n",
+			(unsigned long long) ready, (unsigned long long) sinceBoot);
+	} else {
+		Log::okay("Ready %llu ms after starting\n", (unsigned long long) ready);
+	}
+}
+
+/*!	Talk to the server if the connection and backoff allow it.
+ *
+ * 	Runs on the reactor's worker thread, since each step may wait on the
+ * 	server.
+ */
+void serverWork(void* ctx) {
+	//The network monitor keeps the connection icon up to date itself
+	if (!NetMonitor::connected()) {
+		Sender::disconnect();
+		if (!haveUsers) {
+			State::changeState(State::NO_INTERNET);
+		}
+	} else if (Health::ready()) {
+		//Only talk to the server as often as the backoff allows
+		if (State::state == State::NO_INTERNET) {
+			if (Health::probe()) {
+				Screen::show(Screen::MESSAGE, "Loading users...");
+				if (UserHandler::update()) {
+					haveUsers = true;
+					synced = true;
+					Sender::reconnect();
+					State::changeState(State::READY);
+					Clock::wakeup();
+				} else {
+					Health::reportFailure();
+					Utils::showRequestError();
+					Screen::show(Screen::MESSAGE, "Connecting...");
+				}
+			} else {
+				Screen::show(Screen::MESSAGE, "Connecting...");
+			}
+		} else if (!synced) {
+			//Bring the users restored at boot up to date in the background
+			if (Health::probe()) {
+				if (UserHandler::update()) {
+					synced = true;
+					Sender::reconnect();
+				} else {
+					//Nobody is waiting on this, so keep it off the display
+					Log::warn("Could not bring the restored users up to date\n");
+					Health::reportFailure();
+				}
+			}
+		} else if (Sender::isOffline()) {
+			//Replay anything that piled up while the server was away
+			if (Health::probe()) {
+				Sender::reconnect();
+			}
+		}
+	}
+	workPending = false;
+}
+
+/*!	Poll timer handler.
+ *
+ * 	Hands serverWork() to the worker, unless the last one is still going.
+ */
+void pollTick(uint32_t events, void* ctx) {
+	if (!workPending.exchange(true)) {
+		Reactor::defer(serverWork, nullptr);
+	}
 }
 
 int main() {
-	// add signal handlers
-	struct sigaction action1 = {};
-	action1.sa_handler = catch_signal;
-	sigaction(SIGTERM, &action1, NULL);
-	sigaction(SIGINT, &action1, NULL);
+	bootStart = Metrics::now();
+	State::subscribe(bootReady, nullptr);
+	//Timer for pollTick()
+	int pollTimer = -1;
+	//Loads the users saved by the last run while the hardware comes up
+	std::thread loader;
 	//Change state
 	State::changeState(State::INIT);
 	//Initialize components
 	printf(INFO "Initializing components...\n");
 	try {
 		//Initialize things
+		Reactor::init();
+		Log::init();
 		Main::init();
+		Metrics::init();
+		Http::init();
+		Health::init();
+		//Nothing below needs the user table until the User Handler
+		loader = std::thread([] { haveUsers = UserHandler::restore(); });
 		LCD::init();
+		Screen::init();
 		Buzzer::init();
 		Keypad::init();
 		RFID::init();
 		Clock::init();
+		NetMonitor::init();
 
+		loader.join();
 		UserHandler::init();
+		Journal::init();
+		Sender::init();
+		Gossip::init();
+		Input::init();
+		pollTimer = Reactor::timer(pollTick, nullptr);
 	} catch(const std::exception& e) {
 		//Catch the error
 		printf("\n\n");
 		printf(FAIL "%s\n" RESET, e.what());
+		if (loader.joinable()) {
+			loader.join();
+		}
 		State::changeState(State::ERROR);
 		exit(0);
 	}
@@ -65,63 +185,34 @@ int main() {
 	fflush(stdout);
 	fflush(stderr);
 
-	State::changeState(State::NO_INTERNET);
-	std::unique_lock<std::mutex> lk(m);
-
-	while (true) {
-		std::vector<Utils::ConnectionState> cs = Utils::getConnectionState();
-		if (cs.size() == 0) {
-			State::haveWifi = false;
-			State::haveEthernet = false;
-			State::changeState(State::NO_INTERNET);
-			Clock::wakeup();
-		} else {
-			bool wifi = false, ethernet = false;
-			for (int i = 0; i < cs.size(); i++) {
-				if (cs[i].connectionType == Utils::WIFI) {
-					wifi = true;
-				} else if (cs[i].connectionType == Utils::ETHERNET) {
-					ethernet = true;
-				}
-			}
-			State::haveWifi = wifi;
-			State::haveEthernet = ethernet;
-
-			if (State::state == State::NO_INTERNET) {
-				if (Utils::hasInternetConnectivity()) {
-					LCD::writeMessage("Loading users...", 0, 0);
-					if (UserHandler::update()) {
-						State::changeState(State::READY);
-						Clock::wakeup();
-					} else {
-						LCD::writeMessage("Connecting...   ", 0, 0);
-					}
-				} else {
-					LCD::writeMessage("Connecting...   ", 0, 0);
-				}
-			}
-		}
-
-		// wait 1 sec until we poll again, or until interrupted by a signal
-		cv.wait_for(lk, std::chrono::seconds(1));
-		if (!running) {
-			// interrupted, time to clean up and exit
-			break;
-		}
-	}
+	State::changeState(haveUsers ? State::READY : State::NO_INTERNET);
 
-	lk.release();
+	//Look at the connection straight away, then once a second
+	Reactor::arm(pollTimer, 0, MAIN_POLL_INTERVAL);
+	//Handle everything until SIGTERM or SIGINT
+	Reactor::run();
 
 	//Clean up time
 	State::changeState(State::STOPPING);
 	printf(INFO "Destroying components...\n");
+	Input::destroy();
+	Gossip::destroy();
+	Sender::destroy();
+	Journal::destroy();
 	UserHandler::destroy();
+	NetMonitor::destroy();
 	Clock::destroy();
 	RFID::destroy();
 	Keypad::destroy();
 	Buzzer::destroy();
+	Screen::destroy();
 	LCD::destroy();
+	Health::destroy();
+	Http::destroy();
+	Metrics::destroy();
 	Main::destroy();
+	Reactor::destroy();
+	Log::destroy();
 
 	//Change state for the last time
 	State::changeState(State::STOPPED);
@@ -135,7 +226,7 @@ namespace Main {
 		fflush(stdout);
 
 		//Initialize the bcm2835 library
-		if(!bcm2835_init()) {
+		if(!Hal::init()) {
 			//Failed to initialize library
 			printf("\r[" RED "FAIL\n" RESET);
 			throw std::runtime_error("Failed to initialize bcm2835 library");
@@ -181,7 +272,7 @@ namespace Main {
 		fflush(stdout);
 
 		//Un-initialize the bcm2835 library
-		if(!bcm2835_close()) {
+		if(!Hal::close()) {
 			//Failed to de-initialize library
 			printf("\r[" YELLOW "WARN\n" RESET);
 			printf("  Failed to destroy bcm2835 library");
@@ -0,0 +1,253 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Metrics.h"
+#include "Log.h"
+#include "Reactor.h"
+#include "ANSI.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+///Number of histogram buckets, bucket i holds durations under 2^i microseconds
+#define METRICS_BUCKETS				24
+///Default file the metrics are written to
+#define METRICS_DEFAULT_FILE		"metrics.prom"
+///Default time between two writes of the file, in seconds
+#define METRICS_DEFAULT_INTERVAL	60
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The initialization process for the metrics sets a Reactor timer for
+ * 	writing them out, so it must run after the reactor's.  Recording works
+ * 	before it runs, so it doesn't matter which modules are initialized
+ * 	first otherwise.
+ *
+ * 	@section recording	Recording
+ *
+ * 	Timings are taken with the monotonic clock, in microseconds, around the
+ * 	steps between a card being read and the greeting being shown, and
+ * 	around talking to the server.  Each one is added to a histogram whose
+ * 	buckets double in width, so recording one is a handful of relaxed
+ * 	atomic additions with no locks and no allocation, and is cheap enough
+ * 	to leave in everywhere.
+ *
+ * 	@section export	Export
+ *
+ * 	Every @p METRICS_INTERVAL seconds, and once more on exit, the metrics
+ * 	are written to @p METRICS_FILE in the Prometheus text format, so the
+ * 	file can be picked up by the node exporter's textfile collector or
+ * 	simply read over ssh.  The file is replaced atomically, so a reader
+ * 	never sees half of it.  Setting @p METRICS_FILE to an empty string
+ * 	turns the export off.
+ *
+ */
+namespace Metrics {
+
+	/**
+	 * Histogram of durations
+	 * buckets: Number of durations under 2^i microseconds, and not in an
+	 *  earlier bucket; the last bucket holds everything longer
+	 * count: Number of durations
+	 * sum: Total of every duration, in microseconds
+	 */
+	struct Histogram {
+		std::atomic<uint64_t> buckets[METRICS_BUCKETS];
+		std::atomic<uint64_t> count;
+		std::atomic<uint64_t> sum;
+	};
+
+	/**
+	 * How a metric is exported
+	 * name: Metric name, without the common prefix
+	 * help: Description
+	 * gauge: For counters, whether the value is set rather than added to
+	 */
+	struct Info {
+		const char* name;
+		const char* help;
+		bool gauge;
+	};
+
+	///Timers, in the same order as @p Timer
+	const Info timerInfo[TIMER_COUNT] = {
+		{ "rfid_read_seconds", "Time from a card answering to its UID being read", false },
+		{ "user_lookup_seconds", "Time to find the owner of a card", false },
+		{ "tap_to_greeting_seconds", "Time from a card being read to its owner being greeted", false },
+		{ "lcd_write_seconds", "Time taken by a write to the display", false },
+		{ "http_trigger_seconds", "Round trip time of a sign in or tag request", false },
+		{ "roster_sync_seconds", "Time taken by a user list update", false }
+	};
+
+	///Counters, in the same order as @p Counter
+	const Info counterInfo[COUNTER_COUNT] = {
+		{ "cards_read_total", "Cards read", false },
+		{ "i2c_errors_total", "Failed writes to the display", false },
+		{ "http_trigger_failures_total", "Sign in or tag requests that failed", false },
+		{ "roster_sync_failures_total", "User list updates that failed", false },
+		{ "roster_bytes_total", "Bytes of user list downloaded", false },
+		{ "roster_users", "Users in the user table", true },
+		{ "roster_signed_in", "Users signed in on the user table", true },
+		{ "boot_ready_milliseconds", "Time from the program starting to the first READY", true },
+		{ "boot_uptime_ready_milliseconds", "Time from the system booting to the first READY", true }
+	};
+
+	Histogram timers[TIMER_COUNT];
+	std::atomic<uint64_t> counters[COUNTER_COUNT];
+
+	///File the metrics are written to, empty if they aren't
+	std::string path;
+	///Time between two writes, in seconds
+	long interval = METRICS_DEFAULT_INTERVAL;
+
+	///Timer for the next write, or -1 if the export is off
+	int timer = -1;
+
+	/*!	Get the monotonic time.
+	 *
+	 * 	@returns	The time in microseconds, from an arbitrary start
+	 */
+	uint64_t now() {
+		return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	/*!	Record a duration.
+	 *
+	 * 	Can be called from any thread.
+	 */
+	void record(Timer timer, uint64_t micros) {
+		Histogram& h = timers[timer];
+		int bucket = 0;
+		while(bucket < METRICS_BUCKETS - 1 && micros >= (1ULL << bucket)) {
+			bucket++;
+		}
+		h.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+		h.count.fetch_add(1, std::memory_order_relaxed);
+		h.sum.fetch_add(micros, std::memory_order_relaxed);
+	}
+
+	/*!	Record the time since @p start, which came from now().
+	 */
+	void since(Timer timer, uint64_t start) {
+		record(timer, now() - start);
+	}
+
+	/*!	Add to a counter.
+	 */
+	void add(Counter counter, uint64_t n) {
+		counters[counter].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	/*!	Set a gauge.
+	 */
+	void set(Counter counter, uint64_t value) {
+		counters[counter].store(value, std::memory_order_relaxed);
+	}
+
+	/*!	Write every metric to the file.
+	 */
+	void write() {
+		std::string tmp = path + ".tmp";
+		FILE* file = fopen(tmp.c_str(), "w");
+		if(file == nullptr) {
+			Log::warn("Failed to write the metrics to %s\n", tmp.c_str());
+			return;
+		}
+		for(int i = 0; i < TIMER_COUNT; i++) {
+			const Info& info = timerInfo[i];
+			fprintf(file, "# HELP attendance_%s %s\n", info.name, info.help);
+			fprintf(file, "# TYPE attendance_%s histogram\n", info.name);
+			uint64_t cumulative = 0;
+			for(int b = 0; b < METRICS_BUCKETS - 1; b++) {
+				cumulative += timers[i].buckets[b].load(std::memory_order_relaxed);
+				fprintf(file, "attendance_%s_bucket{le=\"%g\"} %llu\n", info.name,
+					(double) (1ULL << b) / 1e6, (unsigned long long) cumulative);
+			}
+			uint64_t count = timers[i].count.load(std::memory_order_relaxed);
+			fprintf(file, "attendance_%s_bucket{le=\"+Inf\"} %llu\n", info.name,
+				(unsigned long long) count);
+			fprintf(file, "attendance_%s_sum %g\n", info.name,
+				(double) timers[i].sum.load(std::memory_order_relaxed) / 1e6);
+			fprintf(file, "attendance_%s_count %llu\n", info.name,
+				(unsigned long long) count);
+		}
+		for(int i = 0; i < COUNTER_COUNT; i++) {
+			const Info& info = counterInfo[i];
+			fprintf(file, "# HELP attendance_%s %s\n", info.name, info.help);
+			fprintf(file, "# TYPE attendance_%s %s\n", info.name,
+				info.gauge ? "gauge" : "counter");
+			fprintf(file, "attendance_%s %llu\n", info.name,
+				(unsigned long long) counters[i].load(std::memory_order_relaxed));
+		}
+		if(fclose(file) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+			Log::warn("Failed to write the metrics to %s\n", path.c_str());
+		}
+	}
+
+	/*!	Writer job, run on the reactor's worker so the SD card can take its
+	 * 	time.
+	 */
+	void writer(void* ctx) {
+		write();
+	}
+
+	/*!	Write timer handler.
+	 */
+	void tick(uint32_t events, void* ctx) {
+		Reactor::defer(writer, nullptr);
+	}
+
+	/*!	Metrics Initialization Method.
+	 *
+	 * 	This method reads the export settings and sets the write timer.
+	 */
+	void init() {
+		//Initialize the metrics
+		printf(LOADING "Initializing Metrics...");
+		fflush(stdout);
+
+		const char* file = getenv("METRICS_FILE");
+		path = file != nullptr ? file : METRICS_DEFAULT_FILE;
+		const char* seconds = getenv("METRICS_INTERVAL");
+		if(seconds != nullptr && atol(seconds) > 0) {
+			interval = atol(seconds);
+		}
+
+		//Start the writer, unless the export is off
+		if(!path.empty()) {
+			try {
+				timer = Reactor::timer(tick, nullptr);
+			} catch(const std::exception& e) {
+				printf("\r[" RED "FAIL\n" RESET);
+				throw;
+			}
+			Reactor::arm(timer, interval * 1000, interval * 1000);
+		}
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/*!	Metrics Destruction Method.
+	 *
+	 * 	This method stops the write timer and writes the file one last time.
+	 */
+	void destroy() {
+		//Destroy the metrics
+		printf(LOADING "Destroying Metrics...");
+		fflush(stdout);
+
+		if(timer >= 0) {
+			Reactor::remove(timer);
+			timer = -1;
+			write();
+		}
+
+		//Success
+		printf(OKAY "\n");
+	}
+}
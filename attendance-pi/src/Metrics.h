@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace Metrics {
+
+	///Durations that are kept as histograms
+	typedef enum {
+		RFID_READ,
+		USER_LOOKUP,
+		TAP_TO_GREETING,
+		LCD_WRITE,
+		HTTP_TRIGGER,
+		ROSTER_SYNC,
+		TIMER_COUNT
+	} Timer;
+
+	///Values that are counted, or set
+	typedef enum {
+		CARDS_READ,
+		I2C_ERRORS,
+		HTTP_TRIGGER_FAILURES,
+		ROSTER_SYNC_FAILURES,
+		ROSTER_BYTES,
+		ROSTER_USERS,
+		ROSTER_SIGNED_IN,
+		BOOT_READY,
+		BOOT_UPTIME_READY,
+		COUNTER_COUNT
+	} Counter;
+
+	void init();
+	void destroy();
+
+	uint64_t now();
+	void record(Timer, uint64_t micros);
+	void since(Timer, uint64_t start);
+	void add(Counter, uint64_t n = 1);
+	void set(Counter, uint64_t value);
+}
@@ -0,0 +1,404 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "NetMonitor.h"
+#include "Input.h"
+#include "Health.h"
+#include "Log.h"
+#include "Reactor.h"
+#include "ANSI.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdexcept>
+#include <mutex>
+#include <map>
+#include <string>
+#include <poll.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/wireless.h>
+#include <arpa/inet.h>
+
+///Size of the netlink receive buffer
+#define NET_MONITOR_BUFFER	8192
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The initialization process for the network monitor opens a routing
+ * 	netlink socket subscribed to link and IPv4 address changes, asks the
+ * 	kernel for every link and address there is right now, and hands the
+ * 	socket to the Reactor.
+ *
+ * 	@section net_cache	Interface Cache
+ *
+ * 	Rather than walking every interface and asking for its flags, type and
+ * 	address with a handful of ioctls once a second, the monitor keeps a
+ * 	table of the interfaces the kernel has told it about and changes it
+ * 	only when the kernel sends a link or address message.  Whether an
+ * 	interface is wireless is asked once, when it first appears.  Whenever
+ * 	the set of connections that are up changes, a NETWORK event is posted
+ * 	to the Input bus, which updates @p State::haveWifi and
+ * 	@p State::haveEthernet and redraws the connection icon.
+ *
+ * 	The Wi-Fi signal strength changes constantly and is only ever shown on
+ * 	the diagnostics screen, so it isn't cached; Utils::getConnectionState()
+ * 	samples it when asked.
+ *
+ * 	If the kernel sends changes faster than they are read, the socket
+ * 	overruns and some of them are lost.  The table is then listed again
+ * 	from scratch, dropping any interface the kernel no longer has, before
+ * 	the connections are posted.
+ *
+ */
+namespace NetMonitor {
+
+	/**
+	 * What the monitor knows about an interface
+	 * name: Interface name
+	 * running: Whether the interface is up and running
+	 * loopback: Whether this is a loopback interface, which is never counted
+	 * wireless: Whether this is a wireless interface
+	 * ip: The interface's IPv4 address, or empty if it doesn't have one
+	 * listed: Whether the kernel listed the interface since the last resync
+	 */
+	struct Interface {
+		std::string name;
+		bool running;
+		bool loopback;
+		bool wireless;
+		std::string ip;
+		bool listed;
+	};
+
+	//Private declarations
+	void onNetlink(uint32_t events, void* ctx);
+
+	///Netlink socket
+	int sock = -1;
+	///Netlink sequence number for requests
+	uint32_t sequence = 0;
+	///Whether messages were lost since the table was last listed
+	bool overrun = false;
+
+	///Interfaces, by index
+	std::map<int, Interface> interfaces;
+	///Guards @p interfaces
+	std::mutex lock;
+
+	///Connections last posted to the Input bus
+	bool postedWifi = false;
+	bool postedEthernet = false;
+	bool posted = false;
+
+	/*!	Check whether an interface is wireless.
+	 *
+	 * 	Only wireless interfaces answer a request for their protocol name.
+	 */
+	bool isWireless(const char* name) {
+		int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+		if(fd < 0) {
+			return false;
+		}
+		struct iwreq request = {};
+		strncpy(request.ifr_name, name, IFNAMSIZ - 1);
+		bool wireless = ioctl(fd, SIOCGIWNAME, &request) != -1;
+		close(fd);
+		return wireless;
+	}
+
+	/*!	Handle a link message.
+	 *
+	 * 	Must be called with @p lock held.
+	 */
+	void handleLink(struct nlmsghdr* header) {
+		struct ifinfomsg* info = (struct ifinfomsg*) NLMSG_DATA(header);
+		if(header->nlmsg_type == RTM_DELLINK) {
+			interfaces.erase(info->ifi_index);
+			return;
+		}
+		Interface& iface = interfaces[info->ifi_index];
+		iface.listed = true;
+		iface.running = (info->ifi_flags & IFF_UP) && (info->ifi_flags & IFF_RUNNING);
+		iface.loopback = (info->ifi_flags & IFF_LOOPBACK) != 0;
+		//Find the name
+		int length = IFLA_PAYLOAD(header);
+		for(struct rtattr* attr = IFLA_RTA(info); RTA_OK(attr, length);
+				attr = RTA_NEXT(attr, length)) {
+			if(attr->rta_type == IFLA_IFNAME) {
+				std::string name((const char*) RTA_DATA(attr));
+				if(name != iface.name) {
+					iface.name = name;
+					iface.wireless = !iface.loopback && isWireless(name.c_str());
+				}
+			}
+		}
+	}
+
+	/*!	Handle an address message.
+	 *
+	 * 	Must be called with @p lock held.
+	 */
+	void handleAddress(struct nlmsghdr* header) {
+		struct ifaddrmsg* info = (struct ifaddrmsg*) NLMSG_DATA(header);
+		if(info->ifa_family != AF_INET) {
+			return;
+		}
+		auto it = interfaces.find(info->ifa_index);
+		if(it == interfaces.end()) {
+			return;
+		}
+		//Prefer the local address, which differs on point to point links
+		char ip[INET_ADDRSTRLEN] = "";
+		int length = IFA_PAYLOAD(header);
+		for(struct rtattr* attr = IFA_RTA(info); RTA_OK(attr, length);
+				attr = RTA_NEXT(attr, length)) {
+			if(attr->rta_type == IFA_LOCAL ||
+					(attr->rta_type == IFA_ADDRESS && ip[0] == '\0')) {
+				inet_ntop(AF_INET, RTA_DATA(attr), ip, sizeof(ip));
+			}
+		}
+		if(header->nlmsg_type == RTM_NEWADDR) {
+			it->second.ip = ip;
+		} else if(it->second.ip == ip) {
+			it->second.ip.clear();
+		}
+	}
+
+	/*!	Read and handle every message waiting on the socket.
+	 *
+	 * 	@returns	@p true once the reply to a dump request has ended, and
+	 * 		@p false if there was nothing more to read
+	 */
+	bool receive() {
+		char buffer[NET_MONITOR_BUFFER] __attribute__((aligned(NLMSG_ALIGNTO)));
+		bool done = false;
+		while(!done) {
+			ssize_t length = recv(sock, buffer, sizeof(buffer), MSG_DONTWAIT);
+			if(length < 0) {
+				if(errno == ENOBUFS) {
+					//We fell behind and missed messages, the table is listed again
+					Log::warn("Network monitor missed messages\n");
+					overrun = true;
+					continue;
+				}
+				return false;
+			}
+			std::lock_guard<std::mutex> guard(lock);
+			for(struct nlmsghdr* header = (struct nlmsghdr*) buffer;
+					NLMSG_OK(header, length); header = NLMSG_NEXT(header, length)) {
+				switch(header->nlmsg_type) {
+					case NLMSG_DONE:
+					case NLMSG_ERROR:
+						done = true;
+						break;
+					case RTM_NEWLINK:
+					case RTM_DELLINK:
+						handleLink(header);
+						break;
+					case RTM_NEWADDR:
+					case RTM_DELADDR:
+						handleAddress(header);
+						break;
+				}
+			}
+		}
+		return true;
+	}
+
+	/*!	Ask the kernel for every link or address.
+	 *
+	 * 	Waits for the whole reply, handling it as it arrives.
+	 */
+	bool dump(int type) {
+		struct {
+			struct nlmsghdr header;
+			struct rtgenmsg message;
+		} request = {};
+		request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+		request.header.nlmsg_type = type;
+		request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+		request.header.nlmsg_seq = ++sequence;
+		request.message.rtgen_family = AF_UNSPEC;
+		if(send(sock, &request, request.header.nlmsg_len, 0) < 0) {
+			return false;
+		}
+		struct pollfd pfd = { sock, POLLIN, 0 };
+		while(true) {
+			if(poll(&pfd, 1, 1000) <= 0) {
+				return false;
+			}
+			if(receive()) {
+				return true;
+			}
+		}
+	}
+
+	/*!	Post the connections if they have changed.
+	 */
+	void publish() {
+		bool wifi = false, ethernet = false;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for(auto it = interfaces.begin(); it != interfaces.end(); ++it) {
+				if(!it->second.running || it->second.loopback) {
+					continue;
+				}
+				if(it->second.wireless) {
+					wifi = true;
+				} else {
+					ethernet = true;
+				}
+			}
+		}
+		if(!posted || wifi != postedWifi || ethernet != postedEthernet) {
+			//A link coming up is the best time to look for the server again
+			if(posted && (wifi || ethernet) && !postedWifi && !postedEthernet) {
+				Health::linkUp();
+			}
+			posted = true;
+			postedWifi = wifi;
+			postedEthernet = ethernet;
+			Input::postNetwork(wifi, ethernet);
+		}
+	}
+
+	/*!	List every link and address again after messages were lost.
+	 *
+	 * 	Interfaces the kernel doesn't list anymore are dropped, as are the
+	 * 	addresses, which are filled in again from the second list.
+	 */
+	bool resync() {
+		overrun = false;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for(auto it = interfaces.begin(); it != interfaces.end(); ++it) {
+				it->second.listed = false;
+			}
+		}
+		if(!dump(RTM_GETLINK)) {
+			return false;
+		}
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for(auto it = interfaces.begin(); it != interfaces.end();) {
+				if(!it->second.listed) {
+					it = interfaces.erase(it);
+				} else {
+					it->second.ip.clear();
+					++it;
+				}
+			}
+		}
+		return dump(RTM_GETADDR);
+	}
+
+	/*!	Netlink socket handler.
+	 *
+	 * 	Runs on the reactor thread whenever the kernel has sent a change.  If
+	 * 	messages were lost, the table is listed again before it is posted; if
+	 * 	that fails too, it is tried again on the next change.
+	 */
+	void onNetlink(uint32_t events, void* ctx) {
+		receive();
+		if(overrun && !resync()) {
+			Log::warn("Network monitor could not list the interfaces again\n");
+			overrun = true;
+		}
+		publish();
+	}
+
+	/*!	Check whether any connection is up.
+	 */
+	bool connected() {
+		std::lock_guard<std::mutex> guard(lock);
+		for(auto it = interfaces.begin(); it != interfaces.end(); ++it) {
+			if(it->second.running && !it->second.loopback) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*!	Get every connection that is up.
+	 *
+	 * 	The signal strength isn't filled in.
+	 */
+	std::vector<Utils::ConnectionState> connections() {
+		std::vector<Utils::ConnectionState> states;
+		std::lock_guard<std::mutex> guard(lock);
+		for(auto it = interfaces.begin(); it != interfaces.end(); ++it) {
+			if(!it->second.running || it->second.loopback) {
+				continue;
+			}
+			Utils::ConnectionState state;
+			state.connectionType = it->second.wireless ? Utils::WIFI : Utils::ETHERNET;
+			state.dBm = 0;
+			state.name = it->second.name;
+			state.ip = it->second.ip;
+			states.push_back(state);
+		}
+		return states;
+	}
+
+	/*!	Network Monitor Initialization Method.
+	 *
+	 * 	This method opens the netlink socket, reads the interfaces that exist
+	 * 	now and starts listening for changes.
+	 */
+	void init() {
+		//Initialize the network monitor
+		printf(LOADING "Initializing Network Monitor...");
+		fflush(stdout);
+
+		sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+		if(sock < 0) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to open the netlink socket");
+		}
+		struct sockaddr_nl address = {};
+		address.nl_family = AF_NETLINK;
+		address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+		if(bind(sock, (struct sockaddr*) &address, sizeof(address)) < 0) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to bind the netlink socket");
+		}
+		//Find out what is there already
+		if(!dump(RTM_GETLINK) || !dump(RTM_GETADDR)) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to list the network interfaces");
+		}
+		publish();
+
+		//Listen for changes
+		if(!Reactor::watch(sock, EPOLLIN, onNetlink, nullptr)) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to watch the netlink socket");
+		}
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/*!	Network Monitor Destruction Method.
+	 *
+	 * 	This method takes the socket back from the reactor and closes it.
+	 */
+	void destroy() {
+		//Destroy the network monitor
+		printf(LOADING "Destroying Network Monitor...");
+		fflush(stdout);
+
+		Reactor::remove(sock);
+		close(sock);
+
+		//Success
+		printf(OKAY "\n");
+	}
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "Utils.h"
+
+#include <vector>
+
+namespace NetMonitor {
+
+	void init();
+	void destroy();
+
+	bool connected();
+	std::vector<Utils::ConnectionState> connections();
+}
@@ -1,179 +1,571 @@
 #include "RFID.h"
 #include "mfrc522/MFRC522.h"
 #include "LCD.h"
+#include "Log.h"
 #include "ANSI.h"
-#include "Buzzer.h"
-#include "UserHandler.h"
-#include "State.h"
+#include "EdgeMonitor.h"
+#include "Input.h"
+#include "Metrics.h"
 
+#include "Hal.h"
 #include <bcm2835.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string>
 #include <sstream>
+#include <atomic>
 #include <thread>
+#include <vector>
+#include <stdexcept>
+#include <chrono>
 #include <time.h>
 
 using std::string;
 using std::stringstream;
 
+///Default time between detection cycles in interrupt mode, in milliseconds
+#define RFID_DEFAULT_SCAN_INTERVAL	50
+///Time a card needs the field for before it can answer, in microseconds
+#define RFID_FIELD_SETTLE			5000
+///Longest wait for the IRQ pin, a little over the MFRC522's 25ms timeout
+#define RFID_IRQ_TIMEOUT			30
+///Chip selects used when RFID_READERS isn't set
+#define RFID_DEFAULT_READERS		"0"
+///Fastest SPI clock the readers are run at, 7.8MHz, under the MFRC522's 10MHz
+#define RFID_MIN_SPI_DIVIDER		32
+///Slowest SPI clock the readers are run at
+#define RFID_MAX_SPI_DIVIDER		32768
+
 /*!	@section mod_init	Module Initialization
  *
  * 	The initialization process for the RFID interface first initializes the
- * 	MFRC522 library, and then proceeds to spawn a polling thread. The MFRC522
- * 	library does not throw any exceptions or return any indication of weather
- * 	or not the device is working, so we just kind of assume it is and move on
- * 	with our lives.
+ * 	MFRC522 library for every reader, and then proceeds to spawn a polling
+ * 	thread. The MFRC522 library does not throw any exceptions or return any
+ * 	indication of weather or not the device is working, so we just kind of
+ * 	assume it is and move on with our lives.
  *
  * 	@image html rfid_flow.png
  *
+ * 	@section readers	Several Readers
+ *
+ * 	More than one MFRC522 can share the SPI bus, each on its own chip select.
+ * 	The @p RFID_READERS environment variable lists the chip selects in use,
+ * 	separated by commas (@p "0,1" for two readers), and a reader's id is its
+ * 	place in that list.  Only one thread ever talks to the readers, so the
+ * 	bus needs no lock: it points the bus at a reader before each turn and
+ * 	takes the readers in turn, starting one further along every round so
+ * 	none of them is always served first.  Cards are posted to the Input bus
+ * 	with the id of the reader they were seen on.
+ *
  * 	@section poll_thread	Polling Thread
  *
- * 	The polling thread continuously calls @p RFID::pollForUID() in an attempt
- * 	to retrieve the UID of any card that is brought up to the reader, either as
- * 	a ritual sacrifice or otherwise.  Should there be no card present, the
- * 	thread simply tries again, after waiting an excruciating 2 milliseconds.
+ * 	The polling thread continuously calls @p pollForUID() on each reader in
+ * 	an attempt to retrieve the UID of any card that is brought up to it,
+ * 	either as a ritual sacrifice or otherwise.  Should there be no card
+ * 	present, the thread simply tries again, after waiting an excruciating 2
+ * 	milliseconds.  Cards that are read are posted to the Input bus, so the
+ * 	thread is back to looking for the next card straight away.
+ *
+ * 	@section irq_mode	Interrupt Mode
+ *
+ * 	If each MFRC522's IRQ pin is wired up and the GPIO numbers are given in
+ * 	the @p RFID_IRQ_PIN environment variable, in the same order as
+ * 	@p RFID_READERS, the thread stops polling.  It instead runs a short
+ * 	detection cycle every @p RFID_SCAN_INTERVAL milliseconds (50 by
+ * 	default): the antennas are switched on, a REQA is started on every
+ * 	reader, and the thread sleeps until each IRQ pin reports either an
+ * 	answer or the reader's 25ms timeout.  The pins are active low, so only
+ * 	falling edges count: a pin stays low from the end of one cycle until
+ * 	the next command clears its interrupts and lets it go high again.  The readers wait out their
+ * 	timeouts side by side, so a cycle takes no longer with several of them.
+ * 	Between cycles the antennas are off and the thread sleeps, so an idle
+ * 	reader costs a handful of SPI transfers per cycle instead of a
+ * 	busy-waiting transceive every 2ms.  A card that has been read is halted
+ * 	and the field kept on until it is taken away, so holding it against the
+ * 	reader does not read it again.  A halted card doesn't answer a REQA, so
+ * 	another card put down next to it or swapped in for it is still read
+ * 	straight away.  If any reader has no usable IRQ pin, every reader is
+ * 	polled.
  *
  *	@image html rfid_threadflow.png
+ *
+ * 	@section spi_clock	SPI Clock
+ *
+ * 	The readers share one SPI clock, the core clock divided by
+ * 	@p RFID_SPI_DIVIDER (64 by default, about 3.9MHz).  It must be even and
+ * 	at least 32, since the MFRC522 is only good for 10MHz.  Most of the time
+ * 	from a card arriving to its UID being known is spent on the bus, so a
+ * 	faster clock reads cards sooner, as long as the wiring is short enough to
+ * 	keep up.  Setting @p RFID_BENCHMARK to a number of reads makes the module
+ * 	time that many reads of whatever card is on the first reader at each of
+ * 	a few dividers when it starts, and log the average, to help choose one.
  */
 namespace RFID {
 
-	///RFID reader reference object
-	MFRC522* mfrc;
+	/**
+	 * One MFRC522 on the bus
+	 * id: The reader's place in RFID_READERS
+	 * mfrc: RFID reader reference object
+	 * irqPin: The GPIO its IRQ pin is wired to, or -1
+	 * fieldOn: Whether the antenna is powered, in interrupt mode
+	 * cardHalted: Whether the last card read was halted and is being kept in
+	 *  the field
+	 * raised: Whether the IRQ pin has fired in the current cycle
+	 */
+	struct Reader {
+		int id;
+		MFRC522* mfrc;
+		int irqPin;
+		bool fieldOn;
+		bool cardHalted;
+		bool raised;
+	};
+
+	///Every reader, in the order of RFID_READERS
+	std::vector<Reader> readerList;
 
 	///RFID polling thread
 	std::thread rfidThread;
 	///Thread termination condition
-	bool run = true;
+	std::atomic<bool> run(true);
 
 	///Polling thread
 	void thread();
+	RFIDPollResult readUID(Reader& reader);
+
+	///Edge events for the IRQ pins, if they are wired up
+	EdgeMonitor irq;
+	///Whether the readers are driven by their IRQ pins rather than polled
+	bool useIrq = false;
+	///Time between detection cycles in interrupt mode, in milliseconds
+	int scanInterval = RFID_DEFAULT_SCAN_INTERVAL;
+	///SPI clock divider the readers are run at
+	int spiDivider = BCM2835_SPI_CLOCK_DIVIDER_64;
+	///Reads to time at each clock setting before polling starts, or 0
+	int benchmarkReads = 0;
 
-	///UID of last card read - used to prevent reading same card multiple times
-	std::string lastUID = "--------";
-	///Time the last card was read - used to override @p lastUID condition
-	std::clock_t lctime;
+	void benchmark(Reader& reader, int reads);
+
+	/*!	Number list parser.
+	 *
+	 * 	Reads a comma separated list of numbers such as @p "0,1".
+	 *
+	 * 	@returns	The numbers, in order
+	 */
+	std::vector<int> parseList(const char* list) {
+		std::vector<int> numbers;
+		stringstream ss(list);
+		string item;
+		while(std::getline(ss, item, ',')) {
+			if(!item.empty()) {
+				numbers.push_back(atoi(item.c_str()));
+			}
+		}
+		return numbers;
+	}
 
 	/*!	RFID Initialization Method.
 	 *
-	 * 	This method initializes the RFID interface by first initializing the
+	 * 	This method initializes the RFID interface by first initializing each
 	 * 	MFRC522 RFID module, and then spawning the RFID polling thread.
 	 */
 	void init() {
 		printf(LOADING "Initializing RFID...");
 		fflush(stdout);
 
+		//Work out which chip selects have readers on them
+		const char* readersEnv = getenv("RFID_READERS");
+		std::vector<int> chipSelects = parseList(
+			readersEnv != nullptr ? readersEnv : RFID_DEFAULT_READERS);
+		if(chipSelects.empty() || chipSelects.size() > RFID_MAX_READERS) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("RFID_READERS must list 1 to 3 chip selects");
+		}
+		for(size_t i = 0; i < chipSelects.size(); i++) {
+			bool repeated = false;
+			for(size_t j = 0; j < i; j++) {
+				repeated = repeated || chipSelects[j] == chipSelects[i];
+			}
+			if(chipSelects[i] < BCM2835_SPI_CS0 ||
+					chipSelects[i] > BCM2835_SPI_CS2 || repeated) {
+				printf("\r[" RED "FAIL\n" RESET);
+				throw std::runtime_error("Invalid chip select in RFID_READERS");
+			}
+		}
+
+		//Work out how fast to run the bus
+		const char* dividerEnv = getenv("RFID_SPI_DIVIDER");
+		if(dividerEnv != nullptr) {
+			spiDivider = atoi(dividerEnv);
+			if(spiDivider < RFID_MIN_SPI_DIVIDER ||
+					spiDivider > RFID_MAX_SPI_DIVIDER || spiDivider % 2 != 0) {
+				printf("\r[" RED "FAIL\n" RESET);
+				throw std::runtime_error("RFID_SPI_DIVIDER must be an even number from 32 to 32768");
+			}
+		}
+
 		// initialize MFRC522 library
-		mfrc = new MFRC522();
-		mfrc->PCD_Init();
+		for(size_t i = 0; i < chipSelects.size(); i++) {
+			Reader reader = {};
+			reader.id = (int) i;
+			reader.mfrc = new MFRC522(chipSelects[i], RPI_V2_GPIO_P1_22,
+				(word) spiDivider);
+			reader.mfrc->PCD_Init();
+			reader.irqPin = -1;
+			reader.fieldOn = true;
+			readerList.push_back(reader);
+		}
+
+		//Use the IRQ pins if every reader has one
+		const char* irqEnv = getenv("RFID_IRQ_PIN");
+		if(irqEnv != nullptr) {
+			std::vector<int> pins = parseList(irqEnv);
+			useIrq = pins.size() == readerList.size();
+			for(size_t i = 0; useIrq && i < pins.size(); i++) {
+				Hal::gpio().input(pins[i], Hal::PULL_UP);
+				useIrq = irq.watch(pins[i]);
+				readerList[i].irqPin = pins[i];
+			}
+			if(useIrq) {
+				for(Reader& reader : readerList) {
+					reader.mfrc->PCD_Select();
+					reader.mfrc->PCD_EnableIRQ();
+					reader.mfrc->PCD_AntennaOff();
+					reader.fieldOn = false;
+				}
+			} else {
+				irq.close();
+				for(Reader& reader : readerList) {
+					reader.irqPin = -1;
+				}
+			}
+		}
+		const char* interval = getenv("RFID_SCAN_INTERVAL");
+		if(interval != nullptr && atoi(interval) > 0) {
+			scanInterval = atoi(interval);
+		}
+		const char* benchmarkEnv = getenv("RFID_BENCHMARK");
+		if(benchmarkEnv != nullptr && atoi(benchmarkEnv) > 0) {
+			benchmarkReads = atoi(benchmarkEnv);
+		}
 
 		//Start the thread
 		rfidThread = std::thread(thread);
 
 		printf(OKAY "\n");
+		if(readerList.size() > 1) {
+			Log::info("Using %d RFID readers\n", (int) readerList.size());
+		}
+		if(irqEnv != nullptr && !useIrq) {
+			Log::warn("RFID IRQ pins unavailable, polling the readers\n");
+		}
 	}
 
 	/*!	RFID Destruction Method.
 	 *
-	 * 	This method destroys the RFID interface by first destroying the
-	 * 	MFRC522 object, ending the bcm2835's SPI interface, instructing the
-	 * 	polling thread to terminate, joining the polling thread, and finally
+	 * 	This method destroys the RFID interface by first instructing the
+	 * 	polling thread to terminate, joining the polling thread, destroying
+	 * 	the MFRC522 objects, ending the bcm2835's SPI interface, and finally
 	 * 	returning control to the application.
 	 */
 	void destroy() {
 		printf(LOADING "Destroy RFID...");
 		fflush(stdout);
 
-		// clean up MFRC522 library and SPI
-		delete mfrc;
-		bcm2835_spi_end();
-
 		//Instruct the thread to terminate
 		run = false;
+		irq.wakeup();
 		//Join the thread
 		rfidThread.join();
+		irq.close();
+
+		// clean up MFRC522 library and SPI
+		for(Reader& reader : readerList) {
+			if(useIrq) {
+				reader.mfrc->PCD_Select();
+				reader.mfrc->PCD_DisableIRQ();
+			}
+			delete reader.mfrc;
+		}
+		readerList.clear();
+		Hal::spi().end();
 
 		printf(OKAY "\n");
 	}
 
+	/*!	Reader count method.
+	 *
+	 * 	@returns	The number of readers listed in RFID_READERS
+	 */
+	int readers() {
+		return (int) readerList.size();
+	}
+
 	/*!	RFID polling method.
 	 *
-	 * 	This method polls the MFRC522 RFID module for any present cards, and
+	 * 	This method polls one MFRC522 RFID module for any present cards, and
 	 * 	if found, returns an @p RFIDPollResult object containing the UID of the
 	 * 	detected card and the @p success value set to @p true.
 	 *
 	 * 	If the reader fails to detect a card, or detects a card but is unable to
 	 * 	read the UID, it returns an @p RFIDPollResult object in which the
-	 * 	@p success value is set to @p false, and the @p uid value is an empty
-	 * 	string.
+	 * 	@p success value is set to @p false, and the @p uid value is empty.
+	 *
+	 * 	A card that has been read is halted, so it doesn't answer the next
+	 * 	REQA and get selected again every 2ms for as long as it is held to the
+	 * 	reader.  Once it leaves the field it is reset, and answers again.
 	 *
 	 * 	@returns	An @p RFIDPollResult object containing a boolean value
 	 * 		representing the outcome of the request, and the UID of the detected
 	 * 		card if the request was successful.
 	 */
-	RFIDPollResult pollForUID() {
-		if (!mfrc->PICC_IsNewCardPresent()) {
-			return{ false, "" };
+	RFIDPollResult pollForUID(Reader& reader) {
+		reader.mfrc->PCD_Select();
+		if (!reader.mfrc->PICC_IsNewCardPresent()) {
+			return{ false, CardId(), reader.id };
+		}
+		RFIDPollResult result = readUID(reader);
+		if(result.success) {
+			reader.mfrc->PICC_HaltA();
 		}
+		return result;
+	}
 
+	/*!	SPI clock benchmark method.
+	 *
+	 * 	This method times @p reads reads of the card on @p reader, from the
+	 * 	wake up to the UID being known, at each of a few SPI clock dividers,
+	 * 	and logs the average for each.  The card is halted after every read
+	 * 	and woken for the next, so it has to stay on the reader throughout.
+	 * 	It runs on the polling thread before the first poll, and puts the
+	 * 	configured divider and the state of the field back afterwards.
+	 */
+	void benchmark(Reader& reader, int reads) {
+		const word dividers[] = {
+			BCM2835_SPI_CLOCK_DIVIDER_128,
+			BCM2835_SPI_CLOCK_DIVIDER_64,
+			BCM2835_SPI_CLOCK_DIVIDER_32
+		};
+		MFRC522* mfrc = reader.mfrc;
+		mfrc->PCD_Select();
+		if(!reader.fieldOn) {
+			mfrc->PCD_AntennaOn();
+			usleep(RFID_FIELD_SETTLE);
+		}
+		for(word divider : dividers) {
+			mfrc->PCD_SetClockDivider(divider);
+			uint64_t total = 0;
+			int done = 0;
+			for(int i = 0; i < reads; i++) {
+				byte atqa[2];
+				byte size = sizeof(atqa);
+				uint64_t start = Metrics::now();
+				byte status = mfrc->PICC_WakeupA(atqa, &size);
+				if((status != MFRC522::STATUS_OK &&
+						status != MFRC522::STATUS_COLLISION) ||
+						!mfrc->PICC_ReadCardSerial()) {
+					continue;
+				}
+				total += Metrics::now() - start;
+				done++;
+				mfrc->PICC_HaltA();
+			}
+			if(done == 0) {
+				Log::warn("RFID benchmark: no card on reader %d\n", reader.id);
+				break;
+			}
+			Log::info("RFID benchmark: divider %d reads a UID in %dus (%d of %d reads)\n",
+				(int) divider, (int) (total / done), done, reads);
+		}
+		mfrc->PCD_SetClockDivider((word) spiDivider);
+		if(!reader.fieldOn) {
+			mfrc->PCD_AntennaOff();
+		}
+	}
+
+	/*!	UID reader method.
+	 *
+	 * 	This method reads the UID of the card that has just answered a REQA.
+	 */
+	RFIDPollResult readUID(Reader& reader) {
 		// read the UID of the card, which will be stored in mfrc->uid
+		uint64_t start = Metrics::now();
+		MFRC522* mfrc = reader.mfrc;
 		if (!mfrc->PICC_ReadCardSerial()) {
-			printf(WARN "RFID failed to read card\n");
-			return{ false, "" };
+			Log::warn("RFID reader %d failed to read card\n", reader.id);
+			return{ false, CardId(), reader.id };
+		}
+		Metrics::since(Metrics::RFID_READ, start);
+		Metrics::add(Metrics::CARDS_READ);
+
+		//Keep every byte of the UID, however long it is
+		return { true, CardId(mfrc->uid.uidByte, mfrc->uid.size), reader.id };
+	}
+
+	/*!	Detection cycle start method.
+	 *
+	 * 	This method powers the reader's field if it is off, and forgets
+	 * 	whether its IRQ pin fired in the last cycle.
+	 */
+	void startCycle(Reader& reader) {
+		reader.mfrc->PCD_Select();
+		if(!reader.fieldOn) {
+			reader.mfrc->PCD_AntennaOn();
+			reader.fieldOn = true;
+		}
+		reader.raised = false;
+	}
+
+	/*!	Detection cycle finish method.
+	 *
+	 * 	Once the IRQ pin fired, or the timeout passed, this method collects
+	 * 	the answer.  Halted cards don't answer a REQA, so whatever did is a
+	 * 	card that hasn't been read yet, even with another one still halted in
+	 * 	the field.  Its UID is read just like pollForUID() does, and the card
+	 * 	is halted with the field left on so it isn't read again.  If nothing
+	 * 	new answered but a card was halted, it is woken with a WUPA to check
+	 * 	it is still there, and halted again.  Once nothing answers at all,
+	 * 	the field is switched off again.
+	 *
+	 * 	@returns	The same as pollForUID()
+	 */
+	RFIDPollResult finishCycle(Reader& reader) {
+		MFRC522* mfrc = reader.mfrc;
+		mfrc->PCD_Select();
+		byte status = mfrc->PICC_Finish_REQA_or_WUPA();
+		if(status == MFRC522::STATUS_OK || status == MFRC522::STATUS_COLLISION) {
+			RFIDPollResult result = readUID(reader);
+			if(result.success) {
+				mfrc->PICC_HaltA();
+				reader.cardHalted = true;
+				return result;
+			}
+		}
+		if(reader.cardHalted) {
+			byte atqa[2];
+			byte size = sizeof(atqa);
+			status = mfrc->PICC_WakeupA(atqa, &size);
+			if(status == MFRC522::STATUS_OK ||
+					status == MFRC522::STATUS_COLLISION) {
+				//Same card, still in the field, put it back to sleep
+				mfrc->PICC_HaltA();
+				return { false, CardId(), reader.id };
+			}
 		}
+		//Nothing there, or nothing readable
+		reader.cardHalted = false;
+		mfrc->PCD_AntennaOff();
+		reader.fieldOn = false;
+		return { false, CardId(), reader.id };
+	}
+
+	/*!	Interrupt driven card detection method.
+	 *
+	 * 	This method runs one detection cycle on every reader at once: each
+	 * 	field is powered and a REQA started, then the thread sleeps until
+	 * 	every IRQ pin has fired or the timeout passes, and finally each reader's
+	 * 	answer is collected.  Readers are visited from @p first onwards.
+	 */
+	void waitForUIDs(size_t first) {
+		EdgeMonitor::Edge edges[EDGE_MONITOR_BATCH];
+		size_t count = readerList.size();
+		//Forget edges left over from earlier transfers
+		while(irq.wait(0, edges, EDGE_MONITOR_BATCH) > 0) {}
 
-		//Convert the UID to a hex string
-		char buf[8];
-		//Get the bytes
-		byte b0 = mfrc->uid.uidByte[0];
-		byte b1 = mfrc->uid.uidByte[1];
-		byte b2 = mfrc->uid.uidByte[2];
-		byte b3 = mfrc->uid.uidByte[3];
-		//Get UID
-		sprintf(buf,"%02X%02X%02X%02X", b0, b1, b2, b3);
+		bool settle = false;
+		for(size_t i = 0; i < count; i++) {
+			Reader& reader = readerList[(first + i) % count];
+			settle = settle || !reader.fieldOn;
+			startCycle(reader);
+		}
+		if(settle) {
+			//Give the cards a moment to power up in the new field
+			usleep(RFID_FIELD_SETTLE);
+		}
+		for(size_t i = 0; i < count; i++) {
+			Reader& reader = readerList[(first + i) % count];
+			reader.mfrc->PCD_Select();
+			reader.mfrc->PICC_Start_REQA_or_WUPA(MFRC522::PICC_CMD_REQA);
+		}
 
-		//Convert UID to string
-		string uid(buf);
+		//Sleep until every reader has raised its interrupt
+		std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() +
+			std::chrono::milliseconds(RFID_IRQ_TIMEOUT);
+		size_t pending = count;
+		while(pending > 0 && run) {
+			int left = (int) std::chrono::duration_cast<std::chrono::milliseconds>(
+				deadline - std::chrono::steady_clock::now()).count();
+			if(left <= 0) {
+				break;
+			}
+			int n = irq.wait(left, edges, EDGE_MONITOR_BATCH);
+			if(n < 0) {
+				break;
+			}
+			for(int e = 0; e < n; e++) {
+				//The pin is active low, and starting the command clears the
+				//interrupts left from the last cycle, which lets it go high
+				if(edges[e].rising) {
+					continue;
+				}
+				for(Reader& reader : readerList) {
+					if(reader.irqPin == edges[e].line && !reader.raised) {
+						reader.raised = true;
+						pending--;
+					}
+				}
+			}
+		}
 
-		//Return RFIDPollResult struct containing data
-		return { true, uid };
+		for(size_t i = 0; i < count; i++) {
+			RFIDPollResult result = finishCycle(readerList[(first + i) % count]);
+			if(result.success) {
+				//Hand the card to the dispatcher and keep looking
+				Input::postCard(result.uid, result.reader);
+			}
+		}
 	}
 
 	/*!	RFID polling thread.
 	 *
 	 * 	This method is spawned as a new thread by the RFID initialization
 	 * 	process, and handles the dirty work of repeatedly polling the RFID
-	 * 	module for updates, and processing them if and when they occur.
+	 * 	modules for updates, and processing them if and when they occur.  It
+	 * 	is the only thread that uses the SPI bus once the readers are set up.
 	 */
 	void thread() {
+		//Time reads at a few clock settings, if asked to
+		if(benchmarkReads > 0) {
+			benchmark(readerList[0], benchmarkReads);
+		}
+		//Reader that goes first in the next round
+		size_t first = 0;
 		//Check termination condition
 		while(run) {
-			//Get the RFID poll result
-			RFIDPollResult result = pollForUID();
-			//Check if the polling was successful
-			if(result.success) {
-				//Check UID
-				if(result.uid.compare(lastUID) != 0 ||
-						std::difftime(std::time(0), lctime) > 1) {
-					//Set the last UID variable
-					lastUID = result.uid;
-					//Set the last time variable
-					lctime = std::time(0);
-					if (State::state == State::READ_ASSIGN_RFID) {
-						UserHandler::assignRfidToPin(State::assignRfidPin, result.uid.c_str());
-					} else {
-						//Trigger the event
-						UserHandler::triggerRfid(result.uid.c_str());
+			if(useIrq) {
+				waitForUIDs(first);
+			} else {
+				for(size_t i = 0; i < readerList.size(); i++) {
+					//Get the RFID poll result
+					RFIDPollResult result = pollForUID(
+						readerList[(first + i) % readerList.size()]);
+					//Check if the polling was successful
+					if(result.success) {
+						//Hand the card to the dispatcher and keep looking
+						Input::postCard(result.uid, result.reader);
 					}
-					//Beep
-					Buzzer::buzz(50000);
-					//Wait 1 second
-					usleep(1000000);
-					//Change the state back to ready
-					State::changeState(State::READY);
 				}
 			}
+			first = (first + 1) % readerList.size();
 			//Delay before checking again
-			usleep(2000);
+			if(useIrq) {
+				EdgeMonitor::Edge edges[EDGE_MONITOR_BATCH];
+				//Nothing is expected on the pins with the fields off
+				irq.wait(scanInterval, edges, EDGE_MONITOR_BATCH);
+			} else {
+				usleep(2000);
+			}
 		}
 	}
 }
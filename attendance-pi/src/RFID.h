@@ -1,18 +1,25 @@
 #pragma once
 
 #include <string>
+#include "CardId.h"
 
 using std::string;
 
+///Most readers on one SPI bus, one for each of the bcm2835's chip selects
+#define RFID_MAX_READERS	3
+
 namespace RFID {
 	/**
 	 * The result of polling for a nearby RFID tag
 	 * success: Whether there's a tag nearby that was successfully read
 	 * uid: The uid of the tag, if success is true
+	 * reader: Which reader the tag was seen on, counting from 0 in the
+	 *  order of RFID_READERS
 	 */
 	struct RFIDPollResult {
 		bool success;
-		string uid;
+		CardId uid;
+		int reader;
 	};
 
 	/*
@@ -25,13 +32,8 @@ namespace RFID {
 	 */
 	void destroy();
 
-	/*
-	 * Polls for a card nearby. If there is a card, it attempts to read the UID of the card.
-	 * If reading the UID was successful, it returns an RFIDPollResult with success = true
-	 * and uid = the uid of the card.
-	 * If reading failed or there was no card nearby, it returns an RFIDPollResult with success = false
-	 * 
-	 * In theory, this method shouldn't block
+	/**
+	 * Returns the number of readers that were set up
 	 */
-	RFIDPollResult pollForUID();
+	int readers();
 }
@@ -0,0 +1,489 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Reactor.h"
+#include "Log.h"
+#include "ANSI.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdexcept>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The initialization process for the reactor blocks @p SIGTERM and
+ * 	@p SIGINT, creates the epoll instance and spawns the worker thread.  It
+ * 	must run before anything else starts a thread, so that every thread
+ * 	inherits the blocked signals and they can only be picked up by the
+ * 	reactor's signalfd.
+ *
+ * 	@section reactor	Event Loop
+ *
+ * 	Most of what the kiosk does is wait: for the next minute, for 3am, for a
+ * 	key to settle, for the network to change, for a packet from another
+ * 	kiosk.  Each of those used to be a thread of its own, asleep in a poll()
+ * 	or a condition variable.  Instead, the main thread calls run(), which
+ * 	sleeps in one epoll_wait() on all of them, and modules hand it what they
+ * 	are waiting for:
+ *
+ * 	- watch() adds a file descriptor of the module's own, such as a socket
+ * 	  or a GPIO line, and calls the handler whenever it is ready.
+ * 	- timer() and wallTimer() create a timerfd, which is set going with
+ * 	  arm() or armAt().  Wall timers follow the calendar, and also fire if
+ * 	  the clock is set, so whatever is waiting for 3am can work out again
+ * 	  when that is.
+ * 	- event() creates an eventfd, and notify() calls its handler on the
+ * 	  reactor thread from any other thread.
+ *
+ * 	The reactor reads the timer or event counter itself before calling the
+ * 	handler.  Handlers run on the reactor thread, one at a time, and must
+ * 	not block.  Anything that might, such as talking to the server, is
+ * 	handed to defer(), which runs it on the worker thread instead; jobs run
+ * 	one after another, in the order they were deferred.
+ *
+ * 	@section reactor_scope	What Runs Elsewhere
+ *
+ * 	The reactor only covers the waiting listed above; it is not where all
+ * 	of the kiosk's I/O happens.  HTTP requests are blocking curl calls,
+ * 	made on the worker from deferred jobs and on the Sender's own thread,
+ * 	and are never driven by the event loop.  The RFID readers keep their
+ * 	own thread, as their polling needs tight timing and owns the SPI bus.
+ * 	The Input dispatcher, the Log writer, the Buzzer and the Journal keep
+ * 	theirs too, since each of them blocks on I2C, the console, the timing
+ * 	of a tone or the SD card.
+ *
+ * 	@section shutdown	Shutdown
+ *
+ * 	@p SIGTERM and @p SIGINT arrive through a signalfd like any other
+ * 	source, so there is no signal handler and nothing to get wrong in one.
+ * 	Either of them, or a call to stop(), makes run() return once the worker
+ * 	has finished the job it is on.  Jobs that were still waiting are
+ * 	dropped, and the modules are destroyed afterwards as usual.
+ *
+ */
+namespace Reactor {
+
+	///What a file descriptor handed to epoll is for
+	typedef enum {
+		FD,			///< Someone else's descriptor, read by the handler
+		TIMER,		///< A timerfd of ours
+		EVENT,		///< An eventfd of ours
+		SIGNALS		///< The signalfd
+	} Kind;
+
+	/**
+	 * Something epoll is waiting on
+	 * fd: The file descriptor
+	 * kind: What it is for
+	 * handler, ctx: Who to tell when it is ready
+	 * live: Cleared by remove(), so an event already returned is ignored
+	 */
+	struct Source {
+		int fd;
+		Kind kind;
+		Handler handler;
+		void* ctx;
+		bool live;
+	};
+
+	//Private declarations
+	void workerThread();
+
+	///The epoll instance
+	int epfd = -1;
+	///Event used by stop() to wake the loop
+	int wake = -1;
+	///Signals read through @p sigfd
+	sigset_t signals;
+	int sigfd = -1;
+
+	///Every source, by file descriptor
+	std::map<int, Source*> sources;
+	///Sources removed while the loop may still hold events for them
+	std::vector<Source*> retired;
+	///Guards @p sources and @p retired
+	std::mutex lock;
+
+	///Loop termination condition
+	std::atomic<bool> running(false);
+
+	///Worker thread
+	std::thread wThread;
+	///Jobs waiting for the worker
+	std::deque<std::pair<Job, void*>> jobs;
+	std::mutex jobLock;
+	std::condition_variable jobCv;
+	///Worker termination condition
+	bool working = true;
+
+	/*!	Hand a file descriptor to epoll.
+	 *
+	 * 	@returns	@p false if epoll won't take it
+	 */
+	bool add(int fd, uint32_t events, Kind kind, Handler handler, void* ctx) {
+		Source* source = new Source { fd, kind, handler, ctx, true };
+		struct epoll_event event = {};
+		event.events = events;
+		event.data.ptr = source;
+		std::lock_guard<std::mutex> guard(lock);
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			delete source;
+			return false;
+		}
+		sources[fd] = source;
+		return true;
+	}
+
+	/*!	Watch a file descriptor.
+	 *
+	 * 	Calls @p handler whenever any of @p events, such as @p EPOLLIN, is
+	 * 	seen on @p fd.  The descriptor is level triggered, so the handler must
+	 * 	read what is waiting.  It still belongs to the caller, who must
+	 * 	remove() it before closing it.
+	 *
+	 * 	@returns	@p false if the descriptor can't be watched
+	 */
+	bool watch(int fd, uint32_t events, Handler handler, void* ctx) {
+		return add(fd, events, FD, handler, ctx);
+	}
+
+	/*!	Create a timer.
+	 *
+	 * 	@param clock	@p CLOCK_MONOTONIC or @p CLOCK_REALTIME
+	 */
+	int makeTimer(clockid_t clock, Handler handler, void* ctx) {
+		int fd = timerfd_create(clock, TFD_CLOEXEC | TFD_NONBLOCK);
+		if(fd < 0) {
+			throw std::runtime_error("Failed to create a timer");
+		}
+		if(!add(fd, EPOLLIN, TIMER, handler, ctx)) {
+			close(fd);
+			throw std::runtime_error("Failed to watch a timer");
+		}
+		return fd;
+	}
+
+	/*!	Create a timer for intervals, which ignores changes to the clock.
+	 *
+	 * 	The timer does nothing until it is armed.
+	 *
+	 * 	@returns	The timer, to be given to arm() and disarm()
+	 */
+	int timer(Handler handler, void* ctx) {
+		return makeTimer(CLOCK_MONOTONIC, handler, ctx);
+	}
+
+	/*!	Create a timer for times of day.
+	 *
+	 * 	Once set with armAt(), the handler is called when the wall clock gets
+	 * 	there, or as soon as the clock is set, whichever comes first.
+	 *
+	 * 	@returns	The timer, to be given to armAt() and disarm()
+	 */
+	int wallTimer(Handler handler, void* ctx) {
+		return makeTimer(CLOCK_REALTIME, handler, ctx);
+	}
+
+	/*!	Set a timer going.
+	 *
+	 * 	Replaces whatever the timer was set to before.  Can be called from
+	 * 	any thread.
+	 *
+	 * 	@param firstMs		Time until it first fires, in milliseconds; 0 fires it
+	 * 		straight away
+	 * 	@param intervalMs	Time between later firings, or 0 to fire only once
+	 */
+	void arm(int timer, long firstMs, long intervalMs) {
+		struct itimerspec spec = {};
+		spec.it_value.tv_sec = firstMs / 1000;
+		spec.it_value.tv_nsec = (firstMs % 1000) * 1000000L;
+		if(firstMs <= 0) {
+			//A zero value would disarm it instead
+			spec.it_value.tv_sec = 0;
+			spec.it_value.tv_nsec = 1;
+		}
+		spec.it_interval.tv_sec = intervalMs / 1000;
+		spec.it_interval.tv_nsec = (intervalMs % 1000) * 1000000L;
+		if(timerfd_settime(timer, 0, &spec, nullptr) < 0) {
+			Log::warn("Failed to set a timer: %s\n", strerror(errno));
+		}
+	}
+
+	/*!	Set a wall timer to fire once, at @p when.
+	 */
+	void armAt(int timer, std::time_t when) {
+		struct itimerspec spec = {};
+		spec.it_value.tv_sec = when;
+		if(timerfd_settime(timer, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+				&spec, nullptr) < 0) {
+			Log::warn("Failed to set a timer: %s\n", strerror(errno));
+		}
+	}
+
+	/*!	Stop a timer.
+	 */
+	void disarm(int timer) {
+		struct itimerspec spec = {};
+		if(timerfd_settime(timer, 0, &spec, nullptr) < 0) {
+			Log::warn("Failed to stop a timer: %s\n", strerror(errno));
+		}
+	}
+
+	/*!	Create an event.
+	 *
+	 * 	@returns	The event, to be given to notify()
+	 */
+	int event(Handler handler, void* ctx) {
+		int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if(fd < 0) {
+			throw std::runtime_error("Failed to create an event");
+		}
+		if(!add(fd, EPOLLIN, EVENT, handler, ctx)) {
+			close(fd);
+			throw std::runtime_error("Failed to watch an event");
+		}
+		return fd;
+	}
+
+	/*!	Have an event's handler called on the reactor thread.
+	 *
+	 * 	Can be called from any thread.  Several notifications that arrive
+	 * 	before the handler runs call it only once.
+	 */
+	void notify(int event) {
+		uint64_t one = 1;
+		if(write(event, &one, sizeof(one)) < 0) {
+			Log::warn("Failed to notify an event: %s\n", strerror(errno));
+		}
+	}
+
+	/*!	Stop watching a file descriptor.
+	 *
+	 * 	Timers and events are closed as well; watched descriptors are left
+	 * 	for their owner to close.  Must be called on the reactor thread, or
+	 * 	once run() has returned.
+	 */
+	void remove(int fd) {
+		std::lock_guard<std::mutex> guard(lock);
+		auto it = sources.find(fd);
+		if(it == sources.end()) {
+			return;
+		}
+		Source* source = it->second;
+		sources.erase(it);
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+		if(source->kind != FD) {
+			close(fd);
+		}
+		source->live = false;
+		retired.push_back(source);
+	}
+
+	/*!	Run blocking work on the worker thread.
+	 *
+	 * 	Can be called from any thread.
+	 */
+	void defer(Job job, void* ctx) {
+		{
+			std::lock_guard<std::mutex> guard(jobLock);
+			jobs.push_back(std::make_pair(job, ctx));
+		}
+		jobCv.notify_one();
+	}
+
+	/*!	Worker thread.
+	 *
+	 * 	Runs deferred jobs one at a time.
+	 */
+	void workerThread() {
+		std::unique_lock<std::mutex> lk(jobLock);
+		while(true) {
+			jobCv.wait(lk, [] { return !working || !jobs.empty(); });
+			if(!working) {
+				break;
+			}
+			std::pair<Job, void*> job = jobs.front();
+			jobs.pop_front();
+			lk.unlock();
+			job.first(job.second);
+			lk.lock();
+		}
+	}
+
+	/*!	Call a source's handler.
+	 */
+	void dispatch(Source* source, uint32_t events) {
+		switch(source->kind) {
+			case TIMER:
+			case EVENT: {
+				//A wall timer whose clock was set reads ECANCELED, and still fires
+				uint64_t count;
+				if(read(source->fd, &count, sizeof(count)) < 0 &&
+						errno == EAGAIN) {
+					return;
+				}
+				break;
+			}
+			case SIGNALS: {
+				struct signalfd_siginfo info;
+				if(read(source->fd, &info, sizeof(info)) == (ssize_t) sizeof(info)) {
+					Log::info("Caught %s, stopping\n", strsignal(info.ssi_signo));
+					stop();
+				}
+				return;
+			}
+			case FD:
+				break;
+		}
+		source->handler(events, source->ctx);
+	}
+
+	/*!	Event loop.
+	 *
+	 * 	Called by the main thread once everything has been initialized, and
+	 * 	handles events until stop() is called or a signal arrives.  The
+	 * 	worker thread is stopped on the way out.
+	 */
+	void run() {
+		struct epoll_event events[REACTOR_BATCH];
+		running = true;
+		while(running) {
+			int n = epoll_wait(epfd, events, REACTOR_BATCH, -1);
+			if(n < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				Log::fail("Event loop failed: %s\n", strerror(errno));
+				break;
+			}
+			for(int i = 0; i < n && running; i++) {
+				Source* source = (Source*) events[i].data.ptr;
+				if(source->live) {
+					dispatch(source, events[i].events);
+				}
+			}
+			//Nothing returned by this pass refers to a removed source any more
+			std::lock_guard<std::mutex> guard(lock);
+			for(size_t i = 0; i < retired.size(); i++) {
+				delete retired[i];
+			}
+			retired.clear();
+		}
+		running = false;
+
+		//Let the worker finish what it is doing
+		{
+			std::lock_guard<std::mutex> guard(jobLock);
+			working = false;
+			if(!jobs.empty()) {
+				Log::info("Dropping %u waiting jobs\n", (unsigned) jobs.size());
+			}
+			jobs.clear();
+		}
+		jobCv.notify_one();
+		wThread.join();
+	}
+
+	/*!	Make run() return.
+	 *
+	 * 	Can be called from any thread.
+	 */
+	void stop() {
+		running = false;
+		notify(wake);
+	}
+
+	/*!	Wake handler, which only has to interrupt epoll_wait().
+	 */
+	void woken(uint32_t events, void* ctx) {
+	}
+
+	/*!	Reactor Initialization Method.
+	 *
+	 * 	This method blocks the shutdown signals, creates the epoll instance
+	 * 	and spawns the worker thread.
+	 */
+	void init() {
+		//Initialize the reactor
+		printf(LOADING "Initializing Reactor...");
+		fflush(stdout);
+
+		//Every thread started from here on inherits the mask
+		sigemptyset(&signals);
+		sigaddset(&signals, SIGTERM);
+		sigaddset(&signals, SIGINT);
+		if(pthread_sigmask(SIG_BLOCK, &signals, nullptr) != 0) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to block the shutdown signals");
+		}
+
+		epfd = epoll_create1(EPOLL_CLOEXEC);
+		if(epfd < 0) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to create the epoll instance");
+		}
+		sigfd = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+		if(sigfd < 0 || !add(sigfd, EPOLLIN, SIGNALS, nullptr, nullptr)) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw std::runtime_error("Failed to watch the shutdown signals");
+		}
+		try {
+			wake = event(woken, nullptr);
+		} catch(const std::exception& e) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw;
+		}
+
+		//Start the worker
+		wThread = std::thread(workerThread);
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/*!	Reactor Destruction Method.
+	 *
+	 * 	This method closes everything the reactor still owns.  It must run
+	 * 	after every module that handed it something has been destroyed.
+	 */
+	void destroy() {
+		//Destroy the reactor
+		printf(LOADING "Destroying Reactor...");
+		fflush(stdout);
+
+		if(wThread.joinable()) {
+			//run() was never called
+			{
+				std::lock_guard<std::mutex> guard(jobLock);
+				working = false;
+			}
+			jobCv.notify_one();
+			wThread.join();
+		}
+		while(!sources.empty()) {
+			remove(sources.begin()->first);
+		}
+		for(size_t i = 0; i < retired.size(); i++) {
+			delete retired[i];
+		}
+		retired.clear();
+		close(epfd);
+
+		//Success
+		printf(OKAY "\n");
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <ctime>
+
+///Most events handled in one pass of the loop
+#define REACTOR_BATCH	16
+
+namespace Reactor {
+
+	/*!	Called on the reactor thread when a source is ready.
+	 *
+	 * 	@param events	The epoll events seen, for file descriptors
+	 * 	@param ctx		Whatever was given when the source was added
+	 */
+	typedef void (*Handler)(uint32_t events, void* ctx);
+	///Blocking work handed to the worker thread
+	typedef void (*Job)(void* ctx);
+
+	void init();
+	void destroy();
+	void run();
+	void stop();
+
+	bool watch(int fd, uint32_t events, Handler, void* ctx);
+	int timer(Handler, void* ctx);
+	int wallTimer(Handler, void* ctx);
+	void arm(int timer, long firstMs, long intervalMs = 0);
+	void armAt(int timer, std::time_t when);
+	void disarm(int timer);
+	int event(Handler, void* ctx);
+	void notify(int event);
+	void remove(int fd);
+	void defer(Job, void* ctx);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+/*!	Bounded lock free queue.
+ *
+ * 	Holds up to @p Size items, where @p Size is a power of two, for any
+ * 	number of producers and a single consumer.  The queue is a ring of
+ * 	cells, each with a sequence number that says whether it is free for the
+ * 	producer at a given position or full for the consumer, so producers
+ * 	only contend on a single atomic position counter.  Adding an item never
+ * 	blocks, never takes a lock and never makes a system call.  If the queue
+ * 	is full the item is refused.
+ *
+ * 	Every cell is marked free when the ring is constructed, so a ring with
+ * 	static storage can be used before main().
+ *
+ * 	An item can be written straight into its cell: @p claim() hands out a
+ * 	free one, which the consumer doesn't see until it is passed to
+ * 	@p publish().
+ */
+template<typename T, size_t Size>
+class Ring {
+	static_assert(Size > 0 && (Size & (Size - 1)) == 0,
+		"The ring size must be a power of two");
+
+	public:
+		Ring() : enqueuePos(0), dequeuePos(0) {
+			for(size_t i = 0; i < Size; i++) {
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+
+		/*!	Claim the next free cell.
+		 *
+		 * 	Can be called from any thread.
+		 *
+		 * 	@param pos	Set to the position of the cell, for @p publish()
+		 * 	@returns	The item in the cell, or @p nullptr if the queue is full
+		 */
+		T* claim(size_t& pos) {
+			pos = enqueuePos.load(std::memory_order_relaxed);
+			while(true) {
+				Cell& cell = cells[pos & (Size - 1)];
+				size_t seq = cell.sequence.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+				if(diff == 0) {
+					//The cell is free, try to claim it
+					if(enqueuePos.compare_exchange_weak(pos, pos + 1,
+							std::memory_order_relaxed)) {
+						return &cell.item;
+					}
+				} else if(diff < 0) {
+					//The consumer hasn't emptied this cell yet
+					return nullptr;
+				} else {
+					//Another producer got here first
+					pos = enqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		/*!	Hand a claimed cell to the consumer.
+		 */
+		void publish(size_t pos) {
+			cells[pos & (Size - 1)].sequence.store(pos + 1,
+				std::memory_order_release);
+		}
+
+		/*!	Add a copy of an item.
+		 *
+		 * 	@returns	@p false if the queue is full and the item was dropped
+		 */
+		bool push(const T& item) {
+			size_t pos;
+			T* slot = claim(pos);
+			if(slot == nullptr) {
+				return false;
+			}
+			*slot = item;
+			publish(pos);
+			return true;
+		}
+
+		/*!	Take the next item off the queue.
+		 *
+		 * 	Only called by the consumer.
+		 *
+		 * 	@returns	@p false if the queue is empty
+		 */
+		bool take(T& item) {
+			Cell& cell = cells[dequeuePos & (Size - 1)];
+			size_t seq = cell.sequence.load(std::memory_order_acquire);
+			if(seq != dequeuePos + 1) {
+				return false;
+			}
+			item = cell.item;
+			//Hand the cell back to the producers for the next lap
+			cell.sequence.store(dequeuePos + Size, std::memory_order_release);
+			dequeuePos++;
+			return true;
+		}
+
+	private:
+		Ring(const Ring&);
+		Ring& operator=(const Ring&);
+
+		/**
+		 * One slot of the queue
+		 * sequence: Equal to the enqueue position when the cell is free, and to
+		 *  the position plus one once the item is in it
+		 * item: The item
+		 */
+		struct Cell {
+			std::atomic<size_t> sequence;
+			T item;
+		};
+
+		///The queue
+		Cell cells[Size];
+		///Next position to add to, shared by the producers
+		std::atomic<size_t> enqueuePos;
+		///Next position to take from, only used by the consumer
+		size_t dequeuePos;
+};
@@ -0,0 +1,441 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Roster.h"
+
+#include <string.h>
+#include <time.h>
+#include <new>
+
+///Most seconds the hours word can hold, a little over a week
+#define HOURS_MAX_SECONDS	0xFFFFF
+///Weeks the hours word can tell apart
+#define HOURS_WEEK_MASK		0xFFF
+
+/*!	PIN hash
+ *
+ * 	The four characters of a PIN make a word, which is mixed so the bottom
+ * 	bits used for the slot depend on all of them.
+ */
+static size_t pinHash(const char* pin) {
+	uint32_t h;
+	memcpy(&h, pin, sizeof(h));
+	h *= 0x9E3779B1u;
+	return (size_t) (h ^ (h >> 16));
+}
+
+static_assert(ROSTER_PIN_LENGTH == sizeof(uint32_t),
+	"pinHash() takes the PIN as one word");
+static_assert(sizeof(RosterHours) == 8, "The hours are one word per user");
+
+/*!	Week finder
+ *
+ * 	Works out when the local week holding @p t began, at midnight on
+ * 	Monday, and its number counted from the week of 1 January 1970.
+ */
+static void weekOf(std::time_t t, std::time_t& start, uint32_t& number) {
+	struct tm day;
+	localtime_r(&t, &day);
+	day.tm_mday -= (day.tm_wday + 6) % 7;
+	day.tm_hour = 0;
+	day.tm_min = 0;
+	day.tm_sec = 0;
+	day.tm_isdst = -1;
+	start = mktime(&day);
+	//The same date at midnight UTC counts whole days, whatever the zone
+	struct tm utc = day;
+	long days = (long) (timegm(&utc) / 86400);
+	//1 January 1970 was a Thursday
+	number = (uint32_t) ((days + 3) / 7) & HOURS_WEEK_MASK;
+}
+
+/*!	Hours word packer
+ */
+static RosterHours packHours(std::time_t opened, long seconds,
+		uint32_t week) {
+	if(seconds > HOURS_MAX_SECONDS) {
+		seconds = HOURS_MAX_SECONDS;
+	}
+	if(seconds < 0) {
+		seconds = 0;
+	}
+	return ((RosterHours) (uint32_t) opened << 32) |
+		((RosterHours) week << 20) | (RosterHours) seconds;
+}
+
+/*!	Closed seconds this week
+ *
+ * 	@returns	The seconds held in @p hours, or 0 if they are from another
+ * 		week than @p week
+ */
+static long closedSeconds(RosterHours hours, uint32_t week) {
+	if(((hours >> 20) & HOURS_WEEK_MASK) != week) {
+		return 0;
+	}
+	return (long) (hours & HOURS_MAX_SECONDS);
+}
+
+/*!	Open session length
+ *
+ * 	@returns	How much of the session open in @p hours falls between the
+ * 		start of the week and @p when
+ */
+static long openSeconds(RosterHours hours, std::time_t weekStart,
+		std::time_t when) {
+	std::time_t opened = (std::time_t) (hours >> 32);
+	if(opened == 0) {
+		return 0;
+	}
+	std::time_t from = opened > weekStart ? opened : weekStart;
+	return when > from ? (long) (when - from) : 0;
+}
+
+/*!	Empty roster constructor
+ */
+Roster::Roster() {
+	count = 0;
+	mask = 0;
+	arenaBytes = 0;
+	entries = nullptr;
+	weeks = nullptr;
+	flags = nullptr;
+	pinSlots = nullptr;
+	rfidSlots = nullptr;
+	arena = nullptr;
+}
+
+/*!	Make room for users before adding them.
+ *
+ * 	@param users	Number of users that will be added
+ * 	@param nameBytes	Total length of their names
+ */
+void Roster::Builder::reserve(size_t users, size_t nameBytes) {
+	entries.reserve(users);
+	flags.reserve(users);
+	hours.reserve(users);
+	names.reserve(nameBytes + users);
+}
+
+/*!	Add a user.
+ *
+ * 	@returns	@p false if the PIN is not @p ROSTER_PIN_LENGTH characters
+ * 		long, in which case the user is not added.
+ */
+bool Roster::Builder::add(const char* name, size_t nameLength,
+		const char* pin, size_t pinLength, const CardId& rfid, bool signedin,
+		RosterHours hours) {
+	if(pinLength != ROSTER_PIN_LENGTH) {
+		return false;
+	}
+	Entry entry;
+	entry.rfid = rfid;
+	entry.name = (uint32_t) names.size();
+	memcpy(entry.pin, pin, ROSTER_PIN_LENGTH);
+	names.append(name, strnlen(name, nameLength));
+	names += '\0';
+	entries.push_back(entry);
+	flags.push_back(signedin);
+	this->hours.push_back(hours);
+	return true;
+}
+
+/*!	Add a user from another table, as they are right now.
+ */
+void Roster::Builder::copy(const Roster& from, size_t user) {
+	copy(from, user, from.entries[user].rfid);
+}
+
+/*!	Add a user from another table with a different tag.
+ */
+void Roster::Builder::copy(const Roster& from, size_t user,
+		const CardId& rfid) {
+	const char* name = from.name(user);
+	add(name, strlen(name), from.entries[user].pin, ROSTER_PIN_LENGTH, rfid,
+		from.signedIn(user), from.hours(user));
+}
+
+/*!	Get the number of users added so far.
+ */
+size_t Roster::Builder::size() const {
+	return entries.size();
+}
+
+/*!	Build the table.
+ *
+ * 	Lays out everything added in a single new block of memory, and empties
+ * 	the builder.
+ *
+ * 	@returns	The new table
+ */
+std::shared_ptr<Roster> Roster::Builder::build() {
+	static_assert(sizeof(Entry) == 24, "The class comment counts on 24 byte entries");
+	std::shared_ptr<Roster> roster = std::make_shared<Roster>();
+	size_t count = entries.size();
+	//Keep the hash tables at most half full
+	size_t slots = 1;
+	while(slots < count * 2) {
+		slots <<= 1;
+	}
+	size_t words = (count + 31) / 32;
+	//Entries first, they need the widest alignment
+	size_t entryBytes = count * sizeof(Entry);
+	size_t weekBytes = count * sizeof(std::atomic<RosterHours>);
+	size_t flagBytes = words * sizeof(std::atomic<uint32_t>);
+	size_t slotBytes = slots * sizeof(uint32_t);
+	roster->block.reset(new char[entryBytes + weekBytes + flagBytes +
+		slotBytes * 2 + names.size()]);
+	char* p = roster->block.get();
+	roster->count = count;
+	roster->mask = slots - 1;
+	roster->arenaBytes = names.size();
+	roster->entries = (Entry*) p;
+	p += entryBytes;
+	roster->weeks = (std::atomic<RosterHours>*) p;
+	p += weekBytes;
+	roster->flags = (std::atomic<uint32_t>*) p;
+	roster->pinSlots = (uint32_t*) (p + flagBytes);
+	roster->rfidSlots = (uint32_t*) (p + flagBytes + slotBytes);
+	char* arena = p + flagBytes + slotBytes * 2;
+	roster->arena = arena;
+
+	for(size_t i = 0; i < count; i++) {
+		new (&roster->entries[i]) Entry(entries[i]);
+		new (&roster->weeks[i]) std::atomic<RosterHours>(hours[i]);
+	}
+	for(size_t w = 0; w < words; w++) {
+		uint32_t bits = 0;
+		for(size_t b = 0; b < 32 && w * 32 + b < count; b++) {
+			bits |= flags[w * 32 + b] ? 1u << b : 0;
+		}
+		new (&roster->flags[w]) std::atomic<uint32_t>(bits);
+	}
+	if(!names.empty()) {
+		memcpy(arena, names.data(), names.size());
+	}
+
+	//Index everyone, leaving out anyone whose PIN or tag is already taken
+	memset(roster->pinSlots, 0, slotBytes);
+	memset(roster->rfidSlots, 0, slotBytes);
+	for(size_t i = 0; i < count; i++) {
+		const Entry& entry = roster->entries[i];
+		if(roster->find(entry.pin, ROSTER_PIN_LENGTH) == ROSTER_NONE) {
+			size_t s = pinHash(entry.pin) & roster->mask;
+			while(roster->pinSlots[s] != 0) {
+				s = (s + 1) & roster->mask;
+			}
+			roster->pinSlots[s] = (uint32_t) i + 1;
+		}
+		//Users without a tag have an empty uid, which is not indexed
+		if(!entry.rfid.empty() && roster->find(entry.rfid) == ROSTER_NONE) {
+			size_t s = CardIdHash()(entry.rfid) & roster->mask;
+			while(roster->rfidSlots[s] != 0) {
+				s = (s + 1) & roster->mask;
+			}
+			roster->rfidSlots[s] = (uint32_t) i + 1;
+		}
+	}
+
+	entries = std::vector<Entry>();
+	flags = std::vector<bool>();
+	hours = std::vector<RosterHours>();
+	names = std::string();
+	return roster;
+}
+
+/*!	Get the number of users.
+ */
+size_t Roster::size() const {
+	return count;
+}
+
+/*!	Get the total length of the names, for reserving a builder.
+ */
+size_t Roster::nameBytes() const {
+	return arenaBytes;
+}
+
+/*!	PIN lookup
+ *
+ * 	@returns	The position of the user, or @p ROSTER_NONE
+ */
+size_t Roster::find(const char* pin, size_t length) const {
+	if(count == 0 || length != ROSTER_PIN_LENGTH) {
+		return ROSTER_NONE;
+	}
+	for(size_t s = pinHash(pin) & mask; pinSlots[s] != 0; s = (s + 1) & mask) {
+		const Entry& entry = entries[pinSlots[s] - 1];
+		if(memcmp(entry.pin, pin, ROSTER_PIN_LENGTH) == 0) {
+			return pinSlots[s] - 1;
+		}
+	}
+	return ROSTER_NONE;
+}
+
+/*!	UID lookup
+ *
+ * 	@returns	The position of the user, or @p ROSTER_NONE
+ */
+size_t Roster::find(const CardId& rfid) const {
+	if(count == 0) {
+		return ROSTER_NONE;
+	}
+	for(size_t s = CardIdHash()(rfid) & mask; rfidSlots[s] != 0;
+			s = (s + 1) & mask) {
+		if(entries[rfidSlots[s] - 1].rfid == rfid) {
+			return rfidSlots[s] - 1;
+		}
+	}
+	return ROSTER_NONE;
+}
+
+/*!	Find a user by PIN
+ *
+ * 	@returns	The position of the user, or @p ROSTER_NONE if nobody has
+ * 		this PIN
+ */
+size_t Roster::findByPin(const char* pin) const {
+	return find(pin, strlen(pin));
+}
+
+size_t Roster::findByPin(const std::string& pin) const {
+	return find(pin.data(), pin.size());
+}
+
+/*!	Find a user by RFID uid
+ *
+ * 	Tags assigned before 7 and 10 byte cards were read in full were stored
+ * 	as their first four bytes only, so if the whole uid is unknown its
+ * 	first four bytes are tried as well.
+ *
+ * 	@returns	The position of the user, or @p ROSTER_NONE if nobody has
+ * 		this uid
+ */
+size_t Roster::findByRfid(const CardId& rfid) const {
+	size_t user = find(rfid);
+	if(user == ROSTER_NONE && rfid.length() > 4) {
+		user = find(rfid.prefix(4));
+	}
+	return user;
+}
+
+/*!	Get a user's name.
+ */
+const char* Roster::name(size_t user) const {
+	return arena + entries[user].name;
+}
+
+/*!	Get a user's PIN.
+ */
+std::string Roster::pin(size_t user) const {
+	return std::string(entries[user].pin, ROSTER_PIN_LENGTH);
+}
+
+/*!	Get a user's tag, which is empty if they have none.
+ */
+const CardId& Roster::rfid(size_t user) const {
+	return entries[user].rfid;
+}
+
+/*!	Check whether a user is signed in.
+ */
+bool Roster::signedIn(size_t user) const {
+	return (flags[user / 32].load() & (1u << (user % 32))) != 0;
+}
+
+/*!	Set whether a user is signed in.
+ *
+ * 	@returns	Whether they were signed in before
+ */
+bool Roster::setSignedIn(size_t user, bool signedin) const {
+	uint32_t bit = 1u << (user % 32);
+	uint32_t old = signedin ? flags[user / 32].fetch_or(bit) :
+		flags[user / 32].fetch_and(~bit);
+	return (old & bit) != 0;
+}
+
+/*!	Sign a user in if they are out, or out if they are in.
+ *
+ * 	@returns	Whether they are signed in now
+ */
+bool Roster::toggle(size_t user) const {
+	uint32_t bit = 1u << (user % 32);
+	return (flags[user / 32].fetch_xor(bit) & bit) == 0;
+}
+
+/*!	Count the users who are signed in.
+ */
+size_t Roster::countSignedIn() const {
+	size_t total = 0;
+	for(size_t w = 0; w < (count + 31) / 32; w++) {
+		total += __builtin_popcount(flags[w].load());
+	}
+	return total;
+}
+
+/*!	Hours from a summary
+ *
+ * 	Packs the summary the server sends with each user: the seconds of
+ * 	their sessions closed this week, and the start of the open one, if any.
+ */
+RosterHours Roster::makeHours(long weekSeconds, std::time_t since,
+		std::time_t now) {
+	std::time_t start;
+	uint32_t week;
+	weekOf(now, start, week);
+	return packHours(since, weekSeconds, week);
+}
+
+/*!	Get a user's hours word, to carry it over to another table.
+ */
+RosterHours Roster::hours(size_t user) const {
+	return weeks[user].load();
+}
+
+/*!	Start a session.
+ *
+ * 	Records that the user signed in at @p when, unless a session is open
+ * 	already, in which case the earlier start stands.
+ */
+void Roster::openSession(size_t user, std::time_t when) const {
+	std::time_t start;
+	uint32_t week;
+	weekOf(when, start, week);
+	RosterHours old = weeks[user].load();
+	RosterHours fresh;
+	do {
+		if((old >> 32) != 0) {
+			return;
+		}
+		fresh = packHours(when, closedSeconds(old, week), week);
+	} while(!weeks[user].compare_exchange_weak(old, fresh));
+}
+
+/*!	End a session.
+ *
+ * 	Adds the part of the open session that falls in this week to the total.
+ *
+ * 	@returns	The seconds signed in this week, with the session closed
+ */
+long Roster::closeSession(size_t user, std::time_t when) const {
+	std::time_t start;
+	uint32_t week;
+	weekOf(when, start, week);
+	RosterHours old = weeks[user].load();
+	RosterHours fresh;
+	do {
+		fresh = packHours(0, closedSeconds(old, week) +
+			openSeconds(old, start, when), week);
+	} while(!weeks[user].compare_exchange_weak(old, fresh));
+	return closedSeconds(fresh, week);
+}
+
+/*!	Get the seconds a user has been signed in this week.
+ *
+ * 	Counts the open session up to @p now as well.
+ */
+long Roster::weekSeconds(size_t user, std::time_t now) const {
+	std::time_t start;
+	uint32_t week;
+	weekOf(now, start, week);
+	RosterHours hours = weeks[user].load();
+	return closedSeconds(hours, week) + openSeconds(hours, start, now);
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "CardId.h"
+
+#include <atomic>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+///Characters in every PIN, the same as the keypad takes
+#define ROSTER_PIN_LENGTH	4
+///Position returned by the lookups when nobody matches
+#define ROSTER_NONE			((size_t) -1)
+
+/**
+ * A user's time this week, packed in one word so it changes atomically
+ * bits 0-19: Seconds signed in this week, not counting the open session
+ * bits 20-31: The week those seconds belong to, counted from 1970, modulo 4096
+ * bits 32-63: When the open session started, or 0 if there is none
+ */
+typedef uint64_t RosterHours;
+
+/*!	Compact user table.
+ *
+ * 	Holds every user in one block of memory, allocated once when the table
+ * 	is built: a fixed-width entry per user with the PIN and card UID kept
+ * 	inline, a packed bitset of who is signed in, open addressing hash tables
+ * 	for finding users by PIN and by UID, and every name one after another in
+ * 	a single arena.  Each user costs a 24 byte entry, an 8 byte hours word,
+ * 	a sign in bit and their name with its terminator, plus two to four
+ * 	4 byte slots in each of the two hash tables, which are kept between a
+ * 	quarter and half full.  That is 48 to 64 bytes and a bit per
+ * 	user on top of the name, however many there are, and nothing in the
+ * 	table is a heap object of its own, so building one and scanning the
+ * 	whole of it both stay in the cache.
+ *
+ * 	Users are referred to by their position in the table.  Once built, only
+ * 	the sign in bits and the weekly hours ever change, and they are atomic,
+ * 	so a table can be shared between threads without a lock.  Anything else
+ * 	is changed by building a new table with a @p Builder.
+ *
+ * 	The weekly hours are kept as a running total for each user: the
+ * 	seconds of the sessions closed since Monday, and when the open session
+ * 	began.  Opening and closing a session each change one word, whatever
+ * 	came before, and a total left over from an earlier week counts as
+ * 	nothing.  A session that began before Monday counts from Monday.
+ */
+class Roster {
+	private:
+		/**
+		 * One user
+		 * rfid: Card UID, empty if they have no tag
+		 * name: Offset of the name in the arena, which is NUL terminated
+		 * pin: The PIN, not terminated
+		 */
+		struct Entry {
+			CardId rfid;
+			uint32_t name;
+			char pin[ROSTER_PIN_LENGTH];
+		};
+
+	public:
+		/*!	Roster builder.
+		 *
+		 * 	Collects users in the order they are added, then lays them out in
+		 * 	a new table.  If two users share a PIN or a UID, the first one
+		 * 	added is the one found by it.
+		 */
+		class Builder {
+			public:
+				void reserve(size_t users, size_t nameBytes);
+				bool add(const char* name, size_t nameLength, const char* pin,
+					size_t pinLength, const CardId& rfid, bool signedin,
+					RosterHours hours = 0);
+				void copy(const Roster& from, size_t user);
+				void copy(const Roster& from, size_t user, const CardId& rfid);
+				size_t size() const;
+				std::shared_ptr<Roster> build();
+
+			private:
+				std::vector<Entry> entries;
+				std::vector<bool> flags;
+				std::vector<RosterHours> hours;
+				std::string names;
+		};
+
+		Roster();
+
+		static RosterHours makeHours(long weekSeconds, std::time_t since,
+			std::time_t now);
+
+		size_t size() const;
+		size_t nameBytes() const;
+		size_t findByPin(const char* pin) const;
+		size_t findByPin(const std::string& pin) const;
+		size_t findByRfid(const CardId& rfid) const;
+
+		const char* name(size_t user) const;
+		std::string pin(size_t user) const;
+		const CardId& rfid(size_t user) const;
+		bool signedIn(size_t user) const;
+		bool setSignedIn(size_t user, bool signedin) const;
+		bool toggle(size_t user) const;
+		size_t countSignedIn() const;
+
+		RosterHours hours(size_t user) const;
+		void openSession(size_t user, std::time_t when) const;
+		long closeSession(size_t user, std::time_t when) const;
+		long weekSeconds(size_t user, std::time_t now) const;
+
+	private:
+		Roster(const Roster&);
+		Roster& operator=(const Roster&);
+
+		size_t find(const char* pin, size_t length) const;
+		size_t find(const CardId& rfid) const;
+
+		///Number of users
+		size_t count;
+		///Number of slots in each hash table, minus one
+		size_t mask;
+		///Bytes in the name arena
+		size_t arenaBytes;
+		///The users, in the order they were added
+		Entry* entries;
+		///Time this week, one word per user
+		std::atomic<RosterHours>* weeks;
+		///Sign in bits, one per user
+		std::atomic<uint32_t>* flags;
+		///Hash table by PIN, holding positions plus one, 0 when free
+		uint32_t* pinSlots;
+		///Hash table by UID, the same way
+		uint32_t* rfidSlots;
+		///Every name, each followed by a NUL
+		const char* arena;
+		///The memory everything above lives in
+		std::unique_ptr<char[]> block;
+};
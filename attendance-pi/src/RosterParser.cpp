@@ -0,0 +1,347 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "RosterParser.h"
+
+#include <stdlib.h>
+
+/*!	Parser constructor
+ *
+ * 	@param onUser	Called for every complete user record
+ * 	@param onRemoved	Called for every PIN in the @p removed list
+ * 	@param context	Passed through to both callbacks
+ */
+RosterParser::RosterParser(UserCallback onUser, RemovedCallback onRemoved,
+		void* context) {
+	this->onUser = onUser;
+	this->onRemoved = onRemoved;
+	this->context = context;
+	lex = LEX_NONE;
+	depth = 0;
+	expectKey = false;
+	seenRoot = false;
+	err = nullptr;
+	codepoint = 0;
+	highSurrogate = 0;
+	unicodeDigits = 0;
+	record.signedin = false;
+	record.week = 0;
+	record.since = 0;
+	ver = 0;
+	full = true;
+	isArray = false;
+}
+
+/*!	Feed the next chunk of the document to the parser.
+ *
+ * 	@returns	@p false if the document is malformed, in which case the
+ * 		rest of it should not be fed.
+ */
+bool RosterParser::feed(const char* data, size_t length) {
+	for(size_t i = 0; i < length && err == nullptr; i++) {
+		char c = data[i];
+		//Continue whatever token is in progress
+		switch(lex) {
+			case LEX_STRING:
+				if(c == '"') {
+					lex = LEX_NONE;
+					onString();
+				} else if(c == '\\') {
+					lex = LEX_ESCAPE;
+				} else if((unsigned char) c < 0x20) {
+					fail("Control character in string");
+				} else {
+					token += c;
+				}
+				continue;
+			case LEX_ESCAPE:
+				lex = LEX_STRING;
+				switch(c) {
+					case '"': case '\\': case '/': token += c; break;
+					case 'b': token += '\b'; break;
+					case 'f': token += '\f'; break;
+					case 'n': token += '\n'; break;
+					case 'r': token += '\r'; break;
+					case 't': token += '\t'; break;
+					case 'u':
+						lex = LEX_UNICODE;
+						codepoint = 0;
+						unicodeDigits = 0;
+						break;
+					default: fail("Invalid escape sequence");
+				}
+				continue;
+			case LEX_UNICODE:
+				if(c >= '0' && c <= '9') {
+					codepoint = codepoint * 16 + (c - '0');
+				} else if(c >= 'a' && c <= 'f') {
+					codepoint = codepoint * 16 + (c - 'a' + 10);
+				} else if(c >= 'A' && c <= 'F') {
+					codepoint = codepoint * 16 + (c - 'A' + 10);
+				} else {
+					fail("Invalid unicode escape");
+					continue;
+				}
+				if(++unicodeDigits == 4) {
+					appendCodepoint(codepoint);
+					lex = LEX_STRING;
+				}
+				continue;
+			case LEX_NUMBER:
+				if((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' ||
+						c == '+' || c == '-') {
+					token += c;
+					continue;
+				}
+				//This character ends the number, handle it below
+				lex = LEX_NONE;
+				onValue(VALUE_NUMBER);
+				break;
+			case LEX_LITERAL:
+				if(c >= 'a' && c <= 'z') {
+					token += c;
+					continue;
+				}
+				//This character ends the literal, handle it below
+				lex = LEX_NONE;
+				if(token != "true" && token != "false" && token != "null") {
+					fail("Invalid literal");
+					continue;
+				}
+				onValue(VALUE_LITERAL);
+				break;
+			case LEX_NONE:
+				break;
+		}
+		if(err != nullptr) {
+			break;
+		}
+
+		//Start something new
+		switch(c) {
+			case ' ': case '\t': case '\r': case '\n': case ':':
+				break;
+			case ',':
+				expectKey = depth > 0 && stack[depth - 1].object;
+				break;
+			case '{': openContainer(true); break;
+			case '[': openContainer(false); break;
+			case '}': closeContainer(true); break;
+			case ']': closeContainer(false); break;
+			case '"':
+				lex = LEX_STRING;
+				token.clear();
+				break;
+			case 't': case 'f': case 'n':
+				lex = LEX_LITERAL;
+				token.assign(1, c);
+				break;
+			default:
+				if(c == '-' || (c >= '0' && c <= '9')) {
+					lex = LEX_NUMBER;
+					token.assign(1, c);
+				} else {
+					fail("Unexpected character");
+				}
+		}
+	}
+	return err == nullptr;
+}
+
+/*!	Tell the parser the document has ended.
+ *
+ * 	@returns	@p true if a complete document was read
+ */
+bool RosterParser::finish() {
+	if(err == nullptr && (!seenRoot || depth != 0 || lex != LEX_NONE)) {
+		fail("Unexpected end of document");
+	}
+	return err == nullptr;
+}
+
+/*!	Check if the document only holds the changes since an earlier version.
+ */
+bool RosterParser::isDelta() const {
+	return !isArray && !full;
+}
+
+/*!	Get the version of the user list, or 0 if the server did not send one.
+ */
+long RosterParser::version() const {
+	return ver;
+}
+
+/*!	Get a description of what was wrong with the document, if anything.
+ */
+const char* RosterParser::error() const {
+	return err;
+}
+
+/*!	Array and object start handler.
+ *
+ * 	Works out what the new container holds from where it appears.
+ */
+void RosterParser::openContainer(bool object) {
+	Kind kind = KIND_SKIP;
+	if(depth == 0) {
+		if(seenRoot) {
+			fail("More than one document");
+			return;
+		}
+		seenRoot = true;
+		//Either the plain list of users or the versioned object
+		kind = object ? KIND_TOP : KIND_USERS;
+		isArray = !object;
+	} else {
+		const Frame& parent = stack[depth - 1];
+		if(parent.kind == KIND_TOP && !object) {
+			if(key == "users") {
+				kind = KIND_USERS;
+			} else if(key == "removed") {
+				kind = KIND_REMOVED;
+			}
+		} else if(parent.kind == KIND_USERS && object) {
+			kind = KIND_USER;
+			record.fname.clear();
+			record.pin.clear();
+			record.rfid.clear();
+			record.signedin = false;
+			record.week = 0;
+			record.since = 0;
+		}
+	}
+	if(depth == ROSTER_MAX_DEPTH) {
+		fail("Document is nested too deeply");
+		return;
+	}
+	stack[depth].kind = kind;
+	stack[depth].object = object;
+	depth++;
+	expectKey = object;
+}
+
+/*!	Array and object end handler.
+ */
+void RosterParser::closeContainer(bool object) {
+	if(depth == 0 || stack[depth - 1].object != object) {
+		fail("Mismatched bracket");
+		return;
+	}
+	depth--;
+	if(stack[depth].kind == KIND_USER) {
+		onUser(record, context);
+	}
+	expectKey = false;
+}
+
+/*!	String handler.
+ *
+ * 	Strings in key position become the current key, anything else is a
+ * 	value.
+ */
+void RosterParser::onString() {
+	if(expectKey) {
+		key = token;
+		expectKey = false;
+		return;
+	}
+	onValue(VALUE_STRING);
+}
+
+/*!	Scalar value handler.
+ *
+ * 	Stores the value just read if it is one of the interesting ones.
+ */
+void RosterParser::onValue(Value type) {
+	if(depth == 0) {
+		fail("Unexpected value");
+		return;
+	}
+	switch(stack[depth - 1].kind) {
+		case KIND_TOP:
+			if(key == "version" && type == VALUE_NUMBER) {
+				ver = strtol(token.c_str(), nullptr, 10);
+			} else if(key == "full" && type == VALUE_LITERAL) {
+				full = token == "true";
+			}
+			break;
+		case KIND_USER:
+			if(key == "fname" && type == VALUE_STRING) {
+				record.fname = token;
+			} else if(key == "pin" && type != VALUE_LITERAL) {
+				record.pin = token;
+			} else if(key == "rfid" && type != VALUE_LITERAL) {
+				record.rfid = token;
+			} else if(key == "signedin") {
+				record.signedin = parseBool(type);
+			} else if(key == "week" && type != VALUE_LITERAL) {
+				record.week = strtol(token.c_str(), nullptr, 10);
+			} else if(key == "since" && type != VALUE_LITERAL) {
+				record.since = strtol(token.c_str(), nullptr, 10);
+			}
+			break;
+		case KIND_REMOVED:
+			if(type != VALUE_LITERAL) {
+				onRemoved(token, context);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+/*!	UTF-8 encoder for unicode escapes.
+ */
+void RosterParser::appendCodepoint(unsigned int cp) {
+	//Surrogate pairs arrive as two escapes
+	if(cp >= 0xD800 && cp < 0xDC00) {
+		highSurrogate = cp;
+		return;
+	}
+	if(cp >= 0xDC00 && cp < 0xE000) {
+		if(highSurrogate == 0) {
+			token += '?';
+			return;
+		}
+		cp = 0x10000 + ((highSurrogate - 0xD800) << 10) + (cp - 0xDC00);
+	}
+	highSurrogate = 0;
+	if(cp < 0x80) {
+		token += (char) cp;
+	} else if(cp < 0x800) {
+		token += (char) (0xC0 | (cp >> 6));
+		token += (char) (0x80 | (cp & 0x3F));
+	} else if(cp < 0x10000) {
+		token += (char) (0xE0 | (cp >> 12));
+		token += (char) (0x80 | ((cp >> 6) & 0x3F));
+		token += (char) (0x80 | (cp & 0x3F));
+	} else {
+		token += (char) (0xF0 | (cp >> 18));
+		token += (char) (0x80 | ((cp >> 12) & 0x3F));
+		token += (char) (0x80 | ((cp >> 6) & 0x3F));
+		token += (char) (0x80 | (cp & 0x3F));
+	}
+}
+
+/*!	Boolean decoder.
+ *
+ * 	Some servers send flags as @p true, some as @p 1 and some as @p "1", so
+ * 	all of them are accepted.
+ */
+bool RosterParser::parseBool(Value type) const {
+	switch(type) {
+		case VALUE_LITERAL: return token == "true";
+		case VALUE_NUMBER: return strtod(token.c_str(), nullptr) != 0;
+		case VALUE_STRING: return token == "1" || token == "true";
+		default: return false;
+	}
+}
+
+/*!	Error handler.
+ *
+ * 	Records the first thing that went wrong.  Nothing is parsed after it.
+ */
+void RosterParser::fail(const char* why) {
+	if(err == nullptr) {
+		err = why;
+	}
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+#include <stddef.h>
+
+///Deepest nesting of arrays and objects the parser will follow
+#define ROSTER_MAX_DEPTH	32
+
+/*!	Incremental user list decoder.
+ *
+ * 	This class decodes the user list sent by the server a chunk at a time,
+ * 	as the bytes arrive, without ever holding the whole document in memory.
+ * 	Each user is handed to the user callback as soon as its closing brace
+ * 	has been read.  The record passed to the callback is reused for the next
+ * 	user, so its contents must be copied if they are needed afterwards.
+ *
+ * 	Both forms of the list described in @p UserHandler::update() are
+ * 	understood: a plain array of users, and an object with @p version,
+ * 	@p full, @p users and @p removed members.  Any other members, including
+ * 	nested arrays and objects, are skipped.
+ */
+class RosterParser {
+	public:
+		/**
+		 * A user read from the list
+		 * week: Seconds signed in since Monday, not counting an open session
+		 * since: When the open session started, or 0
+		 */
+		struct Record {
+			std::string fname;
+			std::string pin;
+			std::string rfid;
+			bool signedin;
+			long week;
+			long since;
+		};
+
+		typedef void (*UserCallback)(const Record&, void*);
+		typedef void (*RemovedCallback)(const std::string&, void*);
+
+		RosterParser(UserCallback onUser, RemovedCallback onRemoved,
+			void* context);
+
+		bool feed(const char* data, size_t length);
+		bool finish();
+
+		bool isDelta() const;
+		long version() const;
+		const char* error() const;
+
+	private:
+		typedef enum {
+			LEX_NONE,
+			LEX_STRING,
+			LEX_ESCAPE,
+			LEX_UNICODE,
+			LEX_NUMBER,
+			LEX_LITERAL
+		} Lexer;
+
+		typedef enum {
+			VALUE_STRING,
+			VALUE_NUMBER,
+			VALUE_LITERAL
+		} Value;
+
+		typedef enum {
+			KIND_TOP,
+			KIND_USERS,
+			KIND_REMOVED,
+			KIND_USER,
+			KIND_SKIP
+		} Kind;
+
+		struct Frame {
+			Kind kind;
+			bool object;
+		};
+
+		void openContainer(bool object);
+		void closeContainer(bool object);
+		void onString();
+		void onValue(Value type);
+		void appendCodepoint(unsigned int cp);
+		bool parseBool(Value type) const;
+		void fail(const char* why);
+
+		UserCallback onUser;
+		RemovedCallback onRemoved;
+		void* context;
+
+		Lexer lex;
+		Frame stack[ROSTER_MAX_DEPTH];
+		int depth;
+		bool expectKey;
+		bool seenRoot;
+		const char* err;
+
+		std::string key;
+		std::string token;
+		unsigned int codepoint;
+		unsigned int highSurrogate;
+		int unicodeDigits;
+
+		Record record;
+		long ver;
+		bool full;
+		bool isArray;
+};
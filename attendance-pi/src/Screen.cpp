@@ -0,0 +1,235 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Screen.h"
+#include "LCD.h"
+#include "Reactor.h"
+#include "ANSI.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+#include <mutex>
+#include <chrono>
+#include <string>
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The initialization process for the screen draws whatever has been shown
+ * 	so far and creates the expiry timer.  It must run after the LCD has been
+ * 	initialized.  Text can be shown before then, it just isn't drawn yet.
+ *
+ * 	@section regions	Regions
+ *
+ * 	Nothing writes to the LCD directly any more.  The display is split into
+ * 	named regions: the status bar on the second line, where the clock
+ * 	lives, the message line on the first, and the PIN field in the middle
+ * 	of the message line.  Each region holds one text for each priority, and
+ * 	the display shows, everywhere, the highest priority text that covers
+ * 	it.  The @p BACKGROUND text of the message line is the state's own
+ * 	message, such as "Ready!", which State::changeState() puts there.
+ * 	Greetings and errors go on top of it at @p NORMAL priority, and
+ * 	diagnostics at @p ALERT, so the clock can keep redrawing its background
+ * 	without wiping out an IP address someone is trying to read.
+ *
+ * 	@section expiry	Expiry
+ *
+ * 	A text can be given a duration, after which it is taken down and the
+ * 	one underneath shows through again.  A Reactor timer is set for when the
+ * 	next text is due to go, so nobody has to sleep to leave a greeting on
+ * 	the display, or remember to put "Ready!" back afterwards.  Every change
+ * 	recomposes the whole display, which the LCD's shadow framebuffer turns
+ * 	into writes of only the characters that actually changed.
+ *
+ */
+namespace Screen {
+
+	/**
+	 * Where a region is on the display
+	 * row, col: Top left corner
+	 * width: Number of characters
+	 */
+	struct Geometry {
+		int row;
+		int col;
+		int width;
+	};
+
+	/**
+	 * A text shown in a region at one priority
+	 * used: Whether there is a text
+	 * text: The text, padded or cut to the region's width when drawn
+	 * timed: Whether the text expires
+	 * until: When the text expires
+	 */
+	struct Slot {
+		bool used;
+		std::string text;
+		bool timed;
+		std::chrono::steady_clock::time_point until;
+	};
+
+	///Regions, in the same order as @p Region
+	const Geometry regions[REGION_COUNT] = {
+		{ 1, 0, LCD_COLS },
+		{ 0, 0, LCD_COLS },
+		{ 0, 6, 4 }
+	};
+
+	///What each region shows at each priority
+	Slot slots[REGION_COUNT][PRIORITY_COUNT];
+
+	///Guards everything in this module
+	std::mutex lock;
+	///When the next timed text expires
+	std::chrono::steady_clock::time_point next =
+		std::chrono::steady_clock::time_point::max();
+	///Whether the LCD is ready to be drawn on
+	bool ready = false;
+
+	///Timer for the next expiry, or -1 when there is none to set
+	int timer = -1;
+
+	/*!	Draw the display.
+	 *
+	 * 	Paints every region from the lowest priority up, dropping texts that
+	 * 	have expired, and sets the timer for when the next one does.  The
+	 * 	caller must hold @p lock.
+	 */
+	void compose() {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		next = std::chrono::steady_clock::time_point::max();
+		char rows[LCD_ROWS][LCD_COLS];
+		memset(rows, ' ', sizeof(rows));
+		for(int p = 0; p < PRIORITY_COUNT; p++) {
+			for(int r = 0; r < REGION_COUNT; r++) {
+				Slot& slot = slots[r][p];
+				if(!slot.used) {
+					continue;
+				}
+				if(slot.timed && slot.until <= now) {
+					slot.used = false;
+					continue;
+				}
+				if(slot.timed && slot.until < next) {
+					next = slot.until;
+				}
+				const Geometry& g = regions[r];
+				for(int i = 0; i < g.width; i++) {
+					rows[g.row][g.col + i] =
+						(size_t) i < slot.text.size() ? slot.text[i] : ' ';
+				}
+			}
+		}
+		if(!ready) {
+			return;
+		}
+		for(int row = 0; row < LCD_ROWS; row++) {
+			LCD::writeMessage(std::string(rows[row], LCD_COLS), row, 0);
+		}
+		//Come back when the next text expires
+		if(next == std::chrono::steady_clock::time_point::max()) {
+			Reactor::disarm(timer);
+		} else {
+			Reactor::arm(timer, (long)
+				std::chrono::duration_cast<std::chrono::milliseconds>(next - now)
+				.count() + 1);
+		}
+	}
+
+	/*!	Show a text.
+	 *
+	 * 	Puts @p text in @p region at @p priority, in place of whatever was
+	 * 	there at that priority, and draws the display straight away.  If
+	 * 	@p duration is given, the text is taken down again after it.  Can be
+	 * 	called from any thread.
+	 */
+	void show(Region region, const std::string& text, Priority priority,
+			std::chrono::milliseconds duration) {
+		std::lock_guard<std::mutex> guard(lock);
+		Slot& slot = slots[region][priority];
+		bool changed = !slot.used || slot.text != text ||
+			slot.timed || duration.count() > 0;
+		slot.used = true;
+		slot.text = text;
+		slot.timed = duration.count() > 0;
+		if(slot.timed) {
+			slot.until = std::chrono::steady_clock::now() + duration;
+		}
+		if(!changed) {
+			return;
+		}
+		compose();
+	}
+
+	/*!	Take a text down.
+	 *
+	 * 	Removes whatever @p region shows at @p priority, so the text
+	 * 	underneath shows through.
+	 */
+	void clear(Region region, Priority priority) {
+		std::lock_guard<std::mutex> guard(lock);
+		Slot& slot = slots[region][priority];
+		if(!slot.used) {
+			return;
+		}
+		slot.used = false;
+		compose();
+	}
+
+	/*!	Expiry timer handler.
+	 *
+	 * 	Runs on the reactor thread when the next text is due to go, and
+	 * 	redraws the display without it.
+	 */
+	void expire(uint32_t events, void* ctx) {
+		std::lock_guard<std::mutex> guard(lock);
+		if(ready) {
+			compose();
+		}
+	}
+
+	/*!	Screen Initialization Method.
+	 *
+	 * 	This method creates the expiry timer and draws the display for the
+	 * 	first time.
+	 */
+	void init() {
+		//Initialize the screen
+		printf(LOADING "Initializing Screen...");
+		fflush(stdout);
+
+		std::lock_guard<std::mutex> guard(lock);
+		try {
+			timer = Reactor::timer(expire, nullptr);
+		} catch(const std::exception& e) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw;
+		}
+		ready = true;
+		compose();
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/*!	Screen Destruction Method.
+	 *
+	 * 	This method removes the expiry timer.  Texts shown afterwards are kept
+	 * 	but no longer drawn.
+	 */
+	void destroy() {
+		//Destroy the screen
+		printf(LOADING "Destroying Screen...");
+		fflush(stdout);
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			ready = false;
+			Reactor::remove(timer);
+			timer = -1;
+		}
+
+		//Success
+		printf(OKAY "\n");
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <chrono>
+
+///Time a greeting or error stays on the display
+#define SCREEN_MESSAGE_TIME		std::chrono::milliseconds(1000)
+///Time a diagnostics screen stays on the display
+#define SCREEN_DIAGNOSTIC_TIME	std::chrono::milliseconds(5000)
+
+namespace Screen {
+
+	///Parts of the display that are drawn independently
+	typedef enum {
+		STATUS,			///< Second line: the clock and connection icon
+		MESSAGE,		///< First line: the state, greetings and errors
+		INPUT,			///< The PIN being typed, in the middle of the first line
+		REGION_COUNT
+	} Region;
+
+	///Which text wins where regions or messages overlap, lowest first
+	typedef enum {
+		BACKGROUND,		///< What a region shows when nothing else is up
+		NORMAL,			///< Greetings, errors and input
+		ALERT,			///< Diagnostics and shutdown notices
+		PRIORITY_COUNT
+	} Priority;
+
+	void init();
+	void destroy();
+
+	void show(Region, const std::string& text, Priority = BACKGROUND,
+		std::chrono::milliseconds duration = std::chrono::milliseconds(0));
+	void clear(Region, Priority);
+}
@@ -0,0 +1,460 @@
+#include "vs-intellisense-fix.hpp"
+
+#include "Sender.h"
+#include "Journal.h"
+#include "UserHandler.h"
+#include "Health.h"
+#include "Utils.h"
+#include "Metrics.h"
+#include "Log.h"
+#include "ANSI.h"
+#include "json.hpp"
+
+#include <stdio.h>
+#include <string>
+#include <sstream>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <ctime>
+#include <unistd.h>
+
+///Maximum number of events waiting to be sent
+#define SENDER_QUEUE_SIZE	64
+///Maximum number of events sent in one request
+#define SENDER_BATCH_SIZE	32
+///Time to wait for more taps before sending one
+#define SENDER_COALESCE_WINDOW	std::chrono::milliseconds(200)
+
+/*!	@section mod_init	Module Initialization
+ *
+ * 	The initialization process for the Sender spawns the sending thread, which
+ * 	waits for events to be placed in its queue.  The Sender starts out
+ * 	offline, and anything left in the Journal by the previous run is sent
+ * 	once the server has been reached for the first time.
+ *
+ * 	@section send_thread	Sending Thread
+ *
+ * 	Sign in, sign out and tag assignment events are shown to the user and
+ * 	applied to the local user table as soon as they happen, and are then
+ * 	handed to the Sender to be reported to the server.  The sending thread
+ * 	takes events off the queue one at a time, sends the request, and passes
+ * 	the server's reply back to the User Handler so that any disagreement
+ * 	between the local table and the server can be corrected.  This way the
+ * 	RFID and Keypad threads never wait on the network.
+ *
+ * 	@section offline	Offline Operation
+ *
+ * 	Every event is recorded in the Journal before it is queued, and is only
+ * 	removed from it once the server has replied.  When the server cannot be
+ * 	reached, the Sender goes offline: it stops sending, and new events are
+ * 	only written to the Journal.  Once Main sees that the server is reachable
+ * 	again it calls @p reconnect(), and the sending thread replays everything
+ * 	pending in the Journal, oldest first, before moving on to new events.
+ * 	The in-memory queue is therefore only a window onto the Journal, and an
+ * 	event that does not fit in it is never lost.
+ *
+ * 	A reply with a 5xx or 429 status, or one that can't be decoded, such
+ * 	as an error page from a proxy, is treated as no answer as well.  The
+ * 	server still answers the health probe in that case, so the Sender
+ * 	reports the failure to make Main back off before reconnecting.
+ *
+ * 	A request that times out is handled the same way, although the server
+ * 	may well have applied it before the reply was lost.  So that replaying
+ * 	it doesn't toggle the user a second time, every sign in and out carries
+ * 	the name of the kiosk, taken from @p KIOSK_ID or else the hostname,
+ * 	along with its Journal sequence number and time.  The server records
+ * 	each one it applies, and answers one it has seen before with the user's
+ * 	state without applying it again.
+ *
+ * 	@section batching	Batching
+ *
+ * 	Sign ins and outs that are waiting together, because they came in
+ * 	during the rush before practice, piled up while a request was in
+ * 	flight, or are being replayed from the Journal, are posted to the
+ * 	trigger endpoint in a single request of up to @p SENDER_BATCH_SIZE
+ * 	events, each with its own time.  The sending thread waits a moment after
+ * 	a tap so the next few can join it.  The server answers with a result for
+ * 	each event, in order, and each one is checked against the local state
+ * 	just like the reply to a single request.  A server that doesn't know
+ * 	about batches refuses the whole request, with a 400 or 405 status or a
+ * 	reply that isn't a list of results, in which case the events are sent
+ * 	one at a time from then on.  Any other failure, such as a server error
+ * 	or a garbled reply, is retried later like a single event, and batching
+ * 	stays on.  An event is only removed from the Journal
+ * 	once a result for it has come back, and any the server leaves out
+ * 	are sent again on their own.
+ *
+ */
+namespace Sender {
+
+	///Sending thread
+	std::thread sendThread;
+	///Thread termination condition
+	bool run = true;
+
+	///Events waiting to be sent
+	std::deque<Event> queue;
+	std::mutex m;
+	std::condition_variable cv;
+
+	///Weather or not the server is believed to be reachable
+	bool online = false;
+	///Weather or not the Journal holds events that are not in the queue
+	bool backlog = true;
+	///Sequence number of the last event placed in the queue
+	unsigned long lastQueued = 0;
+	///Weather or not the server is believed to take batched triggers
+	bool batching = true;
+	///Name the server knows this kiosk's events by
+	std::string kiosk;
+
+	/*!	Request URL builder.
+	 *
+	 * 	This method creates the URL the given event should be sent to.
+	 */
+	std::string buildUrl(const Event& event) {
+		std::ostringstream url;
+		url << getenv("API_BASEURL");
+		switch(event.type) {
+			case TRIGGER_PIN:
+				url << getenv("API_TRIGGER");
+				url << "?pin=" << event.pin;
+				url << "&kiosk=" << kiosk << "&seq=" << event.seq;
+				url << "&time=" << (long long) event.time;
+				break;
+			case TRIGGER_RFID:
+				url << getenv("API_TRIGGER");
+				url << "?rfid=" << event.rfid;
+				url << "&kiosk=" << kiosk << "&seq=" << event.seq;
+				url << "&time=" << (long long) event.time;
+				break;
+			case ASSIGN_RFID:
+				url << getenv("API_ASSIGN");
+				url << "?pin=" << event.pin;
+				url << "&rfid=" << event.rfid;
+				break;
+		}
+		return url.str();
+	}
+
+	/*!	Check whether an event can go in a batch.
+	 */
+	bool isTrigger(const Event& event) {
+		return event.type == TRIGGER_PIN || event.type == TRIGGER_RFID;
+	}
+
+	/*!	Check whether a request went without an answer.
+	 *
+	 * 	Only a reply the application could be decoded from counts as an
+	 * 	answer.  A server error, an error page from a proxy or anything else
+	 * 	that can't be decoded doesn't, since the event may never have got to
+	 * 	the application.  The events in such a request stay in the Journal
+	 * 	and are sent again later, which the server ignores if it had applied
+	 * 	them after all.
+	 */
+	bool isUnanswered(Utils::RequestStatus status) {
+		return status != Utils::REQUEST_OK;
+	}
+
+	/*!	Single event sender.
+	 *
+	 * 	This method sends one event in a request of its own, and hands the
+	 * 	reply to the User Handler.
+	 */
+	Utils::RequestStatus sendOne(const Event& event) {
+		std::string url = buildUrl(event);
+		nlohmann::json resp;
+		uint64_t start = Metrics::now();
+		Utils::RequestStatus status = Utils::jsonRequest(url.c_str(), resp);
+		Metrics::since(Metrics::HTTP_TRIGGER, start);
+		if(status != Utils::REQUEST_OK) {
+			Metrics::add(Metrics::HTTP_TRIGGER_FAILURES);
+		}
+		if(!isUnanswered(status)) {
+			//The server has seen it, one way or another
+			Journal::ack(event.seq);
+			UserHandler::applyResponse(event, resp);
+		}
+		return status;
+	}
+
+	/*!	Check whether a batch result answers an event.
+	 *
+	 * 	The server echoes each event's sequence number in its result, and a
+	 * 	result that carries a different one, or isn't an object at all, has
+	 * 	been lined up with the wrong event.
+	 */
+	bool isResultFor(const nlohmann::json& result, const Event& event) {
+		if(!result.is_object()) {
+			return false;
+		}
+		auto seq = result.find("seq");
+		return seq == result.end() || (seq->is_number_unsigned() &&
+			seq->get<unsigned long>() == event.seq);
+	}
+
+	/*!	Batch sender.
+	 *
+	 * 	This method posts several sign in and out events to the trigger
+	 * 	endpoint in one request, and hands each event's result to the User
+	 * 	Handler as if it had been sent on its own.  Events the server left
+	 * 	without a result are sent on their own straight away, and @p status
+	 * 	is then that of the last one sent.
+	 *
+	 * 	@returns	@p false if the server refused the batch, by answering
+	 * 		without a list of results or with a 400 or 405 status, in which
+	 * 		case none of the events have been handled.  Any other failure is
+	 * 		left in @p status to be retried like a single event.
+	 */
+	bool sendBatch(const std::vector<Event>& batch, Utils::RequestStatus& status) {
+		nlohmann::json body;
+		body["kiosk"] = kiosk;
+		body["events"] = nlohmann::json::array();
+		for(size_t i = 0; i < batch.size(); i++) {
+			nlohmann::json item;
+			item["seq"] = batch[i].seq;
+			item["time"] = (long long) batch[i].time;
+			if(batch[i].type == TRIGGER_PIN) {
+				item["pin"] = batch[i].pin;
+			} else {
+				item["rfid"] = batch[i].rfid;
+			}
+			body["events"].push_back(item);
+		}
+		std::string text = body.dump();
+		std::string url = std::string(getenv("API_BASEURL")) + getenv("API_TRIGGER");
+
+		nlohmann::json resp;
+		long http = 0;
+		uint64_t start = Metrics::now();
+		status = Utils::jsonRequest(url.c_str(), resp, &text, &http);
+		Metrics::since(Metrics::HTTP_TRIGGER, start);
+		if(status != Utils::REQUEST_OK) {
+			Metrics::add(Metrics::HTTP_TRIGGER_FAILURES);
+		}
+		if(http == 400 || http == 405) {
+			//A server that doesn't take posts, or doesn't read this body
+			return false;
+		}
+		if(isUnanswered(status)) {
+			//Nothing is known about batches yet, so try again later
+			return true;
+		}
+		auto results = resp.find("results");
+		if(results == resp.end() || !results->is_array()) {
+			//Only a server that knows about batches sends a result for each
+			return false;
+		}
+		for(size_t i = 0; i < batch.size(); i++) {
+			if(i < results->size() && isResultFor((*results)[i], batch[i])) {
+				Journal::ack(batch[i].seq);
+				UserHandler::applyResponse(batch[i], (*results)[i]);
+				continue;
+			}
+			//Not answered, so it goes on its own
+			status = sendOne(batch[i]);
+			if(isUnanswered(status)) {
+				break;
+			}
+		}
+		return true;
+	}
+
+	/*!	Sending thread.
+	 *
+	 * 	This method is spawned as a new thread by the Sender initialization
+	 * 	process, and sends queued events to the server in the order they
+	 * 	happened.
+	 */
+	void thread() {
+		std::unique_lock<std::mutex> lk(m);
+		while(run) {
+			//Catch up with the journal once the queue has drained
+			if(queue.empty() && backlog && online) {
+				std::vector<Event> events =
+					Journal::pendingAfter(lastQueued, SENDER_QUEUE_SIZE);
+				queue.insert(queue.end(), events.begin(), events.end());
+				if(!events.empty()) {
+					lastQueued = events.back().seq;
+				}
+				backlog = events.size() == SENDER_QUEUE_SIZE;
+			}
+			//Wait for something to send
+			if(queue.empty() || !online) {
+				cv.wait(lk);
+				continue;
+			}
+			//Give taps that come in together a moment to join the same request
+			if(batching && isTrigger(queue.front()) &&
+					queue.size() < SENDER_BATCH_SIZE) {
+				cv.wait_for(lk, SENDER_COALESCE_WINDOW, [] {
+					return !run || !online || queue.size() >= SENDER_BATCH_SIZE;
+				});
+				if(!run || !online) {
+					continue;
+				}
+			}
+			//Take every sign in and out at the front of the queue
+			std::vector<Event> batch;
+			while(batching && !queue.empty() && batch.size() < SENDER_BATCH_SIZE &&
+					isTrigger(queue.front())) {
+				batch.push_back(queue.front());
+				queue.pop_front();
+			}
+			if(batch.empty()) {
+				batch.push_back(queue.front());
+				queue.pop_front();
+			}
+
+			//Don't hold the queue while talking to the server
+			lk.unlock();
+			Utils::RequestStatus status = Utils::REQUEST_OK;
+			if(batch.size() > 1 && !sendBatch(batch, status)) {
+				Log::warn("Server does not take batched triggers, "
+					"sending them one at a time\n");
+				lk.lock();
+				batching = false;
+				queue.insert(queue.begin(), batch.begin(), batch.end());
+				continue;
+			} else if(batch.size() == 1) {
+				status = sendOne(batch[0]);
+			}
+			lk.lock();
+
+			if(isUnanswered(status)) {
+				//Go offline, and start over from these events once reconnected
+				if(status == Utils::REQUEST_NO_CONNECTION) {
+					Log::warn("Server unreachable, holding %i events\n",
+						(int) Journal::pendingCount());
+				} else if(status == Utils::REQUEST_TIMED_OUT) {
+					Log::warn("Server did not answer, holding %i events\n",
+						(int) Journal::pendingCount());
+				} else {
+					Log::warn("Server could not take the events, holding %i\n",
+						(int) Journal::pendingCount());
+					//It still answers probes, so hold off before trying again
+					Health::reportFailure();
+				}
+				online = false;
+				backlog = true;
+				lastQueued = batch.front().seq - 1;
+				queue.clear();
+			}
+		}
+	}
+
+	/*!	Sender Initialization Method.
+	 *
+	 * 	This method spawns the sending thread.
+	 */
+	void init() {
+		//Initialize the sender
+		printf(LOADING "Initializing Sender...");
+		fflush(stdout);
+
+		//Find the name to send with the events
+		const char* id = getenv("KIOSK_ID");
+		char host[64] = "";
+		if(id == nullptr && gethostname(host, sizeof(host) - 1) == 0) {
+			id = host;
+		}
+		kiosk = id != nullptr ? id : "";
+
+		//Start the sending thread
+		sendThread = std::thread(thread);
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/*!	Sender Destruction Method.
+	 *
+	 * 	This method instructs the sending thread to terminate once the request
+	 * 	in progress, if any, has finished, and then joins it.  Events still
+	 * 	waiting to be sent remain in the Journal for the next run.
+	 */
+	void destroy() {
+		//Destroy the sender
+		printf(LOADING "Destroying Sender...");
+		fflush(stdout);
+
+		//Instruct the thread to terminate
+		{
+			std::lock_guard<std::mutex> lk(m);
+			run = false;
+		}
+		cv.notify_one();
+		//Join the thread
+		sendThread.join();
+
+		//Success
+		printf(OKAY "\n");
+	}
+
+	/*!	Queue an event for sending.
+	 *
+	 * 	This method records the event in the Journal and, if the Sender is
+	 * 	online and keeping up, places it at the end of the queue.  It returns
+	 * 	immediately either way.
+	 *
+	 * 	@returns	@p true if the event was queued, or @p false if it is being
+	 * 		held in the Journal until the Sender catches up.
+	 */
+	bool send(const Event& event) {
+		Event e = event;
+		if(e.time == 0) {
+			e.time = std::time(0);
+		}
+		{
+			std::lock_guard<std::mutex> lk(m);
+			//Journal first, so that the event survives whatever happens next
+			e.seq = Journal::append(e);
+			if(!online || backlog || queue.size() >= SENDER_QUEUE_SIZE) {
+				backlog = true;
+				return false;
+			}
+			queue.push_back(e);
+			lastQueued = e.seq;
+		}
+		cv.notify_one();
+		return true;
+	}
+
+	/*!	Resume sending.
+	 *
+	 * 	This method is called once the server is known to be reachable, and
+	 * 	tells the sending thread to replay the Journal.
+	 */
+	void reconnect() {
+		{
+			std::lock_guard<std::mutex> lk(m);
+			if(online) {
+				return;
+			}
+			online = true;
+		}
+		Log::info("Sender is back online\n");
+		cv.notify_one();
+	}
+
+	/*!	Pause sending.
+	 *
+	 * 	This method is called when the network goes away, so that the sending
+	 * 	thread does not waste time on requests that cannot succeed.
+	 */
+	void disconnect() {
+		std::lock_guard<std::mutex> lk(m);
+		online = false;
+	}
+
+	/*!	Check if the Sender is offline.
+	 */
+	bool isOffline() {
+		std::lock_guard<std::mutex> lk(m);
+		return !online;
+	}
+}
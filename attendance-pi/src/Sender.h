@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <ctime>
+
+namespace Sender {
+
+	typedef enum {
+		TRIGGER_PIN,
+		TRIGGER_RFID,
+		ASSIGN_RFID
+	} EventType;
+
+	/**
+	 * An event that needs to be reported to the server
+	 * type: What kind of request to send
+	 * pin: The PIN of the user the event belongs to
+	 * rfid: The RFID uid used for the event, if any
+	 * seq: The Journal sequence number, assigned by send()
+	 * time: When the event happened, filled in by send() if left at 0
+	 */
+	struct Event {
+		EventType type;
+		std::string pin;
+		std::string rfid;
+		unsigned long seq;
+		std::time_t time;
+	};
+
+	void init();
+	void destroy();
+
+	bool send(const Event&);
+	void reconnect();
+	void disconnect();
+	bool isOffline();
+}
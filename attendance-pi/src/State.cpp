@@ -1,50 +1,184 @@
 #include "State.h"
-#include "LCD.h"
+#include "Screen.h"
+#include "Log.h"
 #include "ANSI.h"
 
+#include <stdio.h>
+#include <stdint.h>
+#include <mutex>
+
+///Most listeners that can be subscribed to state changes
+#define STATE_MAX_LISTENERS	8
+///Bit for a state in a transition mask
+#define TO(s)	(1u << (s))
+///Every state a running program can be stopped or fail from
+#define STATE_ANY_STOP	(TO(ERROR) | TO(STOPPING))
+
+/*!	@section transitions	Transitions
+ *
+ * 	Every state has a row in @p table giving its name, the states it may
+ * 	move to, what it accepts from the input devices and what it puts on the
+ * 	display when entered.  changeState() is the only place the state is
+ * 	written, and refuses anything the table doesn't list, so the input
+ * 	handlers and the background threads don't each need to work out what
+ * 	is allowed.
+ *
+ * 	Moving to the state that is already current is always allowed.  It puts
+ * 	the state's message back, since something else may have replaced it,
+ * 	but isn't logged or passed to the listeners.  The message is shown as
+ * 	the message line's background, so a greeting on top of it stays up
+ * 	until it expires.
+ *
+ * 	@section listeners	Listeners
+ *
+ * 	Modules that care about the state, such as the Clock, subscribe a
+ * 	listener instead of polling @p state.  Transitions are serialized, so
+ * 	listeners see them one at a time and in order.
+ *
+ */
 namespace State {
 
+	/**
+	 * One row of the state table
+	 * name: Name printed in logs
+	 * next: Mask of the states that may follow this one
+	 * keys: Whether key presses are handled
+	 * cards: Whether card taps are handled
+	 * clock: Whether the clock is drawn on the second line
+	 * message: Background of the message line on entry, or @p nullptr to leave it
+	 */
+	struct Row {
+		const char* name;
+		uint32_t next;
+		bool keys;
+		bool cards;
+		bool clock;
+		const char* message;
+	};
+
+	///State table, in the same order as @p State
+	const Row table[] = {
+		{ "PRE_INIT", TO(INIT) | STATE_ANY_STOP, false, false, false, nullptr },
+		{ "INIT", TO(READY) | TO(NO_INTERNET) | STATE_ANY_STOP,
+			false, false, false, nullptr },
+		{ "NO_INTERNET", TO(READY) | STATE_ANY_STOP,
+			false, false, true, "No connection   " },
+		{ "READY", TO(INPUT) | TO(BUSY) | TO(NO_INTERNET) | STATE_ANY_STOP,
+			true, true, true, "     Ready!     " },
+		{ "INPUT", TO(READY) | TO(INPUT_ASSIGN_RFID) | STATE_ANY_STOP,
+			true, true, false, nullptr },
+		{ "INPUT_ASSIGN_RFID", TO(READY) | TO(READ_ASSIGN_RFID) | STATE_ANY_STOP,
+			true, true, false, nullptr },
+		{ "READ_ASSIGN_RFID", TO(READY) | STATE_ANY_STOP,
+			false, true, false, nullptr },
+		{ "BUSY", TO(READY) | TO(NO_INTERNET) | STATE_ANY_STOP,
+			false, true, false, nullptr },
+		{ "ERROR", TO(STOPPING), false, false, false, nullptr },
+		{ "STOPPING", TO(STOPPED), false, false, false, nullptr },
+		{ "STOPPED", 0, false, false, false, nullptr }
+	};
+	///Number of states
+	const int count = sizeof(table) / sizeof(table[0]);
+
 	char assignRfidPin[] = "----";
 
 	//Application state
-	State state = State::PRE_INIT;
+	std::atomic<State> state(State::PRE_INIT);
 
 	//Network
-	bool haveEthernet = false;
-	bool haveWifi = false;
-	bool didTriggerShutdown = false;
+	std::atomic<bool> haveEthernet(false);
+	std::atomic<bool> haveWifi(false);
+	std::atomic<bool> didTriggerShutdown(false);
+
+	///Serializes transitions, and guards the listeners
+	std::mutex transitionLock;
+	///Subscribed listeners
+	Listener listeners[STATE_MAX_LISTENERS];
+	void* listenerCtx[STATE_MAX_LISTENERS];
+	int listenerCount = 0;
 
-	void changeState(State s) {
-		//Print the state change
-		printf(INFO "State changed to %s\n", getName(s));
+	/*!	Check whether the table allows a transition.
+	 */
+	bool canChange(State from, State to) {
+		if(from < 0 || from >= count || to < 0 || to >= count) {
+			return false;
+		}
+		return from == to || (table[from].next & TO(to)) != 0;
+	}
+
+	/*!	Change the state.
+	 *
+	 * 	Can be called from any thread.  Transitions the table doesn't allow
+	 * 	are refused and logged.
+	 *
+	 * 	@returns	@p false if the transition was refused
+	 */
+	bool changeState(State s) {
+		std::lock_guard<std::mutex> lock(transitionLock);
+		State from = state.load();
+		if(!canChange(from, s)) {
+			Log::warn("Refused state change from %s to %s\n", getName(from),
+				getName(s));
+			return false;
+		}
+		if(from != s) {
+			//Print the state change
+			Log::info("State changed to %s\n", getName(s));
+		}
 		//Change the state
 		state = s;
 
-		//Check for state specific handlers
-		if(s == READY) {
-			//Display the ready text
-			LCD::writeMessage("     Ready!     ", 0, 0);
+		//Display the state's message, under any greeting that is still up
+		if(table[s].message != nullptr) {
+			Screen::show(Screen::MESSAGE, table[s].message);
 		}
-		if (s == NO_INTERNET) {
-			LCD::writeMessage("No connection   ", 0, 0);
+
+		if(from != s) {
+			for(int i = 0; i < listenerCount; i++) {
+				listeners[i](from, s, listenerCtx[i]);
+			}
 		}
+		return true;
+	}
+
+	/*!	Subscribe to state changes.
+	 *
+	 * 	@returns	@p false if there are too many listeners already
+	 */
+	bool subscribe(Listener listener, void* ctx) {
+		std::lock_guard<std::mutex> lock(transitionLock);
+		if(listenerCount >= STATE_MAX_LISTENERS) {
+			return false;
+		}
+		listeners[listenerCount] = listener;
+		listenerCtx[listenerCount] = ctx;
+		listenerCount++;
+		return true;
+	}
+
+	/*!	Check whether key presses are handled in a state.
+	 */
+	bool takesKeys(State s) {
+		return s >= 0 && s < count && table[s].keys;
+	}
+
+	/*!	Check whether card taps are handled in a state.
+	 */
+	bool takesCards(State s) {
+		return s >= 0 && s < count && table[s].cards;
+	}
+
+	/*!	Check whether the clock is shown in a state.
+	 */
+	bool showsClock(State s) {
+		return s >= 0 && s < count && table[s].clock;
 	}
 
-	char* getName(State state) {
+	const char* getName(State state) {
 		//Return the name
-		switch (state) {
-		case PRE_INIT: return "PRE_INIT";
-		case INIT: return "INIT";
-		case NO_INTERNET: return "NO_INTERNET";
-		case READY: return "READY";
-		case INPUT: return "INPUT";
-		case INPUT_ASSIGN_RFID: return "INPUT_ASSIGN_RFID";
-		case READ_ASSIGN_RFID: return "READ_ASSIGN_RFID";
-		case BUSY: return "BUSY";
-		case ERROR: return "ERROR";
-		case STOPPING: return "STOPPING";
-		case STOPPED: return "STOPPED";
-		default: return "UNKNOWN STATE";
+		if(state < 0 || state >= count) {
+			return "UNKNOWN STATE";
 		}
+		return table[state].name;
 	}
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 namespace State {
 
 	enum State {
@@ -16,13 +18,26 @@ namespace State {
 		STOPPED
 	};
 
-	extern State state;
-	extern bool haveEthernet;
-	extern bool haveWifi;
-	extern bool didTriggerShutdown;
+	/*!	State change listener.
+	 *
+	 * 	Called with the old and new state after every transition, on the
+	 * 	thread that made it, while transitions are locked out, so it must be
+	 * 	quick and must not change the state itself.
+	 */
+	typedef void (*Listener)(State from, State to, void* ctx);
+
+	extern std::atomic<State> state;
+	extern std::atomic<bool> haveEthernet;
+	extern std::atomic<bool> haveWifi;
+	extern std::atomic<bool> didTriggerShutdown;
 
-	void changeState(State);
-	char* getName(State);
+	bool changeState(State);
+	bool canChange(State from, State to);
+	bool subscribe(Listener, void* ctx);
+	bool takesKeys(State);
+	bool takesCards(State);
+	bool showsClock(State);
+	const char* getName(State);
 
 	extern char assignRfidPin[];
 }
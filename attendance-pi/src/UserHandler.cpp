@@ -1,23 +1,49 @@
 #include "vs-intellisense-fix.hpp"
 
+#include "Log.h"
 #include "ANSI.h"
 #include "json.hpp"
 #include "UserHandler.h"
 #include "Utils.h"
+#include "Screen.h"
 #include "LCD.h"
 #include "Buzzer.h"
 #include "State.h"
+#include "Sender.h"
+#include "Http.h"
+#include "RosterParser.h"
+#include "Roster.h"
+#include "Metrics.h"
+#include "Gossip.h"
+#include "NetMonitor.h"
+#include "Health.h"
+#include "Reactor.h"
 
 #include <stdio.h>
-#include <curl/curl.h>
+#include <stdexcept>
 #include <unordered_map>
+#include <memory>
+#include <atomic>
 #include <cstring>
 #include <unistd.h>
-#include <thread>
 #include <mutex>
-#include <condition_variable>
-#include <chrono>
 #include <ctime>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+///Age in seconds after which a server reply is too late to show on screen
+#define STALE_RESPONSE_AGE	5
+///Default location of the user snapshot, relative to the working directory
+#define SNAPSHOT_DEFAULT_FILE	"roster.bin"
+///First four bytes of every snapshot file
+#define SNAPSHOT_MAGIC			"ATRS"
+///Layout of the snapshot file, bumped whenever it changes
+#define SNAPSHOT_FORMAT			3
 
 /*!	@section mod_init	Module Initialization
  *
@@ -34,79 +60,346 @@
  *
  * 	The trigger method is called whenever a user signs in by RFID or by
  * 	entering their PIN into the keypad.  This method displays a message
- * 	confirming the user has signed in or out, then sends a request to the
- * 	server informing it that the user has signed in.
+ * 	confirming the user has signed in or out, tells any other kiosks on the
+ * 	LAN through Gossip, then hands a request to the Sender, which informs
+ * 	the server in the background.
+ *
+ * 	@section snapshots	User Table Snapshots
+ *
+ * 	Taps are handled on the RFID and Keypad threads while updates run on
+ * 	whichever thread asked for them, so the user table is never changed in
+ * 	place.  Instead, a change builds a complete new table off to the side
+ * 	and then publishes it with a single atomic pointer swap.  A tap takes a
+ * 	reference to whichever table is published at the time and uses it until
+ * 	it is done, so it never waits for an update, even one that is halfway
+ * 	through parsing the server's reply.  The old table is freed once the
+ * 	last tap using it lets go.
+ *
+ * 	The sign in flags are the one exception: they are a bitset of atomic
+ * 	words, and are flipped in place in the published table.  A tap that
+ * 	lands between an update's download and its publication is therefore
+ * 	lost from the new table, but the server's reply to that tap puts it
+ * 	right again.
+ *
+ * 	@section snapshot_file	Snapshot File
+ *
+ * 	Every table received from the server is also saved to the file named by
+ * 	@p ROSTER_SNAPSHOT, or @p roster.bin by default, and the table is saved
+ * 	once more on shutdown to keep the latest sign in states.  On startup the
+ * 	file is mapped into memory and published straight away, so the kiosk is
+ * 	ready for taps before the network is even up; the first update then
+ * 	refreshes it in the background.
+ *
+ * 	The file starts with a @p SnapshotHeader holding a magic number, the
+ * 	format version and the server's table version, followed by one
+ * 	fixed-width @p SnapshotRecord per user and then a block holding all of
+ * 	the names.  The records hold the PIN, the binary card UID and the
+ * 	weekly hours inline and refer to their names by offset and length, and
+ * 	everything is in the Pi's own byte order.
+ *
+ * 	@section roster_store	User Table Layout
+ *
+ * 	A table is a Roster, which keeps every user in a single allocation:
+ * 	fixed-width entries with the PIN and UID inline, the names in one arena,
+ * 	the sign in flags as a packed bitset and the PIN and UID indexes as flat
+ * 	hash tables.  Updates add each user to a Roster::Builder straight from
+ * 	the decoder, so nothing is copied through temporary user objects on the
+ * 	way.  Only 4 digit PINs fit, which is all the keypad can type, so users
+ * 	with any other PIN are left out with a warning.
+ *
+ * 	@section weekly_hours	Weekly Hours
+ *
+ * 	Each user's time signed in this week is kept on the kiosk, so it can be
+ * 	shown when they sign out, as in "Goodbye Alex 12.5h", without asking the
+ * 	server.  The user list carries a summary for each user: @p week, the
+ * 	seconds of their sessions closed since Monday, and @p since, when their
+ * 	open session began.  From then on every sign in opens a session in the
+ * 	user's entry and every sign out closes it and adds it to the total, in
+ * 	constant time, whether it happened here, at another kiosk or in a
+ * 	correction from the server.  The totals are kept in the snapshot file
+ * 	too, and the next update from the server puts right anything the kiosk
+ * 	missed.  A server that sends no summary leaves the kiosk counting only
+ * 	what it has seen itself, and nothing is shown until there is something
+ * 	to show.
  *
  */
 namespace UserHandler {
 
-	//CURL object
-	CURL* curl;
-
-	//User object
-	class User {
-		public:
-			//Variables
-			std::string fname;
-			std::string pin;
-			std::string rfid;
-			bool signedin;
-			//Constructor
-			User(std::string, std::string, std::string, bool);
-	};
-
 	//Periodic updating
-	std::thread updaterThread;
-	std::mutex m;
-	bool run = true;
-	std::condition_variable cv;
+	///Wall timer for the nightly update
+	int nightly = -1;
+	///When the nightly update is due
+	std::time_t nightlyAt = 0;
+	///Whether an update asked for by requestUpdate() is waiting for the worker
+	std::atomic<bool> pullRequested(false);
+
+	/*!	Set the nightly timer for the next 3am.
+	 */
+	void armNightly() {
+		// get current time
+		time_t currentTs;
+		time(&currentTs);
+		tm* currentTime = localtime(&currentTs);
+		// add one day to current time, then set it to 3am
+		currentTime->tm_mday++;
+		currentTime->tm_hour = 3;
+		currentTime->tm_min = 0;
+		currentTime->tm_sec = 0;
+		nightlyAt = mktime(currentTime);
+		Reactor::armAt(nightly, nightlyAt);
+	}
 
 	//Periodic update function
 	//this should run every day after the backend resets signed in users
-	void periodicUpdateThread() {
-		std::unique_lock<std::mutex> lk(m);
-		while (run) {
-			// get current time
-			time_t currentTs;
-			time(&currentTs);
-			tm* currentTime = localtime(&currentTs);
-			// add one day to current time, then set it to 3am
-			currentTime->tm_mday++;
-			currentTime->tm_hour = 3;
-			currentTime->tm_min = 0;
-			currentTime->tm_sec = 0;
-			time_t next = mktime(currentTime);
-			// wait until it's 3am
-			auto tp = std::chrono::system_clock::from_time_t(next);
-			cv.wait_until(lk, tp);
-			if (run) {
-				printf(INFO "Updating local database...\n");
-				State::changeState(State::BUSY);
-				update();
-				State::changeState(State::READY);
-			} // else we were rudely awakened by shutdown
+	void nightlyUpdate(void* ctx) {
+		Log::info("Updating local database...\n");
+		//Only take over the display if nobody is using it
+		bool busy = State::changeState(State::BUSY);
+		update();
+		if(busy) {
+			State::changeState(State::READY);
 		}
 	}
 
-	/*! User object constructor
+	/*!	Nightly timer handler.
 	 *
-	 * 	This constructs a new user object with the provided user information.
+	 * 	Runs on the reactor thread at 3am, or when the clock is set, in which
+	 * 	case 3am may not have come yet.
+	 */
+	void nightlyTick(uint32_t events, void* ctx) {
+		if(std::time(0) >= nightlyAt) {
+			Reactor::defer(nightlyUpdate, nullptr);
+			armNightly();
+		} else {
+			Reactor::armAt(nightly, nightlyAt);
+		}
+	}
+
+	/*!	Background update job for requestUpdate().
 	 */
-	User::User(std::string fnamex, std::string pinx, std::string rfidx,
-			bool signedinx) {
-		//Save the values
-		this->fname = std::string(fnamex);
-		this->pin = std::string(pinx);
-		this->rfid = std::string(rfidx);
-		this->signedin = signedinx;
-		//printf("%s\t%s\t%s\n",
-		//		fnamex.c_str(), pinx.c_str(), rfidx.c_str());
-		//printf("%s\t%s\t%s\n",
-		//		this->fname.c_str(), this->pin.c_str(), this->rfid.c_str());
+	void pullUpdate(void* ctx) {
+		//Catch up in the background without touching the display
+		pullRequested = false;
+		if(NetMonitor::connected() && !update()) {
+			Health::reportFailure();
+		}
 	}
 
-	//Users
-	std::vector<User> users;
+	/*!	Update job for reload().
+	 */
+	void reloadUpdate(void* ctx) {
+		//Hold the display like the nightly update, unless someone took it
+		bool busy = State::changeState(State::BUSY);
+		if(update()) {
+			Screen::clear(Screen::MESSAGE, Screen::NORMAL);
+		} else {
+			Utils::showRequestError();
+		}
+		if(busy) {
+			State::changeState(State::READY);
+		}
+	}
+
+	/*!	Published user table.
+	 *
+	 * 	This must only be accessed through @p current() and @p publish().
+	 */
+	std::shared_ptr<const Roster> roster = std::make_shared<Roster>();
+	///Serializes changes to the published user table
+	std::mutex writeLock;
+	///Serializes updates from the server
+	std::mutex updateLock;
+
+	///ETag of the last user table received from the server
+	std::string rosterEtag;
+	///Version of the last user table received, or 0 if the server has none
+	long rosterVersion = 0;
+
+	/*!	Get the published user table.
+	 *
+	 * 	The returned snapshot stays valid for as long as the caller holds on
+	 * 	to it, even if a newer one is published in the meantime.  This never
+	 * 	waits for an update in progress.
+	 */
+	std::shared_ptr<const Roster> current() {
+		return std::atomic_load(&roster);
+	}
+
+	/*!	Publish a new user table.
+	 *
+	 * 	The caller must hold @p writeLock.
+	 */
+	void publish(const std::shared_ptr<Roster>& fresh) {
+		Metrics::set(Metrics::ROSTER_USERS, fresh->size());
+		Metrics::set(Metrics::ROSTER_SIGNED_IN, fresh->countSignedIn());
+		std::atomic_store(&roster, std::shared_ptr<const Roster>(fresh));
+	}
+
+	/**
+	 * Snapshot file header
+	 * magic: Always @p SNAPSHOT_MAGIC
+	 * format: Layout of the rest of the file, @p SNAPSHOT_FORMAT
+	 * version: Version of the user table, as sent by the server
+	 * count: Number of user records following the header
+	 * nameBytes: Size of the name block following the records
+	 */
+	struct SnapshotHeader {
+		char magic[4];
+		uint32_t format;
+		int64_t version;
+		uint32_t count;
+		uint32_t nameBytes;
+	};
+
+	/**
+	 * Snapshot user record, the name is an offset into the name block
+	 */
+	struct SnapshotRecord {
+		uint8_t rfid[CARD_ID_MAX_BYTES];
+		uint8_t rfidLength;
+		uint8_t signedin;
+		char pin[ROSTER_PIN_LENGTH];
+		uint32_t name;
+		uint32_t nameLength;
+		uint64_t hours;
+	};
+
+	static_assert(sizeof(SnapshotHeader) == 24, "Snapshot header must be packed");
+	static_assert(sizeof(SnapshotRecord) == 32, "Snapshot record must be packed");
+
+	/*!	Get the location of the snapshot file.
+	 */
+	std::string snapshotPath() {
+		const char* path = getenv("ROSTER_SNAPSHOT");
+		return path == nullptr ? SNAPSHOT_DEFAULT_FILE : path;
+	}
+
+	/*!	Snapshot writer
+	 *
+	 * 	This method saves the given user table to the snapshot file so the
+	 * 	next run can start with it.  The file is written to the side and
+	 * 	renamed into place, so a power cut never leaves half a snapshot.
+	 */
+	void saveSnapshot(const Roster& saved) {
+		SnapshotHeader header;
+		memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+		header.format = SNAPSHOT_FORMAT;
+		header.version = rosterVersion;
+		header.count = (uint32_t) saved.size();
+		//Lay out the records and names
+		std::vector<SnapshotRecord> records(saved.size());
+		std::string block;
+		block.reserve(saved.nameBytes());
+		for(size_t i = 0; i < saved.size(); i++) {
+			SnapshotRecord& record = records[i];
+			memset(&record, 0, sizeof(record));
+			const CardId& rfid = saved.rfid(i);
+			record.rfidLength = (uint8_t) rfid.length();
+			for(size_t b = 0; b < rfid.length(); b++) {
+				record.rfid[b] = rfid.byte(b);
+			}
+			record.signedin = saved.signedIn(i) ? 1 : 0;
+			record.hours = saved.hours(i);
+			memcpy(record.pin, saved.pin(i).data(), ROSTER_PIN_LENGTH);
+			const char* name = saved.name(i);
+			record.name = (uint32_t) block.size();
+			record.nameLength = (uint32_t) strlen(name);
+			block.append(name, record.nameLength);
+		}
+		header.nameBytes = (uint32_t) block.size();
+
+		std::string path = snapshotPath();
+		std::string tmp = path + ".tmp";
+		int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(fd < 0) {
+			Log::warn("Failed to open %s\n", tmp.c_str());
+			return;
+		}
+		size_t recordBytes = records.size() * sizeof(SnapshotRecord);
+		bool ok =
+			write(fd, &header, sizeof(header)) == (ssize_t) sizeof(header) &&
+			(recordBytes == 0 || write(fd, records.data(), recordBytes) ==
+				(ssize_t) recordBytes) &&
+			(block.empty() || write(fd, block.data(), block.size()) ==
+				(ssize_t) block.size());
+		ok = fdatasync(fd) == 0 && ok;
+		close(fd);
+		if(!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+			Log::warn("Failed to save the users to %s\n", path.c_str());
+			unlink(tmp.c_str());
+		}
+	}
+
+	/*!	Snapshot reader
+	 *
+	 * 	This method maps the snapshot file left by the last run and publishes
+	 * 	the user table it holds, along with the version the server gave it,
+	 * 	so the next update only downloads what changed since.  Nothing is
+	 * 	published if the file is missing, from another format, or damaged in
+	 * 	any way.  The caller must hold the update lock.
+	 *
+	 * 	@returns	@p true if a user table was restored
+	 */
+	bool loadSnapshot() {
+		std::string path = snapshotPath();
+		int fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if(fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(SnapshotHeader)) {
+			close(fd);
+			return false;
+		}
+		size_t size = (size_t) st.st_size;
+		void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(map == MAP_FAILED) {
+			return false;
+		}
+
+		const char* base = (const char*) map;
+		const SnapshotHeader* header = (const SnapshotHeader*) base;
+		const SnapshotRecord* records =
+			(const SnapshotRecord*) (base + sizeof(SnapshotHeader));
+		const char* block = base + sizeof(SnapshotHeader) +
+			(size_t) header->count * sizeof(SnapshotRecord);
+		//Check the file is what it claims to be before trusting any offsets
+		bool valid = memcmp(header->magic, SNAPSHOT_MAGIC, 4) == 0 &&
+			header->format == SNAPSHOT_FORMAT &&
+			header->count <= (size - sizeof(SnapshotHeader)) /
+				sizeof(SnapshotRecord) &&
+			size == sizeof(SnapshotHeader) +
+				(size_t) header->count * sizeof(SnapshotRecord) +
+				header->nameBytes;
+		Roster::Builder builder;
+		if(valid) {
+			builder.reserve(header->count, header->nameBytes);
+		}
+		for(uint32_t i = 0; valid && i < header->count; i++) {
+			const SnapshotRecord& r = records[i];
+			valid = (size_t) r.name + r.nameLength <= header->nameBytes &&
+				r.rfidLength <= CARD_ID_MAX_BYTES &&
+				builder.add(block + r.name, r.nameLength, r.pin,
+					ROSTER_PIN_LENGTH, CardId(r.rfid, r.rfidLength),
+					r.signedin != 0, r.hours);
+		}
+		long version = valid ? (long) header->version : 0;
+		munmap(map, size);
+		if(!valid) {
+			Log::warn("Ignoring damaged user snapshot %s\n", path.c_str());
+			return false;
+		}
+
+		std::shared_ptr<Roster> fresh = builder.build();
+		std::lock_guard<std::mutex> lock(writeLock);
+		publish(fresh);
+		//The next update only asks for what changed since
+		rosterVersion = version;
+		Log::info("Restored %i users (version %li) from %s\n",
+			(int) fresh->size(), version, path.c_str());
+		return true;
+	}
 
 	// I would remove this, but I know that as soon as I do the issue will
 	// come back to seek revenge.
@@ -135,10 +428,14 @@ namespace UserHandler {
 		printf(LOADING "Initializing User Handler...");
 		fflush(stdout);
 
-		//Perform global CURL initialization
-		curl_global_init(CURL_GLOBAL_SSL);
-
-		updaterThread = std::thread(periodicUpdateThread);
+		//Come back at 3am
+		try {
+			nightly = Reactor::wallTimer(nightlyTick, nullptr);
+		} catch(const std::exception& e) {
+			printf("\r[" RED "FAIL\n" RESET);
+			throw;
+		}
+		armNightly();
 
 		//Success
 		printf(OKAY "\n");
@@ -155,230 +452,490 @@ namespace UserHandler {
 		printf(LOADING "Destroy User Handler...");
 		fflush(stdout);
 
-		run = false;
-		cv.notify_one();
-		updaterThread.join();
-		curl_global_cleanup();
+		Reactor::remove(nightly);
+
+		//Keep the latest sign in states for the next run
+		{
+			std::lock_guard<std::mutex> lock(updateLock);
+			std::shared_ptr<const Roster> last = current();
+			if(last->size() > 0) {
+				saveSnapshot(*last);
+			}
+		}
 
 		//Success
 		printf(OKAY "\n");
 	}
 
-	/*!	User Handler update table method
+	/*!	User table restore method
 	 *
-	 * 	This method sends a request to the server to retrieve an updated user
-	 * 	information table, which it then decodes and stores in memory.
+	 * 	This method loads the user table saved by the last run, so taps can be
+	 * 	handled before the server has been reached.  The sign in states it
+	 * 	holds may be out of date, which the next update() puts right.
+	 *
+	 * 	@returns	@p true if a user table was restored
 	 */
-	bool update() {
+	bool restore() {
+		std::lock_guard<std::mutex> lock(updateLock);
+		return loadSnapshot();
+	}
+
+	/**
+	 * What the streaming decoder has collected so far
+	 * users: The users in the list, in order
+	 * removed: The PINs in the removed list, if any
+	 */
+	struct Download {
+		Roster::Builder users;
+		std::unordered_map<std::string, bool> removed;
+	};
+
+	/*!	User record decoder callback
+	 *
+	 * 	This method adds one element of the user list to the new table as
+	 * 	soon as the decoder has read it.
+	 */
+	void onUser(const RosterParser::Record& record, void* context) {
+		Download* download = (Download*) context;
+		if(record.pin.empty()) {
+			Log::warn("Ignoring a user without a PIN\n");
+			return;
+		}
+		//Users without a tag have an empty uid
+		CardId rfid;
+		CardId::fromHex(record.rfid.c_str(), rfid);
+		RosterHours hours = Roster::makeHours(record.week,
+			record.signedin ? record.since : 0, std::time(0));
+		if(!download->users.add(record.fname.data(), record.fname.size(),
+				record.pin.data(), record.pin.size(), rfid, record.signedin,
+				hours)) {
+			Log::warn("Ignoring %s, whose PIN is not %d digits\n",
+				record.fname.c_str(), ROSTER_PIN_LENGTH);
+		}
+	}
+
+	/*!	Removed user decoder callback
+	 */
+	void onRemoved(const std::string& pin, void* context) {
+		((Download*) context)->removed[pin] = true;
+	}
+
+	/*!	Response body callback
+	 *
+	 * 	Passes each piece of the body to the decoder as curl receives it.
+	 */
+	bool onBody(const char* data, size_t length, void* context) {
+		Metrics::add(Metrics::ROSTER_BYTES, length);
+		return ((RosterParser*) context)->feed(data, length);
+	}
+
+	/*!	User table replacement method
+	 *
+	 * 	This method publishes a new user table holding the given users in
+	 * 	place of the current one.
+	 */
+	void applyFull(Roster::Builder& users) {
+		//Build everything off to the side
+		std::shared_ptr<Roster> fresh = users.build();
+		//Swap it in
+		std::lock_guard<std::mutex> lock(writeLock);
+		publish(fresh);
+	}
+
+	/*!	User table delta method
+	 *
+	 * 	This method applies a list of changed users and a set of removed PINs
+	 * 	to a copy of the current user table, and publishes the copy.  Changed
+	 * 	users replace the user with the same PIN, or are added if there is
+	 * 	none.
+	 */
+	void applyDelta(const Roster& updates,
+			const std::unordered_map<std::string, bool>& gone) {
+		std::lock_guard<std::mutex> lock(writeLock);
+		std::shared_ptr<const Roster> old = current();
+		Roster::Builder builder;
+		builder.reserve(old->size() + updates.size(),
+			old->nameBytes() + updates.nameBytes());
+		//Copy everyone but the removed users, replacing the changed ones
+		std::vector<bool> placed(updates.size(), false);
+		for(size_t i = 0; i < old->size(); i++) {
+			std::string pin = old->pin(i);
+			if(gone.find(pin) != gone.end()) {
+				continue;
+			}
+			size_t changed = updates.findByPin(pin);
+			if(changed != ROSTER_NONE && !placed[changed]) {
+				builder.copy(updates, changed);
+				placed[changed] = true;
+			} else {
+				builder.copy(*old, i);
+			}
+		}
+		//Add the new users on the end
+		for(size_t i = 0; i < updates.size(); i++) {
+			if(!placed[i]) {
+				builder.copy(updates, i);
+			}
+		}
+		publish(builder.build());
+	}
+
+	/*!	User list download method
+	 *
+	 * 	This method does the work of update(), which holds the update lock.
+	 */
+	bool fetch() {
 		//Create the request
 		std::string url = getenv("API_BASEURL");
 		url += getenv("API_LISTUSERS");
-		//Send a get request
-		nlohmann::json json = Utils::jsonGetRequest(url.c_str());
-		if (!Utils::jsonGetRequestSuccess()) {
+		if(rosterVersion > 0) {
+			url += "?since=" + std::to_string(rosterVersion);
+		}
+		//Send a get request, decoding the body as it comes in
+		Download download;
+		RosterParser parser(onUser, onRemoved, &download);
+		Http::Response resp;
+		CURLcode result = Http::stream(url.c_str(), resp, onBody, &parser,
+			rosterEtag);
+		//Check if anything has changed
+		if(result == CURLE_OK && resp.status == 304) {
+			Log::info("User table is already up to date\n");
+			return true;
+		}
+		if(result == CURLE_OK && (resp.status < 200 || resp.status >= 300)) {
+			Log::warn("Server answered %li while updating the users\n",
+				resp.status);
+		} else if(result == CURLE_WRITE_ERROR || (result == CURLE_OK &&
+				!parser.finish())) {
+			Log::warn("Failed to decode the users: %s\n", parser.error());
+		} else if(result != CURLE_OK) {
+			Log::warn("CURL error %i while updating the users\n", result);
 			return false;
+		} else {
+			if(parser.isDelta()) {
+				//Only what changed since our version
+				size_t changed = download.users.size();
+				applyDelta(*download.users.build(), download.removed);
+				Log::info("Applied %i changed and %i removed users\n",
+					(int) changed, (int) download.removed.size());
+			} else {
+				//List of every user
+				applyFull(download.users);
+			}
+			rosterVersion = parser.version();
+			rosterEtag = resp.etag;
+			saveSnapshot(*current());
+			return true;
 		}
-		//Remove existing user records
-		users.clear();
-		//Iterate the elements in the response
-		for(int i = 0; i < json.size(); i++) {
-			//Get the object
-			nlohmann::json element = json[i];
-			//Get the user properties
-			std::string fname = element["fname"].get<std::string>();
-			std::string pin = element["pin"].get<std::string>();
-			std::string rfid = element["rfid"].get<std::string>();
-			bool signedin = element["signedin"].get<bool>();
-			//Create the user object
-			User* user = new User(fname, pin, rfid, signedin);
-			//Push the user into the vector
-			users.push_back(*user);
+		//Start over with a full download next time
+		rosterEtag.clear();
+		rosterVersion = 0;
+		return false;
+	}
+
+	/*!	User Handler update table method
+	 *
+	 * 	This method sends a request to the server to retrieve an updated user
+	 * 	information table, which it then decodes and stores in memory.
+	 *
+	 * 	To avoid downloading the whole table every time, the request carries
+	 * 	the ETag of the last table received in an @p If-None-Match header, and
+	 * 	the version of that table in a @p since parameter.  The server may
+	 * 	answer in any of three ways:
+	 *
+	 * 	- @p 304 Not Modified, if nothing has changed;
+	 * 	- A plain array of users, which replaces the local table;
+	 * 	- An object of the form
+	 * 	  <tt>{"version": N, "full": false, "users": [...], "removed": [...]}</tt>,
+	 * 	  where @p users holds the users added or changed since the requested
+	 * 	  version and @p removed the PINs of the users deleted since then.  If
+	 * 	  @p full is true, @p users is the complete table instead.
+	 *
+	 * 	A server that knows nothing about any of this simply keeps sending the
+	 * 	full array, which works as it always has.
+	 *
+	 * 	The reply is decoded by a RosterParser as it arrives, so users are
+	 * 	built while the rest of the list is still on its way and the body is
+	 * 	never held in memory as a whole.
+	 *
+	 * 	Failures are only logged, since most updates run in the background
+	 * 	with nobody watching.  Callers that someone is waiting on tell them
+	 * 	with Utils::showRequestError().
+	 */
+	bool update() {
+		//Only one update at a time, taps don't care
+		std::lock_guard<std::mutex> lock(updateLock);
+		uint64_t start = Metrics::now();
+		bool success = fetch();
+		Metrics::since(Metrics::ROSTER_SYNC, start);
+		if(!success) {
+			Metrics::add(Metrics::ROSTER_SYNC_FAILURES);
 		}
-		return true;
+		return success;
+	}
+
+	/*!	Weekly hours tracking method
+	 *
+	 * 	This method opens or closes the user's session to match a change of
+	 * 	their sign in state at @p when.
+	 *
+	 * 	@returns	The seconds they have been signed in this week, counted up
+	 * 		to the end of the session if it was closed
+	 */
+	long track(const Roster& users, size_t user, bool signedin,
+			std::time_t when) {
+		if(signedin) {
+			users.openSession(user, when);
+			return users.weekSeconds(user, when);
+		}
+		return users.closeSession(user, when);
+	}
+
+	/*!	Local sign in/out method
+	 *
+	 * 	This method flips the local sign in state of the given user and greets
+	 * 	them on the display, with their hours this week when they leave.  The
+	 * 	server is told about it afterwards by the Sender, and any disagreement
+	 * 	is corrected in @p applyResponse().
+	 *
+	 * 	@returns	Whether the user is now signed in
+	 */
+	bool toggle(const Roster& users, size_t user) {
+		//Message to show to the user
+		std::string message = "";
+		//Change the local state
+		bool signedin = !users.toggle(user);
+		Metrics::set(Metrics::ROSTER_SIGNED_IN, users.countSignedIn());
+		long seconds = track(users, user, !signedin, std::time(0));
+		//Check their status
+		if(signedin) {
+			//This is goodbye :'(
+			message += "Goodbye ";
+		} else {
+			//This is hello :D
+			message += "Hello ";
+		}
+		//Add the users name
+		message.append(users.name(user));
+		//Add their time this week, cutting the name short to make room
+		if(signedin && seconds > 0) {
+			char hours[16];
+			snprintf(hours, sizeof(hours), " %.1fh", seconds / 3600.0);
+			size_t room = LCD_COLS - strlen(hours);
+			if(message.size() > room) {
+				message.resize(room);
+			}
+			message += hours;
+		}
+		//Show that message to their face, for a moment
+		Screen::show(Screen::MESSAGE, message, Screen::NORMAL,
+			SCREEN_MESSAGE_TIME);
+		//Print to console
+		Log::okay("%s has been %s\n", users.name(user),
+			signedin ? "signed out" : "signed in");
+		return !signedin;
 	}
 
 	/*!	Trigger by Pin method
 	 *
-	 * 	This method sends a request to sign the user specified by the given pin
-	 * 	in or out. If the user does not exist, such a situation is handled
-	 * 	accordingly.
+	 * 	This method signs the user specified by the given pin in or out and
+	 * 	queues a request informing the server. If the user does not exist, such
+	 * 	a situation is handled accordingly.
 	 */
 	void triggerPin(char* pin) {
 		//UserHandler::test(); <-- I'm afraid to remove this
 		//Try and find the user
-		for(int i = 0; i < users.size(); i++) {
-			//Check the pin
-			//The next 3 print statements might get angry if you delete them
-			//printf("Checking if this is %s whose ID is %s...\n", users[i].fname.c_str(), users[i].pin.c_str());
-			//printf("Comparing ID [%s] and [%s]\n", users[i].pin.c_str(), pin);
-			//printf("Result: %i\n", users[i].pin.compare(pin));
-			if(users[i].pin.compare(pin) == 0) {
-				//Message to show to the user
-				std::string message = "";
-				//Found the user, check their status
-				if(users[i].signedin) {
-					//This is goodbye :'(
-					message += "Goodbye ";
-					//Change the local state
-					users[i].signedin = false;
-				} else {
-					//This is hello :D
-					message += "Hello ";
-					//Change the local state
-					users[i].signedin = true;
-				}
-				//Add the users name
-				message.append(users[i].fname);
-				//Show that message to their face
-				LCD::writeMessage(message, 0, 0);
-				//Create the trigger url
-				std::ostringstream url;
-				url << getenv("API_BASEURL");
-				url << getenv("API_TRIGGER");
-				url << "?pin=";
-				url << pin;
-				//Send the request
-				nlohmann::json resp = Utils::jsonGetRequest(url.str().c_str());
-				bool signedin = resp["signed_in"].get<bool>();
-				std::string actualResponse = resp["message"].get<std::string>();
-				if (signedin != users[i].signedin) {
-					// uh oh, problem
-					users[i].signedin = signedin;
-					LCD::writeMessage("                ", 0, 0);
-					LCD::writeMessage(actualResponse, 0, 0);
-					Buzzer::buzz(100000);
-					usleep(100000);
-					Buzzer::buzz(100000);
-				}
-				//Print to console
-				printf(OKAY "%s has been %s\n", users[i].fname.c_str(),
-					users[i].signedin ? "signed out" : "signed in");
-				//Finished
-				return;
-			}
+		std::shared_ptr<const Roster> users = current();
+		size_t user = users->findByPin(pin);
+		if(user != ROSTER_NONE) {
+			bool signedin = toggle(*users, user);
+			//Tell the other kiosks, then the server
+			Gossip::announce(users->pin(user), signedin);
+			Sender::send({ Sender::TRIGGER_PIN, users->pin(user), "" });
+			//Finished
+			return;
 		}
 		//If the program reaches this point, there is no user with this pin
-		printf(FAIL "Pin %s does not belong to anyone!\n", pin);
-		LCD::writeMessage("Invalid PIN     ", 0, 0);
-		Buzzer::buzz(1000000);
-		//Change the state back to ready
-		State::changeState(State::READY);
+		Log::fail("Pin %s does not belong to anyone!\n", pin);
+		Screen::show(Screen::MESSAGE, "Invalid PIN", Screen::NORMAL,
+			SCREEN_MESSAGE_TIME);
+		Buzzer::play(Buzzer::ERROR);
 	}
 
 	/*!	Trigger by RFID method
 	 *
-	 * 	This method sends a request to sign the user specified by the given
-	 * 	rfid uid in or out. If the user does not exist, such a situation is
-	 * 	handled accordingly.
+	 * 	This method signs the user specified by the given rfid uid in or out
+	 * 	and queues a request informing the server. If the user does not exist,
+	 * 	such a situation is handled accordingly.  The server is sent the tag
+	 * 	the user has in the table, which for a tag stored by the old program
+	 * 	is only the first four bytes of the card.
 	 *
 	 * 	I wish there was a way to do this without the const, but it's not wroth
 	 * 	the effort :(
 	 */
-	void triggerRfid(const char* rfid) {
+	void triggerRfid(const CardId& rfid) {
 		//Try and find the user
-		for(int i = 0; i < users.size(); i++) {
-			//Check the pin
-			//The next 3 print statements might get angry if you delete them
-			//printf("Checking if this is %s whose ID is %s...\n", users[i].fname.c_str(), users[i].pin.c_str());
-			//printf("Comparing ID [%s] and [%s]\n", users[i].pin.c_str(), pin);
-			//printf("Result: %i\n", users[i].pin.compare(pin));
-			if(users[i].rfid.compare(rfid) == 0) {
-				//Message to show to the user
-				std::string message = "";
-				//Found the user, check their status
-				if(users[i].signedin) {
-					//This is goodbye :'(
-					message += "Goodbye ";
-					//Change the local state
-					users[i].signedin = false;
-				} else {
-					//This is hello :D
-					message += "Hello ";
-					//Change the local state
-					users[i].signedin = true;
-				}
-				//Add the users name
-				message.append(users[i].fname);
-				//Show that message to their face
-				LCD::writeMessage(message, 0, 0);
-				//Create the trigger url
-				std::ostringstream url;
-				url << getenv("API_BASEURL");
-				url << getenv("API_TRIGGER");
-				url << "?rfid=";
-				url << rfid;
-				//Send the request
-				nlohmann::json resp = Utils::jsonGetRequest(url.str().c_str());
-				bool signedin = resp["signed_in"].get<bool>();
-				std::string actualResponse = resp["message"].get<std::string>();
-				if (signedin != users[i].signedin) {
-					// uh oh, problem
-					users[i].signedin = signedin;
-					LCD::writeMessage("                ", 0, 0);
-					LCD::writeMessage(actualResponse, 0, 0);
-					Buzzer::buzz(100000);
-					usleep(100000);
-					Buzzer::buzz(100000);
-				}
-				//Print to console
-				printf(OKAY "%s has been %s\n", users[i].fname.c_str(),
-					users[i].signedin ? "signed in" : "signed out");
-				//Finished
-				return;
+		std::shared_ptr<const Roster> users = current();
+		uint64_t start = Metrics::now();
+		size_t user = users->findByRfid(rfid);
+		Metrics::since(Metrics::USER_LOOKUP, start);
+		char hex[CARD_ID_HEX_LENGTH];
+		rfid.toHex(hex);
+		if(user != ROSTER_NONE) {
+			bool signedin = toggle(*users, user);
+			//The server only knows a tag stored by the old program by its
+			//first four bytes, so send the tag the table matched
+			if(users->rfid(user) != rfid) {
+				users->rfid(user).toHex(hex);
+				Log::info("Card matched the old tag %s\n", hex);
 			}
+			//Tell the other kiosks, then the server
+			Gossip::announce(users->pin(user), signedin);
+			Sender::send({ Sender::TRIGGER_RFID, users->pin(user), hex });
+			//Finished
+			return;
 		}
 		//If the program reaches this point, there is no user with this pin
-		printf(FAIL "RFID %s does not belong to anyone!\n", rfid);
-		LCD::writeMessage("Invalid RFID    ", 0, 0);
-		Buzzer::buzz(1000000);
-		//Change the state back to ready
-		State::changeState(State::READY);
-
+		Log::fail("RFID %s does not belong to anyone!\n", hex);
+		Screen::show(Screen::MESSAGE, "Invalid RFID", Screen::NORMAL,
+			SCREEN_MESSAGE_TIME);
+		Buzzer::play(Buzzer::ERROR);
 	}
 
 	/*!	Assign RFID to PIN method
 	*
-	* 	This method sends a request to assign an RFID tag
-	*   to the user with the specified pin
+	* 	This method assigns an RFID tag to the user with the specified pin and
+	*   queues a request informing the server
 	*/
-	void assignRfidToPin(char* pin, const char* rfid) {
+	void assignRfidToPin(char* pin, const CardId& rfid) {
 		//Try and find the user
-		for (int i = 0; i < users.size(); i++) {
-			//Check the pin
-			//The next 3 print statements might get angry if you delete them
-			//printf("Checking if this is %s whose ID is %s...\n", users[i].fname.c_str(), users[i].pin.c_str());
-			//printf("Comparing ID [%s] and [%s]\n", users[i].pin.c_str(), pin);
-			//printf("Result: %i\n", users[i].pin.compare(pin));
-			if (users[i].pin.compare(pin) == 0) {
-				//Message to show to the user
-				std::string message = "Assigning tag...";
-				//Show that message to their face
-				LCD::writeMessage(message, 0, 0);
-				//Create the trigger url
-				std::ostringstream url;
-				url << getenv("API_BASEURL");
-				url << getenv("API_ASSIGN");
-				url << "?pin=";
-				url << pin;
-				url << "&rfid=";
-				url << rfid;
-				//Send the request TODO: Error checking
-				Utils::jsonGetRequest(url.str().c_str());
-				// update local db
-				users[i].rfid = std::string(rfid);
-				//Print to console
-				printf(OKAY "%s has been given rfid %s\n", users[i].fname.c_str(),
-					rfid);
-				//Finished
-				return;
+		std::unique_lock<std::mutex> lock(writeLock);
+		std::shared_ptr<const Roster> old = current();
+		size_t found = old->findByPin(pin);
+		if(found != ROSTER_NONE) {
+			//Message to show to the user
+			std::string message = "Assigning tag...";
+			//Show that message to their face
+			Screen::show(Screen::MESSAGE, message, Screen::NORMAL,
+				SCREEN_MESSAGE_TIME);
+			// update local db, taking the tag off anyone who had it before
+			Roster::Builder builder;
+			builder.reserve(old->size(), old->nameBytes());
+			for(size_t i = 0; i < old->size(); i++) {
+				if(i == found) {
+					builder.copy(*old, i, rfid);
+				} else if(old->rfid(i) == rfid) {
+					builder.copy(*old, i, CardId());
+				} else {
+					builder.copy(*old, i);
+				}
 			}
+			std::shared_ptr<Roster> fresh = builder.build();
+			publish(fresh);
+			lock.unlock();
+			char hex[CARD_ID_HEX_LENGTH];
+			rfid.toHex(hex);
+			//Tell the server TODO: Error checking
+			Sender::send({ Sender::ASSIGN_RFID, fresh->pin(found), hex });
+			//Print to console
+			Log::okay("%s has been given rfid %s\n", fresh->name(found),
+				hex);
+			//Finished
+			return;
 		}
+		lock.unlock();
 		//If the program reaches this point, there is no user with this pin
-		printf(FAIL "Pin %s does not belong to anyone!\n", pin);
-		LCD::writeMessage("     Invalid PIN", 0, 0);
-		Buzzer::buzz(1000000);
-		//Change the state back to ready
-		State::changeState(State::READY);
+		Log::fail("Pin %s does not belong to anyone!\n", pin);
+		Screen::show(Screen::MESSAGE, "     Invalid PIN", Screen::NORMAL,
+			SCREEN_MESSAGE_TIME);
+		Buzzer::play(Buzzer::ERROR);
+	}
+
+	/*!	Server response handler
+	 *
+	 * 	This method is called by the Sender once the server has replied to an
+	 * 	event.  If the server disagrees with the local idea of whether the user
+	 * 	is signed in, the server wins, and the user is told what actually
+	 * 	happened.  Replies to events replayed from the Journal long after the
+	 * 	fact are applied without bothering whoever is at the kiosk now.
+	 */
+	void applyResponse(const Sender::Event& event, nlohmann::json& resp) {
+		//Only sign in and out requests need to be checked
+		if(event.type == Sender::ASSIGN_RFID) {
+			return;
+		}
+		//Check that the request actually went through
+		if(resp.find("signed_in") == resp.end() ||
+				resp.find("message") == resp.end()) {
+			return;
+		}
+		//The user may have vanished in a roster update since the tap
+		std::shared_ptr<const Roster> users = current();
+		size_t user = users->findByPin(event.pin);
+		if(user == ROSTER_NONE) {
+			return;
+		}
+		bool signedin = resp["signed_in"].get<bool>();
+		std::string actualResponse = resp["message"].get<std::string>();
+		if (users->setSignedIn(user, signedin) != signedin) {
+			// uh oh, problem
+			Metrics::set(Metrics::ROSTER_SIGNED_IN, users->countSignedIn());
+			track(*users, user, signedin, event.time);
+			//Print to console
+			Log::warn("Server says %s is actually %s\n", users->name(user),
+				signedin ? "signed in" : "signed out");
+			//The other kiosks were told the wrong thing too
+			Gossip::announce(event.pin, signedin);
+			if(std::difftime(std::time(0), event.time) > STALE_RESPONSE_AGE) {
+				return;
+			}
+			Screen::show(Screen::MESSAGE, actualResponse, Screen::NORMAL,
+				SCREEN_MESSAGE_TIME);
+			Buzzer::play(Buzzer::MISMATCH);
+		}
+	}
+
+	/*!	Remote sign in/out method
+	 *
+	 * 	This method is called when another kiosk on the LAN says a user has
+	 * 	signed in or out there, and sets their local state to match without
+	 * 	greeting anyone.  The server is told by the kiosk they tapped at.
+	 */
+	void applyRemote(const std::string& pin, bool signedin) {
+		std::shared_ptr<const Roster> users = current();
+		size_t user = users->findByPin(pin);
+		if(user == ROSTER_NONE) {
+			return;
+		}
+		if(users->setSignedIn(user, signedin) != signedin) {
+			Metrics::set(Metrics::ROSTER_SIGNED_IN, users->countSignedIn());
+			track(*users, user, signedin, std::time(0));
+			Log::info("%s has been %s at another kiosk\n", users->name(user),
+				signedin ? "signed in" : "signed out");
+		}
+	}
+
+	/*!	Background update request method
+	 *
+	 * 	This method asks the reactor's worker to bring the user table up to
+	 * 	date from the server as soon as it can, and returns straight away.
+	 * 	Requests that arrive before it has started are folded into one.
+	 */
+	void requestUpdate() {
+		if(!pullRequested.exchange(true)) {
+			Reactor::defer(pullUpdate, nullptr);
+		}
+	}
+
+	/*!	Interactive update method
+	 *
+	 * 	This method asks the reactor's worker to bring the user table up to
+	 * 	date for someone at the kiosk, and returns straight away.  Unlike
+	 * 	requestUpdate(), the result is shown: the message line is cleared
+	 * 	once the table is loaded, or shows an error if it couldn't be.
+	 */
+	void reload() {
+		Reactor::defer(reloadUpdate, nullptr);
 	}
 
 }
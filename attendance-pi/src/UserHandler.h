@@ -1,12 +1,21 @@
 #pragma once
 
+#include "Sender.h"
+#include "CardId.h"
+#include "json.hpp"
+
 namespace UserHandler {
 
 	void init();
 	void destroy();
 
 	void triggerPin(char*);
-	void triggerRfid(const char*);
+	void triggerRfid(const CardId&);
+	bool restore();
 	bool update();
-	void assignRfidToPin(char* pin, const char* rfid);
+	void assignRfidToPin(char* pin, const CardId& rfid);
+	void applyResponse(const Sender::Event&, nlohmann::json&);
+	void applyRemote(const std::string& pin, bool signedin);
+	void requestUpdate();
+	void reload();
 }
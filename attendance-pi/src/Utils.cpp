@@ -1,319 +1,205 @@
 #include "Utils.h"
 #include "json.hpp"
+#include "Log.h"
 #include "ANSI.h"
 #include "Buzzer.h"
-#include "LCD.h"
+#include "Screen.h"
 #include "State.h"
+#include "Http.h"
+#include "NetMonitor.h"
 
-#include <curl/curl.h>
-#include <fstream>
+#include <sstream>
 #include <ctime>
 #include <vector>
 
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
-#include <ifaddrs.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <linux/wireless.h>
 #include <netinet/in.h>
-#include <arpa/inet.h>
 #include <errno.h>
 
 using namespace std;
 
+///Most lines of an error detail that are kept in the log
+#define UTILS_ERROR_LINES	8
+
 namespace Utils {
 
 	bool _jsonGetRequestSuccess = false;
 
-	/*! Checks an individual interface's status
-	 * 
-	 * @return A ConnectionState struct describing the status of the interface
+	/*! Samples the signal strength of a wireless interface
+	 *
+	 * @return The signal level in dBm, or -1 if the driver doesn't report it
 	 */
-	ConnectionState checkInterface(const char* ifname) {
-		ConnectionState connectionState;
-		connectionState.dBm = 0;
-		connectionState.connectionType = NO_CONNECTION;
-
+	unsigned char signalStrength(const char* ifname) {
 		int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
 		if (sock < 0) {
-			printf(WARN "socket() error: %d\n", errno);
-			return connectionState;
-		}
-
-		// first check if the interface is up
-		struct ifreq if_req = {};
-		strncpy(if_req.ifr_name, ifname, IFNAMSIZ);
-		int rv = ioctl(sock, SIOCGIFFLAGS, &if_req);
-
-		if (rv == -1) {
-			printf(WARN "ioctl() error: %d\n", errno);
-			close(sock);
-			return connectionState;
-		}
-
-		if (!((if_req.ifr_flags & IFF_UP) && (if_req.ifr_flags & IFF_RUNNING))) {
-			// it's not up
-			close(sock);
-			return connectionState;
+			Log::warn("socket() error: %d\n", errno);
+			return 0;
 		}
 
-		// then check what type of interface it is
+		unsigned char dBm = -1; // unknown
+		struct iw_statistics stats = {};
 		struct iwreq iw_req = {};
-		strncpy(iw_req.ifr_name, ifname, IFNAMSIZ);
-		if (ioctl(sock, SIOCGIWNAME, &iw_req) != -1) {
-			connectionState.connectionType = WIFI;
-
-			// check the signal strength
-			iw_req.u.data.pointer = (iw_statistics*) malloc(sizeof(iw_statistics));
-			iw_req.u.data.length = sizeof(iw_statistics);
-			if (ioctl(sock, SIOCGIWSTATS, &iw_req) == -1) {
-				printf(WARN "ioctl() error: %d\n", errno);
-			} else if (((iw_statistics*) iw_req.u.data.pointer)->qual.updated & IW_QUAL_DBM) {
-				// signal is measured in dBm and is valid for us to use
-				connectionState.dBm = ((iw_statistics*) iw_req.u.data.pointer)->qual.level /*- 256*/;
-			} else {
-				connectionState.dBm = -1; // unknown
-			}
-		} else {
-			connectionState.connectionType = ETHERNET;
+		strncpy(iw_req.ifr_name, ifname, IFNAMSIZ - 1);
+		iw_req.u.data.pointer = &stats;
+		iw_req.u.data.length = sizeof(stats);
+		if (ioctl(sock, SIOCGIWSTATS, &iw_req) == -1) {
+			Log::warn("ioctl() error: %d\n", errno);
+		} else if (stats.qual.updated & IW_QUAL_DBM) {
+			// signal is measured in dBm and is valid for us to use
+			dBm = stats.qual.level /*- 256*/;
 		}
 
 		close(sock);
 
-		return connectionState;
+		return dBm;
 	}
 
-	/*! Checks the status for all network interfaces that are up and running
+	/*! Gets the status of every network interface that is up and running
+	*
+	* The interfaces come from the network monitor's cache, only the Wi-Fi
+	* signal strength is sampled here.
 	*
 	* @return A vector of ConnectionState structs for each interface that is up and running
 	*/
 	std::vector<ConnectionState> getConnectionState() {
-		struct ifaddrs* ifaddr;
-		struct ifaddrs* ifa;
-		std::vector<ConnectionState> retval;
-
-		// find all interfaces
-		if (getifaddrs(&ifaddr) == -1) {
-			printf(WARN "getifaddrs() error\n");
-
-			return retval;
-		}
-
-		// check status of each interface
-		for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-			if (ifa->ifa_addr == NULL ||
-				ifa->ifa_addr->sa_family != AF_PACKET)
-				continue;
-
-			if (ifa->ifa_flags & IFF_LOOPBACK)
-				continue;
-
-			ConnectionState cs = checkInterface(ifa->ifa_name);
-			if (cs.connectionType != NO_CONNECTION) {
-				// this is a network that is up
-				struct ifreq ifr = {};
-				int fd = socket(AF_INET, SOCK_DGRAM, 0);
-				if (fd >= 0) {
-					ifr.ifr_addr.sa_family = AF_INET;
-					strncpy(ifr.ifr_name, ifa->ifa_name, IFNAMSIZ - 1);
-					int res = ioctl(fd, SIOCGIFADDR, &ifr);
-					if (res >= 0) {
-						cs.ip = inet_ntoa(((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr);
-					}
-					close(fd);
-				}
-				retval.push_back(cs);
+		std::vector<ConnectionState> retval = NetMonitor::connections();
+		for (size_t i = 0; i < retval.size(); i++) {
+			if (retval[i].connectionType == WIFI) {
+				retval[i].dBm = signalStrength(retval[i].name.c_str());
 			}
 		}
-
-		freeifaddrs(ifaddr);
-		
 		return retval;
 	}
 
-	//Get time prototype
-	string getTime();
-
-	/*! Request callback method
-	 *
-	 * 	This method passes data read by curl and passes it into the json
-	 * 	object for parsing.
-	 */
-	size_t curlParseCallback(char *ptr, size_t size, size_t nmemb,
-			string *string) {
-		//Get the real size
-		size_t realsize = size * nmemb;
-		//Convert into a string
-		std::string tempstring(ptr, size);
-		//Write the temp string to the json
-		string->append(ptr, realsize);
-		//Return the number of bytes taken care of
-		return realsize;
-	}
-
-	/*! JSON request object
+	/*! Quiet JSON request method
 	 *
 	 * 	This method sends a get request to the URL passed in @p url, and parses
-	 * 	the returned information as a json object, which it then returns.
+	 * 	the returned information as a json object into @p json.  Unlike
+	 * 	@p jsonGetRequest(), it does not tell the user about failures, which
+	 * 	makes it suitable for requests made in the background.
 	 *
 	 * 	@parameter url The URL to send the get request to, including parameters
+	 * 	@parameter json The object to store the decoded response in
+	 * 	@parameter body If given, JSON to post instead of making a get request
+	 * 	@parameter httpStatus If given, set to the HTTP status of the reply,
+	 * 		or 0 if there was none
 	 *
-	 * 	@returns The decoded json object
-	 *
-	 * 	@throws Probably throws something if such and such does a thing, but I
-	 * 			quite honestly have absolutely no idea.  Maybe someone else can
-	 * 			figure this out down the line and edit this comment so that I
-	 * 			don't look like a sleep deprived programmer, despite the fact
-	 * 			that that is the most accurate way to describe me currently.
+	 * 	@returns	@p REQUEST_OK on success, @p REQUEST_NO_CONNECTION if the
+	 * 		server could not be reached at all, which is worth retrying later,
+	 * 		@p REQUEST_TIMED_OUT if the request may have reached the server but
+	 * 		no reply came back, so it may or may not have been acted on,
+	 * 		@p REQUEST_SERVER_ERROR if the reply was a 5xx or 429 status, from
+	 * 		the server or a proxy in front of it, or @p REQUEST_BAD_RESPONSE
+	 * 		if the reply could not be decoded, such as an error page.  In the
+	 * 		last two cases the application may not have handled the request,
+	 * 		so they are worth retrying later as well.
 	 */
-	nlohmann::json jsonGetRequest(const char* url) {
+	RequestStatus jsonRequest(const char* url, nlohmann::json& json,
+			const std::string* body, long* httpStatus) {
 		//Server response
-		string response;
-		//Be prepared to catch errors here
+		Http::Response resp;
+		resp.status = 0;
+		string& response = resp.body;
+		//DEBUG
+		//printf("Sending request to %s...\n", url);
+		//Send the request over a pooled connection
+		CURLcode result = body == nullptr ? Http::get(url, resp) :
+			Http::post(url, *body, resp);
+		if (httpStatus != nullptr) {
+			*httpStatus = result == CURLE_OK ? resp.status : 0;
+		}
+		if (result != CURLE_OK) {
+			Log::warn("CURL error %i for %s\n", result, url);
+			return Http::outcome(result) == Http::NOT_SENT ?
+				REQUEST_NO_CONNECTION : REQUEST_TIMED_OUT;
+		}
+		//Overloaded, or failing, or a proxy that couldn't get through
+		if (resp.status >= 500 || resp.status == 429) {
+			Log::warn("HTTP status %ld for %s\n", resp.status, url);
+			return REQUEST_SERVER_ERROR;
+		}
+		//Decode the response
 		try {
-			//DEBUG
-			//printf("Sending request to %s...\n", url);
-			//Create the curl handle
-			CURL* chandle = curl_easy_init();
-			//Set the url
-			curl_easy_setopt(chandle, CURLOPT_URL, url);
-			//Set the callback
-			curl_easy_setopt(chandle, CURLOPT_WRITEFUNCTION,
-					Utils::curlParseCallback);
-			//Enable authentication
-			curl_easy_setopt(chandle, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-			//Set the username
-			curl_easy_setopt(chandle, CURLOPT_USERNAME, getenv("HTTP_USERNAME"));
-			//Set the password
-			curl_easy_setopt(chandle, CURLOPT_PASSWORD, getenv("HTTP_PASSWORD"));
-			//Tell curl to write the response into the string
-			curl_easy_setopt(chandle, CURLOPT_WRITEDATA, &response);
-			curl_easy_setopt(chandle, CURLOPT_USE_SSL, CURLUSESSL_TRY);
-			//Perform the ritual sacrifice / get request
-			CURLcode result = curl_easy_perform(chandle);
-			curl_easy_cleanup(chandle);
-			if (result != CURLE_OK) {
-				std::ostringstream err;
-				err << "CURL error: ";
-				err << result;
-				throw std::runtime_error(err.str());
-			}
-			//Create a json object
-			nlohmann::json json = nlohmann::json::parse(response);
-			//We're done here
-			_jsonGetRequestSuccess = true;
-			return json;
+			json = nlohmann::json::parse(response);
 		} catch(exception e) {
-			LCD::writeMessage("Request error   ", 0, 0);
-			//Make an error sound
-			Buzzer::buzz(1000000);
 			//Something went wrong!
-			printf(WARN "Utils::jsonGetRequest() encountered an exception!\n");
+			Log::warn("Utils::jsonRequest() could not decode the response!\n");
 			//Create the error message
 			string message;
-			message += "Encountered an error while performing a json ";
-			message += "get request.  Details of the error are below:\n\n";
+			message += "Encountered an error while decoding a json ";
+			message += "get request.  Details of the error are below:\n";
 			message += "URL: ";
 			message += url;
 			message += "\n";
-			message += "Username: ";
-			message += getenv("HTTP_USERNAME");
-			message += "\n";
-			message += "Password: [not shown]\n";
 			message += "Raw message:\n";
 			message += response;
 			//Save the error
 			Utils::writeError(message);
-			//TODO: Proper error handling here
-			_jsonGetRequestSuccess = false;
-			return  nlohmann::json::parse("{}");
+			return REQUEST_BAD_RESPONSE;
 		}
+		//We're done here
+		return REQUEST_OK;
 	}
 
-	bool jsonGetRequestSuccess() {
-		return _jsonGetRequestSuccess;
-	}
-
-	/*! Write an error detail to the disk
+	/*! JSON request object
+	 *
+	 * 	This method sends a get request to the URL passed in @p url, and parses
+	 * 	the returned information as a json object, which it then returns.  If
+	 * 	the request fails, the user is told so on the display, and an empty
+	 * 	object is returned.
+	 *
+	 * 	@parameter url The URL to send the get request to, including parameters
 	 *
-	 * 	This method takes the given error string and writes it to the disk. It
-	 * 	will also print a message to the console informing that the error has
-	 * 	been written.
+	 * 	@returns The decoded json object
 	 */
-	void writeError(string message) {
-		//Get the file name
-		string fname("error_");
-		fname += Utils::getTime();
-		fname += ".txt";
-		//Create the output stream
-		std::ofstream file;
-		//Open the file
-		file.open(fname);
-		//Write the message to the file
-		file << message;
-		//Close the file
-		file.close();
-		//Print
-		printf(INFO "Error details have been saved to %s\n", fname.c_str());
+	nlohmann::json jsonGetRequest(const char* url) {
+		nlohmann::json json;
+		if(jsonRequest(url, json) == REQUEST_OK) {
+			//We're done here
+			_jsonGetRequestSuccess = true;
+			return json;
+		}
+		showRequestError();
+		//TODO: Proper error handling here
+		_jsonGetRequestSuccess = false;
+		return  nlohmann::json::parse("{}");
 	}
 
-	/*! Get the current time as a string
+	/*! Request failure notification
 	 *
-	 * 	This method gets and returns the time as a string formatted such that
-	 * 	it is a valid filename.  This method is used for generating error
-	 * 	reports.
+	 * 	This method tells the user that a request they are waiting on has
+	 * 	failed.
 	 */
-	string getTime() {
-		//Time string
-		std::ostringstream ss;
-		//Get the time object
-		time_t t = time(0);
-		//Get the local time
-		struct tm * now = localtime(&t);
-		//Convert to a string
-		ss << (now->tm_year + 1900) << "-";
-		ss << (now->tm_mon + 1) << "-";
-		ss << (now->tm_mday) << "_";
-		ss << (now->tm_hour) << "-";
-		ss << (now->tm_min) << "-";
-		ss << (now->tm_sec);
-		//Return the time
-		return ss.str();
+	void showRequestError() {
+		Screen::show(Screen::MESSAGE, "Request error", Screen::NORMAL,
+			SCREEN_MESSAGE_TIME);
+		//Make an error sound
+		Buzzer::play(Buzzer::ERROR);
 	}
 
-	/*! Check for internet connectivity
-	*
-	* 	This method returns true if the pi can connect
-	*   to the attendance server, false otherwise
-	*/
-	bool hasInternetConnectivity() {
-		CURL *curl = curl_easy_init();;
-		CURLcode res;
-
-		bool hasInternet = true;
+	bool jsonGetRequestSuccess() {
+		return _jsonGetRequestSuccess;
+	}
 
-		curl_easy_setopt(curl, CURLOPT_URL, getenv("API_BASEURL"));
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
-			Utils::curlParseCallback);
-		std::string response;
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-		if ((res = curl_easy_perform(curl)) != CURLE_OK) {
-			switch (res) {
-			case CURLE_COULDNT_CONNECT:
-			case CURLE_COULDNT_RESOLVE_HOST:
-			case CURLE_COULDNT_RESOLVE_PROXY:
-				hasInternet = false;
-				break;
-			default:
-				break; // site error, guess we just continue
-			}
+	/*! Write an error detail to the log
+	 *
+	 * 	This method takes the given error string and adds it to the log, one
+	 * 	line at a time, leaving out everything past the first few lines.  It
+	 * 	used to get a file of its own, which during an outage meant a new file
+	 * 	on the SD card for every tap.
+	 */
+	void writeError(string message) {
+		std::istringstream lines(message);
+		string line;
+		for(int i = 0; i < UTILS_ERROR_LINES && std::getline(lines, line); i++) {
+			Log::warn("  %s\n", line.c_str());
 		}
-
-		curl_easy_cleanup(curl);
-		return hasInternet;
 	}
 
 	void shutdownPi() {
@@ -322,7 +208,7 @@ namespace Utils {
 	}
 
 	void restartProgram() {
-		LCD::writeMessage("Force restart...", 0, 0);
+		Screen::show(Screen::MESSAGE, "Force restart...", Screen::ALERT);
 		system("service attendancev4 restart &");
 		std::exit(1);
 	}
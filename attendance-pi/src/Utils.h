@@ -14,13 +14,24 @@ namespace Utils {
 	typedef struct {
 		ConnectionType connectionType;
 		unsigned char dBm;
+		std::string name;
 		std::string ip;
 	} ConnectionState;
 
+	typedef enum {
+		REQUEST_OK,
+		REQUEST_NO_CONNECTION,
+		REQUEST_TIMED_OUT,
+		REQUEST_SERVER_ERROR,
+		REQUEST_BAD_RESPONSE
+	} RequestStatus;
+
+	RequestStatus jsonRequest(const char*, nlohmann::json&,
+		const std::string* body = nullptr, long* httpStatus = nullptr);
 	nlohmann::json jsonGetRequest(const char*);
+	void showRequestError();
 	bool jsonGetRequestSuccess();
 
-	bool hasInternetConnectivity();
 	std::vector<ConnectionState> getConnectionState();
 
 	void writeError(std::string);
@@ -0,0 +1,238 @@
+#include "../vs-intellisense-fix.hpp"
+
+#include "Bench.h"
+#include "../HalFake.h"
+#include "../Http.h"
+#include "../Log.h"
+#include "../ANSI.h"
+#include "../json.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdexcept>
+#include <chrono>
+#include <string>
+
+/*!	@section bench_run	Running
+ *
+ * 	@p make @p bench builds @p attendance-bench next to the daemon and runs
+ * 	every benchmark.  Give the names of some of them, through @p BENCH_ARGS
+ * 	with make, to only run those.  The roster has @p BENCH_USERS users,
+ * 	1000 by default.
+ *
+ * 	The benchmark binary is built from the same sources as the daemon,
+ * 	apart from Main.cpp and Hal.cpp, so it doesn't link against the
+ * 	bcm2835 library, although the modules still need its header for the
+ * 	pin numbers.  It never touches the hardware: the recording fakes are
+ * 	installed before anything else runs.
+ *
+ * 	@section bench_list	Benchmarks
+ *
+ * 	- @p lookup: finding users in the roster by PIN and by card.
+ * 	- @p roster: decoding the user list at startup, with the whole
+ * 	  document parsed at once as before and with the streaming decoder,
+ * 	  timed and with the peak memory each takes.
+ * 	- @p lcd: rewriting a row of the display, with the bytes and transfers
+ * 	  each character costs on the I2C bus, batched as now and one byte at a
+ * 	  time as before.
+ * 	- @p input: taps posted back to back, from the Input bus to the
+ * 	  greeting on the display.
+ * 	- @p burst: 30 students tapping in over 60 seconds, played back with
+ * 	  the gaps scaled by @p BENCH_BURST_SCALE, 0.05 by default.  Reports
+ * 	  the time from each tap to its greeting and how long the server took
+ * 	  to hear about all of them.
+ */
+namespace Bench {
+
+	///Hardware fakes, installed for the whole run
+	Hal::FakeGpio gpio;
+	Hal::FakeI2c i2c;
+	Hal::FakeSpi spi;
+
+	/**
+	 * A benchmark that can be picked on the command line
+	 * name: What it is called there
+	 * run: The benchmark
+	 */
+	struct Entry {
+		const char* name;
+		void (*run)();
+	};
+
+	///Every benchmark, in the order they run
+	const Entry benchmarks[] = {
+		{ "lookup", lookup },
+		{ "roster", roster },
+		{ "lcd", lcd },
+		{ "input", input },
+		{ "burst", burst }
+	};
+	///Number of benchmarks
+	const size_t count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+	/*!	Time a benchmark.
+	 *
+	 * 	Runs @p body once to warm up, then @p BENCH_REPEATS more times.
+	 *
+	 * 	@returns	The fastest time for one iteration, in nanoseconds
+	 */
+	double measure(Body body, long iterations, void* ctx) {
+		body(iterations, ctx);
+		double best = 0;
+		for(int i = 0; i < BENCH_REPEATS; i++) {
+			std::chrono::steady_clock::time_point start =
+				std::chrono::steady_clock::now();
+			body(iterations, ctx);
+			double ns = std::chrono::duration<double, std::nano>(
+				std::chrono::steady_clock::now() - start).count();
+			if(i == 0 || ns < best) {
+				best = ns;
+			}
+		}
+		return best / iterations;
+	}
+
+	/*!	Print one result.
+	 */
+	void report(const char* name, const char* format, ...) {
+		printf("  %-36s ", name);
+		va_list args;
+		va_start(args, format);
+		vprintf(format, args);
+		va_end(args);
+		printf("\n");
+		fflush(stdout);
+	}
+
+	/*!	Print the heading of a group of results.
+	 */
+	void section(const char* name) {
+		printf(INFO "%s\n", name);
+		fflush(stdout);
+	}
+
+	/*!	Get the number of users to generate.
+	 */
+	size_t users() {
+		const char* env = getenv("BENCH_USERS");
+		long n = env != nullptr ? atol(env) : BENCH_DEFAULT_USERS;
+		if(n < 1) {
+			return 1;
+		}
+		return n > BENCH_MAX_USERS ? BENCH_MAX_USERS : (size_t) n;
+	}
+
+	/*!	Get the PIN of a generated user.
+	 *
+	 * 	PINs start at 1000, well clear of the 0xxx keypad codes.
+	 */
+	std::string pin(size_t user) {
+		char buf[8];
+		snprintf(buf, sizeof(buf), "%04u", (unsigned) (1000 + user));
+		return buf;
+	}
+
+	/*!	Get the card of a generated user.
+	 *
+	 * 	Most cards have 4 byte UIDs, but one user in @p BENCH_LEGACY_EVERY
+	 * 	has a 7 byte one.
+	 */
+	CardId card(size_t user) {
+		uint32_t mixed = (uint32_t) (user * 2654435761u) ^ 0x5A5A0000u;
+		uint8_t bytes[7] = { (uint8_t) (mixed >> 24), (uint8_t) (mixed >> 16),
+			(uint8_t) (mixed >> 8), (uint8_t) mixed, 0x04, (uint8_t) (user >> 8),
+			(uint8_t) user };
+		bool legacy = user % BENCH_LEGACY_EVERY == BENCH_LEGACY_EVERY - 1;
+		return CardId(bytes, legacy ? 7 : 4);
+	}
+
+	/*!	Get the tag the server holds for a generated user.
+	 *
+	 * 	The 7 byte cards were assigned by the old program, which stored only
+	 * 	their first 4 bytes.
+	 */
+	CardId tag(size_t user) {
+		return card(user).prefix(4);
+	}
+
+	/*!	Generate a user list.
+	 *
+	 * 	Each user looks like one from listUsers.php, fields the kiosk
+	 * 	ignores included, so decoding it costs what the real list does.
+	 */
+	std::string rosterJson(size_t users) {
+		nlohmann::json list = nlohmann::json::array();
+		for(size_t i = 0; i < users; i++) {
+			char rfid[CARD_ID_HEX_LENGTH];
+			tag(i).toHex(rfid);
+			std::string n = std::to_string(i);
+			nlohmann::json user;
+			user["id"] = n;
+			//Short enough that every greeting still looks different
+			user["fname"] = "S" + n;
+			user["lname"] = "Lastname" + n;
+			user["email"] = "student" + n + "@example.org";
+			user["pin"] = pin(i);
+			user["rfid"] = rfid;
+			user["username"] = "student" + n;
+			user["permissions"] = nlohmann::json::array({ "event.trigger" });
+			user["time"] = std::to_string(3600 * (i % 200));
+			user["signedin"] = "0";
+			user["week"] = 0;
+			user["since"] = 0;
+			list.push_back(user);
+		}
+		//Pretty printed, like everything the API sends
+		return list.dump(4);
+	}
+}
+
+int main(int argc, char** argv) {
+	//Nothing below may touch the hardware or the network
+	Hal::install(&Bench::gpio, &Bench::i2c, &Bench::spi);
+	//Keep what the modules log and save out of the way of the results
+	setenv("LOG_LEVEL", "warn", 0);
+	setenv("LOG_FILE", "", 0);
+	setenv("METRICS_FILE", "", 0);
+	setenv("JOURNAL_FILE", "/tmp/attendance-bench-journal.log", 0);
+	setenv("ROSTER_SNAPSHOT", "/tmp/attendance-bench-roster.bin", 0);
+	setenv("KIOSK_ID", "bench", 0);
+	setenv("API_BASEURL", "http://bench.invalid/api/", 0);
+	setenv("API_LISTUSERS", "listUsers.php", 0);
+	setenv("API_TRIGGER", "trigger.php", 0);
+	setenv("API_ASSIGN", "assign.php", 0);
+
+	int ran = 0;
+	for(size_t i = 0; i < Bench::count; i++) {
+		bool picked = argc < 2;
+		for(int a = 1; a < argc; a++) {
+			if(strcmp(argv[a], Bench::benchmarks[i].name) == 0) {
+				picked = true;
+			}
+		}
+		if(!picked) {
+			continue;
+		}
+		try {
+			Bench::benchmarks[i].run();
+		} catch(const std::exception& e) {
+			printf(FAIL "%s failed: %s\n" RESET, Bench::benchmarks[i].name,
+				e.what());
+			Bench::finish();
+			return 1;
+		}
+		ran++;
+	}
+	Bench::finish();
+	if(ran == 0) {
+		printf("Usage: %s [benchmark...]\nBenchmarks:", argv[0]);
+		for(size_t i = 0; i < Bench::count; i++) {
+			printf(" %s", Bench::benchmarks[i].name);
+		}
+		printf("\n");
+		return 1;
+	}
+	return 0;
+}
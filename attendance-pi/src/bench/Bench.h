@@ -0,0 +1,46 @@
+#pragma once
+
+#include "../CardId.h"
+
+#include <string>
+#include <stddef.h>
+
+///Users in the generated roster, unless BENCH_USERS says otherwise
+#define BENCH_DEFAULT_USERS		1000
+///Most users the generated PINs can tell apart
+#define BENCH_MAX_USERS			9000
+///Timed runs of each benchmark, of which the fastest is reported
+#define BENCH_REPEATS			5
+///One in this many generated users has a 7 byte card stored by its first 4
+#define BENCH_LEGACY_EVERY		4
+
+/*!	Host benchmarks.
+ *
+ * 	Runs the hot paths of the kiosk on any Linux machine, against the fakes
+ * 	in HalFake.h and a fake server, and prints how long they take.  Each
+ * 	benchmark is run once to warm up and then @p BENCH_REPEATS times, and
+ * 	the fastest run is reported, so that numbers from one build can be
+ * 	compared with the next.
+ */
+namespace Bench {
+
+	///Code being timed, which does its work @p iterations times
+	typedef void (*Body)(long iterations, void* ctx);
+
+	double measure(Body, long iterations, void* ctx);
+	void report(const char* name, const char* format, ...);
+	void section(const char* name);
+
+	size_t users();
+	std::string pin(size_t user);
+	CardId card(size_t user);
+	CardId tag(size_t user);
+	std::string rosterJson(size_t users);
+
+	void lookup();
+	void roster();
+	void lcd();
+	void input();
+	void burst();
+	void finish();
+}
@@ -0,0 +1,395 @@
+#include "../vs-intellisense-fix.hpp"
+
+#include "Bench.h"
+#include "../HalFake.h"
+#include "../Http.h"
+#include "../Reactor.h"
+#include "../Log.h"
+#include "../Metrics.h"
+#include "../LCD.h"
+#include "../Screen.h"
+#include "../Buzzer.h"
+#include "../State.h"
+#include "../UserHandler.h"
+#include "../Journal.h"
+#include "../Sender.h"
+#include "../Input.h"
+#include "../json.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <unistd.h>
+
+///Students in the burst
+#define BENCH_BURST_TAPS		30
+///Length of the burst, before it is scaled
+#define BENCH_BURST_SECONDS		60
+///Default factor the gaps between taps are scaled by
+#define BENCH_DEFAULT_SCALE		0.05
+///Default time the fake server takes to answer, in milliseconds
+#define BENCH_DEFAULT_DELAY		30
+///Taps posted at once by the input benchmark, which must fit in the queue
+#define BENCH_INPUT_ROUND		32
+///Time without display traffic after which the kiosk is taken to be idle
+#define BENCH_SETTLE			std::chrono::milliseconds(20)
+///Longest wait for the kiosk to do anything
+#define BENCH_TIMEOUT			std::chrono::seconds(10)
+
+/*!	@section bench_stack	Kiosk Under Test
+ *
+ * 	The input and burst benchmarks run the same modules as the daemon does
+ * 	between a tap and the server: the Input bus, the User Handler, the
+ * 	Screen and LCD, the Buzzer, the Journal and the Sender, with the
+ * 	reactor running on a thread of its own.  The roster is downloaded from
+ * 	a fake server at the start, through the same decoder as on the kiosk.
+ * 	The same server then answers every sign in and out after
+ * 	@p BENCH_SERVER_DELAY milliseconds, 30 by default, echoing the sequence
+ * 	number of each event like trigger.php does.  Like the real one, it only
+ * 	knows the tags it handed out, and a tap with any other tag is counted
+ * 	as rejected, which fails the benchmark.
+ *
+ * 	A tap counts as greeted once the display has been written to after
+ * 	it, which is read off the fake I2C bus.
+ */
+namespace Bench {
+
+	extern Hal::FakeI2c i2c;
+
+	/*!	Fake server.
+	 *
+	 * 	Answers the user list and the trigger endpoint, and counts what it
+	 * 	has been sent.
+	 */
+	class Server : public Http::Transport {
+		public:
+			Server(size_t users, long delayMs) : roster(rosterJson(users)),
+				delayMs(delayMs), requests(0), events(0), rejected(0) {
+				for(size_t i = 0; i < users; i++) {
+					char hex[CARD_ID_HEX_LENGTH];
+					tag(i).toHex(hex);
+					tags.insert(hex);
+				}
+				base = getenv("API_BASEURL");
+				listUrl = base + getenv("API_LISTUSERS");
+				triggerUrl = base + getenv("API_TRIGGER");
+			}
+
+			CURLcode perform(const char* url, const std::string& etag,
+					bool headOnly, const std::string* body, Http::Sink sink,
+					void* context, Http::Response& response) {
+				std::string u = url;
+				response.status = 200;
+				if(u == listUrl) {
+					//Hand the list over in pieces, as curl would
+					for(size_t at = 0; at < roster.size(); at += CURL_MAX_WRITE_SIZE) {
+						size_t length = std::min((size_t) CURL_MAX_WRITE_SIZE,
+							roster.size() - at);
+						if(sink != nullptr && !sink(roster.data() + at, length,
+								context)) {
+							return CURLE_WRITE_ERROR;
+						}
+					}
+					return CURLE_OK;
+				}
+				if(u.compare(0, triggerUrl.size(), triggerUrl) != 0) {
+					return CURLE_COULDNT_CONNECT;
+				}
+				usleep(delayMs * 1000);
+				requests++;
+				nlohmann::json reply;
+				reply["result"] = "success";
+				if(body == nullptr) {
+					size_t at = u.find("rfid=");
+					if(at != std::string::npos && !knows(u.substr(at + 5,
+							u.find('&', at) - at - 5))) {
+						rejected++;
+					}
+					events++;
+				} else {
+					nlohmann::json batch = nlohmann::json::parse(*body);
+					reply["results"] = nlohmann::json::array();
+					for(size_t i = 0; i < batch["events"].size(); i++) {
+						nlohmann::json result;
+						result["result"] = "success";
+						result["seq"] = batch["events"][i]["seq"];
+						if(batch["events"][i].count("rfid") > 0 &&
+								!knows(batch["events"][i]["rfid"])) {
+							rejected++;
+						}
+						reply["results"].push_back(result);
+					}
+					events += batch["events"].size();
+				}
+				response.body = reply.dump();
+				return CURLE_OK;
+			}
+
+			///Requests made to the trigger endpoint
+			size_t triggerRequests() const {
+				return requests;
+			}
+
+			///Events the trigger endpoint has been sent
+			size_t triggerEvents() const {
+				return events;
+			}
+
+			///Events naming a tag nobody has
+			size_t rejectedEvents() const {
+				return rejected;
+			}
+
+		private:
+			///Whether anybody has the tag @p hex
+			bool knows(const std::string& hex) const {
+				return tags.count(hex) > 0;
+			}
+
+
+			std::string roster;
+			long delayMs;
+			std::string base;
+			std::string listUrl;
+			std::string triggerUrl;
+			std::atomic<size_t> requests;
+			std::atomic<size_t> events;
+			std::atomic<size_t> rejected;
+			std::unordered_set<std::string> tags;
+	};
+
+	/*!	Get how long the fake server takes to answer.
+	 */
+	long serverDelay() {
+		const char* env = getenv("BENCH_SERVER_DELAY");
+		return env != nullptr && atol(env) >= 0 ? atol(env) : BENCH_DEFAULT_DELAY;
+	}
+
+	///Runs the reactor while the kiosk is up
+	std::thread reactorThread;
+	///The server the kiosk talks to, once it is up
+	Server* server = nullptr;
+
+	/*!	Bring up the modules between a tap and the server.
+	 *
+	 * 	In the same order the daemon does, leaving out the hardware that
+	 * 	isn't being driven and anything that only talks to the network.
+	 * 	The modules can only be initialized once, so the kiosk stays up
+	 * 	until finish() is called.
+	 *
+	 * 	@returns	The server it talks to
+	 */
+	Server& startKiosk() {
+		if(server != nullptr) {
+			return *server;
+		}
+		server = new Server(users(), serverDelay());
+		//Start from an empty journal, with nothing left over to replay
+		unlink(getenv("JOURNAL_FILE"));
+		unlink(getenv("ROSTER_SNAPSHOT"));
+		Http::install(server);
+		State::changeState(State::INIT);
+		Reactor::init();
+		Log::init();
+		Metrics::init();
+		Http::init();
+		LCD::init();
+		Screen::init();
+		Buzzer::init();
+		UserHandler::init();
+		Journal::init();
+		Sender::init();
+		Input::init();
+		reactorThread = std::thread(Reactor::run);
+		if(!UserHandler::update()) {
+			throw std::runtime_error("Could not load the generated users");
+		}
+		State::changeState(State::READY);
+		Sender::reconnect();
+		return *server;
+	}
+
+	/*!	Take the modules down again, if they were brought up.
+	 */
+	void finish() {
+		if(server == nullptr) {
+			return;
+		}
+		Reactor::stop();
+		reactorThread.join();
+		Input::destroy();
+		Sender::destroy();
+		Journal::destroy();
+		UserHandler::destroy();
+		Buzzer::destroy();
+		Screen::destroy();
+		LCD::destroy();
+		Http::destroy();
+		Metrics::destroy();
+		Reactor::destroy();
+		Log::destroy();
+		unlink(getenv("JOURNAL_FILE"));
+		unlink(getenv("ROSTER_SNAPSHOT"));
+		delete server;
+		server = nullptr;
+	}
+
+	/*!	Wait for the display to be written to.
+	 *
+	 * 	@returns	When it was, after @p since bytes had gone to it
+	 */
+	std::chrono::steady_clock::time_point waitForDisplay(size_t since) {
+		std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() + BENCH_TIMEOUT;
+		while(i2c.bytes() == since) {
+			if(std::chrono::steady_clock::now() > deadline) {
+				throw std::runtime_error("Nothing was shown on the display");
+			}
+			std::this_thread::yield();
+		}
+		return std::chrono::steady_clock::now();
+	}
+
+	/*!	Wait for the display to stop changing.
+	 *
+	 * 	@returns	When it last changed
+	 */
+	std::chrono::steady_clock::time_point waitForIdle() {
+		size_t seen = i2c.bytes();
+		std::chrono::steady_clock::time_point changed =
+			std::chrono::steady_clock::now();
+		while(std::chrono::steady_clock::now() - changed < BENCH_SETTLE) {
+			usleep(50);
+			size_t now = i2c.bytes();
+			if(now != seen) {
+				seen = now;
+				changed = std::chrono::steady_clock::now();
+			}
+		}
+		return changed;
+	}
+
+	/*!	Wait for the server to have been sent every event.
+	 *
+	 * 	@returns	When the last one got there
+	 */
+	std::chrono::steady_clock::time_point waitForServer(const Server& server,
+			size_t events) {
+		std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() + BENCH_TIMEOUT;
+		while(server.triggerEvents() < events || Journal::pendingCount() > 0) {
+			if(std::chrono::steady_clock::now() > deadline) {
+				throw std::runtime_error("The server never heard about every tap");
+			}
+			usleep(100);
+		}
+		return std::chrono::steady_clock::now();
+	}
+
+	/*!	Print the spread of a set of times, in milliseconds.
+	 */
+	void reportSpread(const char* name, std::vector<double> ms) {
+		std::sort(ms.begin(), ms.end());
+		report(name, "p50 %7.3f ms  p95 %7.3f ms  max %7.3f ms",
+			ms[ms.size() / 2], ms[(ms.size() * 95) / 100], ms.back());
+	}
+
+	/*!	Input dispatch benchmark.
+	 *
+	 * 	Posts rounds of taps by different students all at once, as if they
+	 * 	had piled up in the queue, and times how long the dispatcher takes
+	 * 	to greet all of them.
+	 */
+	void input() {
+		size_t n = users();
+		startKiosk();
+		section("Input dispatch");
+		int rounds = 8;
+		size_t next = 0;
+		double best = 0;
+		for(int r = 0; r < rounds; r++) {
+			waitForIdle();
+			size_t before = i2c.bytes();
+			std::chrono::steady_clock::time_point start =
+				std::chrono::steady_clock::now();
+			for(int t = 0; t < BENCH_INPUT_ROUND; t++) {
+				Input::postCard(card(next++ % n), 0);
+			}
+			waitForDisplay(before);
+			double ms = std::chrono::duration<double, std::milli>(
+				waitForIdle() - start).count();
+			//The first round warms up
+			if(r == 1 || (r > 1 && ms < best)) {
+				best = ms;
+			}
+		}
+		report("taps dispatched", "%10.1f taps/s",
+			BENCH_INPUT_ROUND * 1000.0 / best);
+		report("time per tap", "%10.3f ms", best / BENCH_INPUT_ROUND);
+	}
+
+	/*!	Burst simulation.
+	 *
+	 * 	Plays back 30 students tapping in over a minute, at random but
+	 * 	repeatable moments, as they do in the rush before practice.
+	 */
+	void burst() {
+		const char* env = getenv("BENCH_BURST_SCALE");
+		double scale = env != nullptr && atof(env) >= 0 ? atof(env) :
+			BENCH_DEFAULT_SCALE;
+		size_t n = users();
+		if(n < BENCH_BURST_TAPS) {
+			throw std::runtime_error("The burst needs at least 30 users");
+		}
+		//The same moments every run
+		std::vector<double> at;
+		unsigned int seed = 42;
+		for(int t = 0; t < BENCH_BURST_TAPS; t++) {
+			at.push_back((double) (rand_r(&seed) % 1000000) / 1000000 *
+				BENCH_BURST_SECONDS);
+		}
+		std::sort(at.begin(), at.end());
+
+		Server& server = startKiosk();
+		char heading[96];
+		snprintf(heading, sizeof(heading), "Burst of %d taps in %d s, played "
+			"back %.2fx", BENCH_BURST_TAPS, BENCH_BURST_SECONDS, scale);
+		section(heading);
+		waitForIdle();
+		size_t heard = server.triggerEvents();
+		size_t requested = server.triggerRequests();
+		std::vector<double> greet;
+		std::chrono::steady_clock::time_point begin =
+			std::chrono::steady_clock::now();
+		for(int t = 0; t < BENCH_BURST_TAPS; t++) {
+			std::this_thread::sleep_until(begin +
+				std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double>(at[t] * scale)));
+			size_t before = i2c.bytes();
+			std::chrono::steady_clock::time_point tapped =
+				std::chrono::steady_clock::now();
+			//Spread the students over the whole table, and over both kinds of card
+			Input::postCard(card(((t * n) / BENCH_BURST_TAPS + t) % n), 0);
+			greet.push_back(std::chrono::duration<double, std::milli>(
+				waitForDisplay(before) - tapped).count());
+		}
+		std::chrono::steady_clock::time_point sent =
+			waitForServer(server, heard + BENCH_BURST_TAPS);
+		reportSpread("tap to greeting", greet);
+		report("last tap to server", "%10.1f ms",
+			std::chrono::duration<double, std::milli>(sent - begin).count() -
+			at.back() * scale * 1000);
+		report("requests to the server", "%10zu for %d taps",
+			server.triggerRequests() - requested, BENCH_BURST_TAPS);
+		if(server.rejectedEvents() > 0) {
+			throw std::runtime_error("The server was sent tags it doesn't know");
+		}
+	}
+}
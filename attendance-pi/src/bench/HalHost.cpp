@@ -0,0 +1,49 @@
+#include "../vs-intellisense-fix.hpp"
+
+#include "../Hal.h"
+
+/*!	@section bench_hal	Hardware Access
+ *
+ * 	Takes the place of Hal.cpp in the benchmark binary, so that it doesn't
+ * 	need the bcm2835 library to link.  There is no real hardware to fall
+ * 	back on: the fakes must be installed before any module is initialized.
+ */
+namespace Hal {
+
+	///Installed implementations
+	Gpio* currentGpio = nullptr;
+	I2c* currentI2c = nullptr;
+	Spi* currentSpi = nullptr;
+
+	/*!	Open the hardware, of which there is none.
+	 */
+	bool init() {
+		return true;
+	}
+
+	/*!	Close the hardware.
+	 */
+	bool close() {
+		return true;
+	}
+
+	Gpio& gpio() {
+		return *currentGpio;
+	}
+
+	I2c& i2c() {
+		return *currentI2c;
+	}
+
+	Spi& spi() {
+		return *currentSpi;
+	}
+
+	/*!	Install the implementations to use.
+	 */
+	void install(Gpio* g, I2c* i, Spi* s) {
+		currentGpio = g;
+		currentI2c = i;
+		currentSpi = s;
+	}
+}
@@ -0,0 +1,96 @@
+#include "../vs-intellisense-fix.hpp"
+
+#include "Bench.h"
+#include "../HalFake.h"
+#include "../LCD.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+///I2C clock the bus time is worked out for, unless LCD_I2C_BAUD says otherwise
+#define BENCH_I2C_BAUD			100000
+///Bits on the bus for every byte: eight of data and the acknowledge
+#define BENCH_I2C_BYTE_BITS		9
+///Rows written for the transfer counts
+#define BENCH_LCD_WRITES		1000
+///One byte transactions the kiosk used to make for every byte sent
+#define BENCH_OLD_TRANSACTIONS	6
+///Time the kiosk used to sleep after each of them, in microseconds
+#define BENCH_OLD_SLEEP			100
+
+/*!	@section bench_lcd	Display Writes
+ *
+ * 	Rewrites a whole row of the display over and over, with every character
+ * 	changing each time, and reads off the fake I2C bus how many bytes and
+ * 	transfers each character took.  From those it works out how long the
+ * 	bus is busy for each character at @p LCD_I2C_BAUD, counting the address
+ * 	byte that starts every transfer.
+ *
+ * 	The same figure is worked out for the way the display used to be
+ * 	driven, where each nibble went out as three transactions of one byte,
+ * 	each followed by a 100 microsecond sleep, and the cursor was moved for
+ * 	every message.
+ */
+namespace Bench {
+
+	extern Hal::FakeI2c i2c;
+
+	/**
+	 * What the display benchmark works on
+	 * rows: Two texts that differ in every cell
+	 * next: Which one goes out next
+	 */
+	struct LcdCase {
+		std::string rows[2];
+		int next;
+	};
+
+	void timeRowWrite(long iterations, void* ctx) {
+		LcdCase* lcd = (LcdCase*) ctx;
+		for(long i = 0; i < iterations; i++) {
+			LCD::writeMessage(lcd->rows[lcd->next], 1, 0);
+			lcd->next ^= 1;
+		}
+	}
+
+	/*!	Display write benchmarks.
+	 */
+	void lcd() {
+		LcdCase lcd;
+		lcd.rows[0] = "ABCDEFGHIJKLMNOP";
+		lcd.rows[1] = "abcdefghijklmnop";
+		lcd.next = 0;
+		const char* env = getenv("LCD_I2C_BAUD");
+		double baud = env != nullptr && atol(env) > 0 ? atol(env) : BENCH_I2C_BAUD;
+
+		LCD::init();
+		section("Display writes, 16 characters at a time");
+		double ns = measure(timeRowWrite, BENCH_LCD_WRITES, &lcd) / LCD_COLS;
+		report("characters written, CPU only", "%10.0f chars/s", 1000000000 / ns);
+
+		size_t bytes = i2c.bytes();
+		size_t transfers = i2c.transfers().size();
+		timeRowWrite(BENCH_LCD_WRITES, &lcd);
+		double chars = BENCH_LCD_WRITES * LCD_COLS;
+		double bytesPerChar = (i2c.bytes() - bytes) / chars;
+		double transfersPerChar = (i2c.transfers().size() - transfers) / chars;
+		//Each transfer starts with the address of the expander
+		double busUs = (bytesPerChar + transfersPerChar) * BENCH_I2C_BYTE_BITS *
+			1000000 / baud;
+		report("bytes per character", "%10.2f", bytesPerChar);
+		report("transfers per character", "%10.3f", transfersPerChar);
+		report("bus time per character", "%10.1f us, %.0f chars/s", busUs,
+			1000000 / busUs);
+
+		//Before, the cursor move and every character went out as two nibbles
+		double oldTransactions = BENCH_OLD_TRANSACTIONS * (LCD_COLS + 1.0) /
+			LCD_COLS;
+		double oldUs = oldTransactions * (2 * BENCH_I2C_BYTE_BITS * 1000000 / baud +
+			BENCH_OLD_SLEEP);
+		report("unbatched, transfers per character", "%10.3f", oldTransactions);
+		report("unbatched, time per character", "%10.1f us, %.0f chars/s", oldUs,
+			1000000 / oldUs);
+		LCD::destroy();
+	}
+}
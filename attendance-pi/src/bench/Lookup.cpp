@@ -0,0 +1,104 @@
+#include "../vs-intellisense-fix.hpp"
+
+#include "Bench.h"
+#include "../Roster.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/*!	@section bench_lookup	User Lookup
+ *
+ * 	Times what a tap or a PIN costs before anything is shown: finding the
+ * 	user in the roster, by card and by PIN, for users spread over the whole
+ * 	table and for nobody at all.  Some of the cards are only known by the
+ * 	first four bytes, so those are found by the fallback.  Building the table from scratch, which
+ * 	every full roster download does, is timed as well.
+ */
+namespace Bench {
+
+	/**
+	 * What the lookup benchmarks work on
+	 * roster: The table being searched
+	 * pins: A PIN for every user
+	 * cards: A card for every user
+	 * tags: What the table holds for each card
+	 * found: Sum of the positions found, so the lookups aren't optimized out
+	 */
+	struct LookupCase {
+		std::shared_ptr<Roster> roster;
+		std::vector<std::string> pins;
+		std::vector<CardId> cards;
+		std::vector<CardId> tags;
+		size_t found;
+	};
+
+	/*!	Build the table for every user in @p lookup.
+	 */
+	std::shared_ptr<Roster> buildRoster(const LookupCase& lookup) {
+		Roster::Builder builder;
+		builder.reserve(lookup.pins.size(), lookup.pins.size() * 12);
+		for(size_t i = 0; i < lookup.pins.size(); i++) {
+			std::string name = "Student" + std::to_string(i);
+			builder.add(name.data(), name.size(), lookup.pins[i].data(),
+				lookup.pins[i].size(), lookup.tags[i], false);
+		}
+		return builder.build();
+	}
+
+	void timeBuild(long iterations, void* ctx) {
+		LookupCase* lookup = (LookupCase*) ctx;
+		for(long i = 0; i < iterations; i++) {
+			lookup->found += buildRoster(*lookup)->size();
+		}
+	}
+
+	void timePinLookup(long iterations, void* ctx) {
+		LookupCase* lookup = (LookupCase*) ctx;
+		size_t n = lookup->pins.size();
+		for(long i = 0; i < iterations; i++) {
+			lookup->found += lookup->roster->findByPin(lookup->pins[i % n]);
+		}
+	}
+
+	void timeCardLookup(long iterations, void* ctx) {
+		LookupCase* lookup = (LookupCase*) ctx;
+		size_t n = lookup->cards.size();
+		for(long i = 0; i < iterations; i++) {
+			lookup->found += lookup->roster->findByRfid(lookup->cards[i % n]);
+		}
+	}
+
+	void timeMissingLookup(long iterations, void* ctx) {
+		LookupCase* lookup = (LookupCase*) ctx;
+		//Nobody has a card past the end of the generated ones
+		size_t n = lookup->cards.size();
+		for(long i = 0; i < iterations; i++) {
+			lookup->found += lookup->roster->findByRfid(card(n + (i & 1023)));
+		}
+	}
+
+	/*!	User lookup benchmarks.
+	 */
+	void lookup() {
+		LookupCase lookup;
+		size_t n = users();
+		for(size_t i = 0; i < n; i++) {
+			lookup.pins.push_back(pin(i));
+			lookup.cards.push_back(card(i));
+			lookup.tags.push_back(tag(i));
+		}
+		lookup.found = 0;
+		lookup.roster = buildRoster(lookup);
+
+		section(("User lookup, " + std::to_string(n) + " users").c_str());
+		report("build table", "%10.1f us",
+			measure(timeBuild, 20, &lookup) / 1000);
+		report("find by PIN", "%10.1f ns",
+			measure(timePinLookup, 1000000, &lookup));
+		report("find by card", "%10.1f ns",
+			measure(timeCardLookup, 1000000, &lookup));
+		report("find an unknown card", "%10.1f ns",
+			measure(timeMissingLookup, 1000000, &lookup));
+	}
+}
@@ -0,0 +1,218 @@
+#include "../vs-intellisense-fix.hpp"
+
+#include "Bench.h"
+#include "../Roster.h"
+#include "../RosterParser.h"
+#include "../json.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <algorithm>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+///Bytes handed over at a time, as curl does
+#define BENCH_CHUNK_SIZE	16384
+
+/*!	@section bench_roster	Roster Download
+ *
+ * 	Times decoding the user list at startup both ways it has been done: by
+ * 	collecting the whole body, parsing it into a JSON document and copying
+ * 	each user out of that, as the kiosk used to, and by feeding the body a
+ * 	chunk at a time to the streaming decoder straight into the table, as it
+ * 	does now.  Each is also run once in a child process of its own, to
+ * 	read how far it pushes the resident set above where it started.
+ */
+namespace Bench {
+
+	/**
+	 * A user as the kiosk used to keep them
+	 * fname: First name
+	 * pin: PIN
+	 * rfid: Tag, in hex
+	 * signedin: Whether they were signed in
+	 */
+	struct OldUser {
+		std::string fname;
+		std::string pin;
+		std::string rfid;
+		bool signedin;
+	};
+
+	/**
+	 * What the roster benchmarks work on
+	 * body: The list as the server sends it
+	 * decoded: Sum of the users decoded, so the work isn't optimized out
+	 */
+	struct ParseCase {
+		std::string body;
+		size_t decoded;
+	};
+
+	/*!	Decode the list the way the kiosk used to.
+	 *
+	 * 	@returns	The number of users
+	 */
+	size_t parseDocument(const std::string& body) {
+		//The whole body was collected before anything was decoded
+		std::string collected;
+		for(size_t at = 0; at < body.size(); at += BENCH_CHUNK_SIZE) {
+			collected.append(body, at, BENCH_CHUNK_SIZE);
+		}
+		nlohmann::json json = nlohmann::json::parse(collected);
+		std::vector<OldUser> users;
+		users.reserve(json.size());
+		for(size_t i = 0; i < json.size(); i++) {
+			const nlohmann::json& element = json[i];
+			users.push_back({ element["fname"].get<std::string>(),
+				element["pin"].get<std::string>(),
+				element["rfid"].get<std::string>(),
+				element["signedin"].get<std::string>() == "1" });
+		}
+		return users.size();
+	}
+
+	/*!	Add one decoded user to the table, like UserHandler does.
+	 */
+	void onParsedUser(const RosterParser::Record& record, void* context) {
+		CardId rfid;
+		CardId::fromHex(record.rfid.c_str(), rfid);
+		((Roster::Builder*) context)->add(record.fname.data(),
+			record.fname.size(), record.pin.data(), record.pin.size(), rfid,
+			record.signedin, Roster::makeHours(record.week,
+			record.signedin ? record.since : 0, std::time(0)));
+	}
+
+	void onParsedRemoved(const std::string& pin, void* context) {
+	}
+
+	/*!	Decode the list the way the kiosk does now.
+	 *
+	 * 	@returns	The number of users
+	 */
+	size_t parseStream(const std::string& body) {
+		Roster::Builder builder;
+		RosterParser parser(onParsedUser, onParsedRemoved, &builder);
+		for(size_t at = 0; at < body.size(); at += BENCH_CHUNK_SIZE) {
+			size_t length = std::min((size_t) BENCH_CHUNK_SIZE, body.size() - at);
+			if(!parser.feed(body.data() + at, length)) {
+				throw std::runtime_error(parser.error());
+			}
+		}
+		if(!parser.finish()) {
+			throw std::runtime_error(parser.error());
+		}
+		return builder.build()->size();
+	}
+
+	void timeDocument(long iterations, void* ctx) {
+		ParseCase* parse = (ParseCase*) ctx;
+		for(long i = 0; i < iterations; i++) {
+			parse->decoded += parseDocument(parse->body);
+		}
+	}
+
+	void timeStream(long iterations, void* ctx) {
+		ParseCase* parse = (ParseCase*) ctx;
+		for(long i = 0; i < iterations; i++) {
+			parse->decoded += parseStream(parse->body);
+		}
+	}
+
+	/*!	Read a memory figure of this process, in kilobytes.
+	 *
+	 * 	@param	field	The line of /proc/self/status to read, like "VmRSS:"
+	 */
+	long statusKb(const char* field) {
+		FILE* status = fopen("/proc/self/status", "r");
+		if(status == nullptr) {
+			throw std::runtime_error("Could not read /proc/self/status");
+		}
+		char line[128];
+		long kb = -1;
+		size_t length = strlen(field);
+		while(fgets(line, sizeof(line), status) != nullptr) {
+			if(strncmp(line, field, length) == 0) {
+				kb = atol(line + length);
+				break;
+			}
+		}
+		fclose(status);
+		return kb;
+	}
+
+	/*!	Measure how much memory decoding the list takes.
+	 *
+	 * 	Runs @p parse in a child process, which first hands everything
+	 * 	already freed back to the system, so that none of it can be reused
+	 * 	without showing up, and then resets its peak to what it holds now.
+	 *
+	 * 	@returns	How far the peak resident set rose, in kilobytes
+	 */
+	long peakGrowthKb(size_t (*parse)(const std::string&),
+			const std::string& body) {
+		int fds[2];
+		if(pipe(fds) != 0) {
+			throw std::runtime_error("Could not create a pipe");
+		}
+		pid_t pid = fork();
+		if(pid < 0) {
+			throw std::runtime_error("Could not fork");
+		}
+		if(pid == 0) {
+			close(fds[0]);
+			malloc_trim(0);
+			//The child starts with the peak of its parent
+			long grown = -1;
+			FILE* refs = fopen("/proc/self/clear_refs", "w");
+			if(refs != nullptr && fputs("5", refs) >= 0 && fclose(refs) == 0) {
+				long before = statusKb("VmRSS:");
+				parse(body);
+				grown = statusKb("VmHWM:") - before;
+			}
+			if(write(fds[1], &grown, sizeof(grown)) < 0) {
+				//The parent sees nothing and fails
+			}
+			_exit(0);
+		}
+		close(fds[1]);
+		long grown = -1;
+		ssize_t got = read(fds[0], &grown, sizeof(grown));
+		close(fds[0]);
+		waitpid(pid, nullptr, 0);
+		if(got != sizeof(grown) || grown < 0) {
+			throw std::runtime_error("Could not measure the peak memory");
+		}
+		return grown;
+	}
+
+	/*!	Roster download benchmarks.
+	 */
+	void roster() {
+		ParseCase parse;
+		size_t n = users();
+		parse.body = rosterJson(n);
+		parse.decoded = 0;
+
+		char heading[96];
+		snprintf(heading, sizeof(heading), "Roster download, %zu users, %zu kB",
+			n, parse.body.size() / 1024);
+		section(heading);
+		report("parse time, whole document", "%10.3f ms",
+			measure(timeDocument, 1, &parse) / 1000000);
+		report("parse time, streamed", "%10.3f ms",
+			measure(timeStream, 1, &parse) / 1000000);
+		report("peak RSS growth, whole document", "%10ld kB",
+			peakGrowthKb(parseDocument, parse.body));
+		report("peak RSS growth, streamed", "%10ld kB",
+			peakGrowthKb(parseStream, parse.body));
+	}
+}
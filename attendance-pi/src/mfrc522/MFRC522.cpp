@@ -5,28 +5,28 @@
  */
 
 #include "MFRC522.h"
+#include "../Hal.h"
 #include "bcm2835.h"
+#include <unistd.h>
 #include <linux/types.h>
 #include <stdint.h>
 #include <cstring>
 #include <stdio.h>
 #include <string>
-
-#define RSTPIN RPI_V2_GPIO_P1_22
+#include <chrono>
 
 using namespace std;
 
 /**
  * Constructor.
  * Prepares the output pins.
+ * Several readers can share the SPI bus, each on its own chip select.
  */
-MFRC522::MFRC522(){
+MFRC522::MFRC522(byte chipSelect, byte resetPin, word clockDivider) : _chipSelect(chipSelect), _resetPin(resetPin), _clockDivider(clockDivider) {
   
-  if (!bcm2835_init()) {
-    printf("Failed to initialize. This tool needs root access, use sudo.\n");
-  }
-  bcm2835_gpio_fsel(RSTPIN, BCM2835_GPIO_FSEL_OUTP);
-  bcm2835_gpio_write(RSTPIN, LOW);
+  // The hardware has already been opened by Hal::init()
+  Hal::gpio().output(_resetPin);
+  Hal::gpio().write(_resetPin, false);
   // Set SPI bus to work with MFRC522 chip.
   setSPIConfig();
 } // End constructor
@@ -37,15 +37,29 @@ MFRC522::MFRC522(){
  */
 void MFRC522::setSPIConfig() {
   
-  bcm2835_spi_begin();
-  bcm2835_spi_setBitOrder(BCM2835_SPI_BIT_ORDER_MSBFIRST);      // The default
-  bcm2835_spi_setDataMode(BCM2835_SPI_MODE0);                   // The default
-  bcm2835_spi_setClockDivider(BCM2835_SPI_CLOCK_DIVIDER_64);    // ~ 4 MHz
-  bcm2835_spi_chipSelect(BCM2835_SPI_CS0);                      // The default
-  bcm2835_spi_setChipSelectPolarity(BCM2835_SPI_CS0, LOW);      // the default
+  Hal::spi().begin();                                           // MSB first, mode 0
+  Hal::spi().setClockDivider(_clockDivider);                    // 64 gives ~ 4 MHz, the MFRC522 takes up to 10 MHz
+  Hal::spi().chipSelect(_chipSelect);                           // Active low
 	
 } // End setSPIConfig()
 
+/**
+ * Points the SPI bus at this reader.
+ * Must be called before talking to the reader if another reader on the same bus was used since.
+ */
+void MFRC522::PCD_Select() {
+  Hal::spi().chipSelect(_chipSelect);
+} // End PCD_Select()
+
+/**
+ * Changes the SPI clock divider used with this reader, and sets it on the bus straight away.
+ * The bus has a single clock, so every reader on it should use the same divider.
+ */
+void MFRC522::PCD_SetClockDivider(word clockDivider) {
+  _clockDivider = clockDivider;
+  Hal::spi().setClockDivider(_clockDivider);
+} // End PCD_SetClockDivider()
+
 /////////////////////////////////////////////////////////////////////////////////////
 // Basic interface functions for communicating with the MFRC522
 /////////////////////////////////////////////////////////////////////////////////////
@@ -61,22 +75,27 @@ void MFRC522::PCD_WriteRegister(	byte reg,		///< The register to write to. One o
   char data[2];
   data[0] = reg & 0x7E;
   data[1] = value;
-  bcm2835_spi_transfern(data, 2);
+  Hal::spi().transfern(data, 2);
   
 } // End PCD_WriteRegister()
 
 /**
  * Writes a number of bytes to the specified register in the MFRC522 chip.
  * The interface is described in the datasheet section 8.1.2.
+ * All of the bytes go in one transfer: the address is sent once and every byte after it is written to the
+ * same register, which is how the FIFO is filled.
  */
 void MFRC522::PCD_WriteRegister(	byte reg,		///< The register to write to. One of the PCD_Register enums.
 					byte count,		///< The number of bytes to write to the register
 					byte *values	///< The values to write. Byte array.
 					) {
-  for (byte index = 0; index < count; index++) {
-  	PCD_WriteRegister(reg, values[index]);
-	}
-
+  if (count == 0) {
+    return;
+  }
+  char data[256];
+  data[0] = reg & 0x7E;
+  memcpy(&data[1], values, count);
+  Hal::spi().transfern(data, count + 1);
 } // End PCD_WriteRegister()
 
 /**
@@ -88,13 +107,15 @@ byte MFRC522::PCD_ReadRegister(	byte reg	///< The register to read from. One of
   
   char data[2];
   data[0] = 0x80 | ((reg) & 0x7E);
-  bcm2835_spi_transfern(data,2);
+  Hal::spi().transfern(data,2);
   return (byte)data[1];
 } // End PCD_ReadRegister()
 
 /**
  * Reads a number of bytes from the specified register in the MFRC522 chip.
  * The interface is described in the datasheet section 8.1.2.
+ * All of the bytes come back in one transfer: the address is sent count times, each byte clocked out
+ * returns the value asked for by the one before, and a final 0 stops reading.
  */
 void MFRC522::PCD_ReadRegister(	byte reg,		///< The register to read from. One of the PCD_Register enums.
 				byte count,		///< The number of bytes to read
@@ -104,31 +125,50 @@ void MFRC522::PCD_ReadRegister(	byte reg,		///< The register to read from. One o
   if (count == 0) {
     return;
   }
-  //Serial.print(F("Reading ")); 	Serial.print(count); Serial.println(F(" bytes from register."));
   byte address = 0x80 | (reg & 0x7E);		// MSB == 1 is for reading. LSB is not used in address. Datasheet section 8.1.2.3.
+  char data[256];
+  memset(data, address, count);
+  data[count] = 0;
+  Hal::spi().transfern(data, count + 1);
   byte index = 0;							// Index in values array.
-  count--;								// One read is performed outside of the loop
-  bcm2835_spi_transfer(address);
-  while (index < count) {
-    if (index == 0 && rxAlign) {		// Only update bit positions rxAlign..7 in values[0]
-      // Create bit mask for bit positions rxAlign..7
-      byte mask = 0;
-      for (byte i = rxAlign; i <= 7; i++) {
-	mask |= (1 << i);
-      }
-      // Read value and tell that we want to read the same address again.
-      byte value = bcm2835_spi_transfer(address);
-      // Apply mask to both current value of values[0] and the new data in value.
-      values[0] = (values[index] & ~mask) | (value & mask);
-    }
-    else { // Normal case
-      values[index] = bcm2835_spi_transfer(address);
+  if (rxAlign) {		// Only update bit positions rxAlign..7 in values[0]
+    // Create bit mask for bit positions rxAlign..7
+    byte mask = 0;
+    for (byte i = rxAlign; i <= 7; i++) {
+      mask |= (1 << i);
     }
+    // Apply mask to both current value of values[0] and the new data.
+    values[0] = (values[0] & ~mask) | ((byte)data[1] & mask);
     index++;
   }
-  values[index] = bcm2835_spi_transfer(0);			// Read the final byte. Send 0 to stop reading.
+  for (; index < count; index++) {
+    values[index] = (byte)data[index + 1];
+  }
 } // End PCD_ReadRegister()
 
+/**
+ * Reads several different registers in one transfer.
+ * Each address clocked in returns the value of the one before it (datasheet section 8.1.2.1), so this
+ * costs one transfer of count + 1 bytes instead of count transfers of two.
+ */
+void MFRC522::PCD_ReadRegisters(	const byte *regs,	///< The registers to read. PCD_Register enums.
+				byte count,		///< The number of registers
+				byte *values	///< Byte array to store the values in, in the same order.
+				) {
+  if (count == 0) {
+    return;
+  }
+  char data[256];
+  for (byte index = 0; index < count; index++) {
+    data[index] = 0x80 | (regs[index] & 0x7E);
+  }
+  data[count] = 0;
+  Hal::spi().transfern(data, count + 1);
+  for (byte index = 0; index < count; index++) {
+    values[index] = (byte)data[index + 1];
+  }
+} // End PCD_ReadRegisters()
+
 /**
  * Sets the bits given in mask in register reg.
  */
@@ -153,37 +193,25 @@ void MFRC522::PCD_ClearRegisterBitMask(	byte reg,	///< The register to update. O
 
 
 /**
- * Use the CRC coprocessor in the MFRC522 to calculate a CRC_A.
+ * Calculate a CRC_A.
+ * This used to be done by the CRC coprocessor in the MFRC522, which costs five register writes, a FIFO
+ * write, a busy wait on DivIrqReg and two more reads over SPI. The CRC is small enough to work out here
+ * instead: ISO/IEC 14443-3 CRC_A, preset 0x6363, the same as ModeReg is set to in PCD_Init().
  * 
- * @return STATUS_OK on success, STATUS_??? otherwise.
+ * @return STATUS_OK
  */
-byte MFRC522::PCD_CalculateCRC(	byte *data,		///< In: Pointer to the data to transfer to the FIFO for CRC calculation.
-				byte length,	///< In: The number of bytes to transfer.
+byte MFRC522::PCD_CalculateCRC(	byte *data,		///< In: Pointer to the data to calculate the CRC for.
+				byte length,	///< In: The number of bytes.
 				byte *result	///< Out: Pointer to result buffer. Result is written to result[0..1], low byte first.
 				) {
-  PCD_WriteRegister(CommandReg, PCD_Idle);		// Stop any active command.
-  PCD_WriteRegister(DivIrqReg, 0x04);				// Clear the CRCIRq interrupt request bit
-  PCD_SetRegisterBitMask(FIFOLevelReg, 0x80);		// FlushBuffer = 1, FIFO initialization
-  PCD_WriteRegister(FIFODataReg, length, data);	// Write data to the FIFO
-  PCD_WriteRegister(CommandReg, PCD_CalcCRC);		// Start the calculation
-	
-  // Wait for the CRC calculation to complete. Each iteration of the while-loop takes 17.73�s.
-  word i = 5000;
-  byte n;
-  while (1) {
-    n = PCD_ReadRegister(DivIrqReg);	// DivIrqReg[7..0] bits are: Set2 reserved reserved MfinActIRq reserved CRCIRq reserved reserved
-    if (n & 0x04) {						// CRCIRq bit set - calculation done
-      break;
-    }
-    if (--i == 0) {						// The emergency break. We will eventually terminate on this one after 89ms. Communication with the MFRC522 might be down.
-      return STATUS_TIMEOUT;
-    }
-  }
-  PCD_WriteRegister(CommandReg, PCD_Idle);		// Stop calculating CRC for new content in the FIFO.
-	
-  // Transfer the result from the registers to the result buffer
-  result[0] = PCD_ReadRegister(CRCResultRegL);
-  result[1] = PCD_ReadRegister(CRCResultRegH);
+  word crc = 0x6363;
+  for (byte i = 0; i < length; i++) {
+    byte b = data[i] ^ (byte)(crc & 0xFF);
+    b ^= b << 4;
+    crc = (crc >> 8) ^ ((word)b << 8) ^ ((word)b << 3) ^ (b >> 4);
+  }
+  result[0] = crc & 0xFF;
+  result[1] = crc >> 8;
   return STATUS_OK;
 } // End PCD_CalculateCRC()
 
@@ -196,10 +224,10 @@ byte MFRC522::PCD_CalculateCRC(	byte *data,		///< In: Pointer to the data to tra
  * Initializes the MFRC522 chip.
  */
 void MFRC522::PCD_Init() {
-  if (bcm2835_gpio_lev(RSTPIN) == LOW) {	//The MFRC522 chip is in power down mode.
-    bcm2835_gpio_write(RSTPIN, HIGH);		// Exit power down mode. This triggers a hard reset.
+  if (!Hal::gpio().read(_resetPin)) {	//The MFRC522 chip is in power down mode.
+    Hal::gpio().write(_resetPin, true);		// Exit power down mode. This triggers a hard reset.
     // Section 8.8.2 in the datasheet says the oscillator start-up time is the start up time of the crystal + 37,74�s. Let us be generous: 50ms.
-    delay(50);
+    usleep(50000);
   }
   else { // Perform a soft reset
     PCD_Reset();
@@ -226,7 +254,7 @@ void MFRC522::PCD_Reset() {
   // The datasheet does not mention how long the SoftRest command takes to complete.
   // But the MFRC522 might have been in soft power-down mode (triggered by bit 4 of CommandReg) 
   // Section 8.8.2 in the datasheet says the oscillator start-up time is the start up time of the crystal + 37,74�s. Let us be generous: 50ms.
-  delay(50);
+  usleep(50000);
   // Wait for the PowerDown bit in CommandReg to be cleared
   while (PCD_ReadRegister(CommandReg) & (1<<4)) {
     // PCD still restarting - unlikely after waiting 50ms, but better safe than sorry.
@@ -251,6 +279,25 @@ void MFRC522::PCD_AntennaOff() {
   PCD_ClearRegisterBitMask(TxControlReg, 0x03);
 } // End PCD_AntennaOff()
 
+/**
+ * Routes the receive and timer interrupts to the IRQ pin.
+ * The pin is driven push-pull and is active low, so it falls when a PICC answers or the timer runs out.
+ * The interrupt request bits are still polled by PCD_CommunicateWithPICC(), so all other functions keep working.
+ */
+void MFRC522::PCD_EnableIRQ() {
+  PCD_WriteRegister(ComIEnReg, 0xA1);		// IRqInv=1, RxIEn=1, TimerIEn=1
+  PCD_WriteRegister(DivIEnReg, 0x80);		// IRQPushPull=1
+  PCD_WriteRegister(ComIrqReg, 0x7F);		// Clear all seven interrupt request bits
+} // End PCD_EnableIRQ()
+
+/**
+ * Stops driving the IRQ pin.
+ */
+void MFRC522::PCD_DisableIRQ() {
+  PCD_WriteRegister(ComIEnReg, 0x80);		// Reset value, no interrupts enabled
+  PCD_WriteRegister(DivIEnReg, 0x00);
+} // End PCD_DisableIRQ()
+
 /**
  * Get the current MFRC522 Receiver Gain (RxGain[2:0]) value.
  * See 9.3.3.6 / table 98 in http://www.nxp.com/documents/data_sheet/MFRC522.pdf
@@ -384,7 +431,6 @@ byte MFRC522::PCD_CommunicateWithPICC(	byte command,		///< The command to execut
 					bool checkCRC		///< In: True => The last two bytes of the response is assumed to be a CRC_A that must be validated.
 					) {
   byte n, _validBits;
-  unsigned int i;
 	
   // Prepare values for BitFramingReg
   byte txLastBits = validBits ? *validBits : 0;
@@ -392,18 +438,18 @@ byte MFRC522::PCD_CommunicateWithPICC(	byte command,		///< The command to execut
 	
   PCD_WriteRegister(CommandReg, PCD_Idle);			// Stop any active command.
   PCD_WriteRegister(ComIrqReg, 0x7F);					// Clear all seven interrupt request bits
-  PCD_SetRegisterBitMask(FIFOLevelReg, 0x80);			// FlushBuffer = 1, FIFO initialization
+  PCD_WriteRegister(FIFOLevelReg, 0x80);				// FlushBuffer = 1, FIFO initialization. The other bits are read only.
   PCD_WriteRegister(FIFODataReg, sendLen, sendData);	// Write sendData to the FIFO
   PCD_WriteRegister(BitFramingReg, bitFraming);		// Bit adjustments
   PCD_WriteRegister(CommandReg, command);				// Execute the command
   if (command == PCD_Transceive) {
-    PCD_SetRegisterBitMask(BitFramingReg, 0x80);	// StartSend=1, transmission of data starts
+    PCD_WriteRegister(BitFramingReg, bitFraming | 0x80);	// StartSend=1, transmission of data starts. RxAlign and TxLastBits as just written.
   }
 	
   // Wait for the command to complete.
   // In PCD_Init() we set the TAuto flag in TModeReg. This means the timer automatically starts when the PCD stops transmitting.
-  // Each iteration of the do-while-loop takes 17.86�s.
-  i = 2000;
+  // How long each read takes depends on the SPI clock, so the emergency break goes by the time instead.
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(35700);
   while (1) {
     n = PCD_ReadRegister(ComIrqReg);	// ComIrqReg[7..0] bits are: Set1 TxIRq RxIRq IdleIRq HiAlertIRq LoAlertIRq ErrIRq TimerIRq
     if (n & waitIRq) {					// One of the interrupts that signal success has been set.
@@ -412,26 +458,30 @@ byte MFRC522::PCD_CommunicateWithPICC(	byte command,		///< The command to execut
     if (n & 0x01) {						// Timer interrupt - nothing received in 25ms
       return STATUS_TIMEOUT;
     }
-    if (--i == 0) {						// The emergency break. If all other condions fail we will eventually terminate on this one after 35.7ms. Communication with the MFRC522 might be down.
+    if (std::chrono::steady_clock::now() > deadline) {	// The emergency break. If all other condions fail we will eventually terminate on this one after 35.7ms. Communication with the MFRC522 might be down.
       return STATUS_TIMEOUT;
     }
   }
 	
+  // Read the error, the FIFO level and the last bits received in one transfer
+  const byte statusRegs[3] = { ErrorReg, FIFOLevelReg, ControlReg };
+  byte status[3];
+  PCD_ReadRegisters(statusRegs, 3, status);
   // Stop now if any errors except collisions were detected.
-  byte errorRegValue = PCD_ReadRegister(ErrorReg); // ErrorReg[7..0] bits are: WrErr TempErr reserved BufferOvfl CollErr CRCErr ParityErr ProtocolErr
+  byte errorRegValue = status[0]; // ErrorReg[7..0] bits are: WrErr TempErr reserved BufferOvfl CollErr CRCErr ParityErr ProtocolErr
   if (errorRegValue & 0x13) {	 // BufferOvfl ParityErr ProtocolErr
     return STATUS_ERROR;
   }	
 
   // If the caller wants data back, get it from the MFRC522.
   if (backData && backLen) {
-    n = PCD_ReadRegister(FIFOLevelReg);			// Number of bytes in the FIFO
+    n = status[1] & 0x7F;			// Number of bytes in the FIFO
     if (n > *backLen) {
       return STATUS_NO_ROOM;
     }
     *backLen = n;											// Number of bytes returned
-    PCD_ReadRegister(FIFODataReg, n, backData, rxAlign);	// Get received data from FIFO
-    _validBits = PCD_ReadRegister(ControlReg) & 0x07;		// RxLastBits[2:0] indicates the number of valid bits in the last received byte. If this value is 000b, the whole byte is valid.
+    PCD_ReadRegister(FIFODataReg, n, backData, rxAlign);	// Get received data from FIFO, in one burst
+    _validBits = status[2] & 0x07;		// RxLastBits[2:0] indicates the number of valid bits in the last received byte. If this value is 000b, the whole byte is valid.
     if (validBits) {
       *validBits = _validBits;
     }
@@ -506,7 +556,7 @@ byte MFRC522::PICC_REQA_or_WUPA(	byte command, 		///< The command to send - PICC
   if (bufferATQA == NULL || *bufferSize < 2) {	// The ATQA response is 2 bytes long.
     return STATUS_NO_ROOM;
   }
-  PCD_ClearRegisterBitMask(CollReg, 0x80);		// ValuesAfterColl=1 => Bits received after collision are cleared.
+  PCD_WriteRegister(CollReg, 0x00);				// ValuesAfterColl=1 => Bits received after collision are cleared.
   validBits = 7;									// For REQA and WUPA we need the short frame format - transmit only 7 bits of the last (and only) byte. TxLastBits = BitFramingReg[2..0]
   status = PCD_TransceiveData(&command, 1, bufferATQA, bufferSize, &validBits);
   if (status != STATUS_OK) {
@@ -518,6 +568,55 @@ byte MFRC522::PICC_REQA_or_WUPA(	byte command, 		///< The command to send - PICC
   return STATUS_OK;
 } // End PICC_REQA_or_WUPA()
 
+/**
+ * Starts a REQA or WUPA without waiting for it to complete.
+ * Use this together with PCD_EnableIRQ(): the IRQ pin falls once a PICC answers or the 25ms timer runs out,
+ * and PICC_Finish_REQA_or_WUPA() then collects the result. In the meantime the caller is free to sleep.
+ */
+void MFRC522::PICC_Start_REQA_or_WUPA(	byte command	///< The command to send - PICC_CMD_REQA or PICC_CMD_WUPA
+					) {
+  // The registers are written whole rather than read first. CollReg's other bits are read only or reserved,
+  // FIFOLevelReg's are read only, and BitFramingReg's RxAlign is meant to be 0 for a short frame.
+  PCD_WriteRegister(CollReg, 0x00);				// ValuesAfterColl=1 => Bits received after collision are cleared.
+  PCD_WriteRegister(CommandReg, PCD_Idle);		// Stop any active command.
+  PCD_WriteRegister(ComIrqReg, 0x7F);				// Clear all seven interrupt request bits
+  PCD_WriteRegister(FIFOLevelReg, 0x80);			// FlushBuffer = 1, FIFO initialization
+  PCD_WriteRegister(FIFODataReg, command);		// Write the command to the FIFO
+  PCD_WriteRegister(BitFramingReg, 7);			// Short frame format - transmit only 7 bits of the command, RxAlign = 0
+  PCD_WriteRegister(CommandReg, PCD_Transceive);	// Execute the command
+  PCD_WriteRegister(BitFramingReg, 0x87);		// StartSend=1, transmission of data starts. The rest as just written.
+} // End PICC_Start_REQA_or_WUPA()
+
+/**
+ * Collects the result of a REQA or WUPA started by PICC_Start_REQA_or_WUPA().
+ * On success the PICC is in the READY state, and PICC_ReadCardSerial() can be called.
+ * 
+ * @return STATUS_OK or STATUS_COLLISION if a PICC answered, STATUS_TIMEOUT if none did.
+ */
+byte MFRC522::PICC_Finish_REQA_or_WUPA() {
+  // Everything needed to judge the answer, in one transfer
+  const byte regs[4] = { ComIrqReg, ErrorReg, FIFOLevelReg, ControlReg };
+  byte values[4];
+  PCD_ReadRegisters(regs, 4, values);
+  byte n = values[0];	// ComIrqReg[7..0] bits are: Set1 TxIRq RxIRq IdleIRq HiAlertIRq LoAlertIRq ErrIRq TimerIRq
+  if (!(n & 0x30)) {						// Neither RxIRq nor IdleIRq, nothing was received
+    PCD_WriteRegister(CommandReg, PCD_Idle);	// Stop the command if it is somehow still running.
+    return STATUS_TIMEOUT;
+  }
+  byte errorRegValue = values[1]; // ErrorReg[7..0] bits are: WrErr TempErr reserved BufferOvfl CollErr CRCErr ParityErr ProtocolErr
+  if (errorRegValue & 0x13) {	 // BufferOvfl ParityErr ProtocolErr
+    return STATUS_ERROR;
+  }
+  if (errorRegValue & 0x08) {		// CollErr
+    return STATUS_COLLISION;
+  }
+  // The ATQA must be exactly 16 bits.
+  if ((values[2] & 0x7F) != 2 || (values[3] & 0x07) != 0) {
+    return STATUS_ERROR;
+  }
+  return STATUS_OK;
+} // End PICC_Finish_REQA_or_WUPA()
+
 /**
  * Transmits SELECT/ANTICOLLISION commands to select a single PICC.
  * Before calling this function the PICCs must be placed in the READY(*) state by calling PICC_RequestA() or PICC_WakeupA().
@@ -582,7 +681,7 @@ byte MFRC522::PICC_Select(	Uid *uid,			///< Pointer to Uid struct. Normally outp
   }
 	
   // Prepare MFRC522
-  PCD_ClearRegisterBitMask(CollReg, 0x80);		// ValuesAfterColl=1 => Bits received after collision are cleared.
+  PCD_WriteRegister(CollReg, 0x00);				// ValuesAfterColl=1 => Bits received after collision are cleared.
 	
   // Repeat Cascade Level loop until we have a complete UID.
   uidComplete = false;
@@ -768,7 +867,12 @@ byte MFRC522::PICC_HaltA() {
   //		If the PICC responds with any modulation during a period of 1 ms after the end of the frame containing the
   //		HLTA command, this response shall be interpreted as 'not acknowledge'.
   // We interpret that this way: Only STATUS_TIMEOUT is an success.
+  // Waiting out the usual 25ms timeout would hold up the next read, so the timer is cut to 2ms for this.
+  PCD_WriteRegister(TReloadRegH, 0x00);		// 0x050 = 80 periods of 25us, 2ms
+  PCD_WriteRegister(TReloadRegL, 0x50);
   result = PCD_TransceiveData(buffer, sizeof(buffer), NULL, 0);
+  PCD_WriteRegister(TReloadRegH, 0x03);		// Back to 0x3E8, 25ms, as set by PCD_Init()
+  PCD_WriteRegister(TReloadRegL, 0xE8);
   if (result == STATUS_TIMEOUT) {
     return STATUS_OK;
   }
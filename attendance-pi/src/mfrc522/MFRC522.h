@@ -15,6 +15,7 @@
 #define MFRC522_h
 
 #include <stdint.h>
+#include <bcm2835.h>
 #include <stdio.h>
 #include <string>
 using namespace std;
@@ -239,8 +240,10 @@ public:
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Functions for setting up the Raspberry Pi
 	/////////////////////////////////////////////////////////////////////////////////////
-	MFRC522();
+	MFRC522(byte chipSelect = BCM2835_SPI_CS0, byte resetPin = RPI_V2_GPIO_P1_22, word clockDivider = BCM2835_SPI_CLOCK_DIVIDER_64);
 	void setSPIConfig();
+	void PCD_Select();
+	void PCD_SetClockDivider(word clockDivider);
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Basic interface functions for communicating with the MFRC522
 	/////////////////////////////////////////////////////////////////////////////////////
@@ -248,6 +251,7 @@ public:
 	void PCD_WriteRegister(byte reg, byte count, byte *values);
 	byte PCD_ReadRegister(byte reg);
 	void PCD_ReadRegister(byte reg, byte count, byte *values, byte rxAlign = 0);
+	void PCD_ReadRegisters(const byte *regs, byte count, byte *values);
 	void setBitMask(unsigned char reg, unsigned char mask);
 	void PCD_SetRegisterBitMask(byte reg, byte mask);
 	void PCD_ClearRegisterBitMask(byte reg, byte mask);
@@ -263,6 +267,8 @@ public:
 	byte PCD_GetAntennaGain();
 	void PCD_SetAntennaGain(byte mask);
 	bool PCD_PerformSelfTest();
+	void PCD_EnableIRQ();
+	void PCD_DisableIRQ();
 	
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Functions for communicating with PICCs
@@ -272,6 +278,8 @@ public:
 	byte PICC_RequestA(byte *bufferATQA, byte *bufferSize);
 	byte PICC_WakeupA(byte *bufferATQA, byte *bufferSize);
 	byte PICC_REQA_or_WUPA(byte command, byte *bufferATQA, byte *bufferSize);
+	void PICC_Start_REQA_or_WUPA(byte command);
+	byte PICC_Finish_REQA_or_WUPA();
 	byte PICC_Select(Uid *uid, byte validBits = 0);
 	byte PICC_HaltA();
 	
@@ -317,6 +325,10 @@ public:
 	bool PICC_ReadCardSerial();
 	
 private:
+	byte _chipSelect;						// The SPI chip select the reader is wired to.
+	byte _resetPin;							// The GPIO the reader's NRSTPD pin is wired to.
+	word _clockDivider;						// The SPI clock divider used with this reader.
+
 	byte MIFARE_TwoStepHelper(byte command, byte blockAddr, long data);
 };
 
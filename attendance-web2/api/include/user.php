@@ -116,24 +116,24 @@ class User {
 		return in_array($this->udata->id,$superAdmins);
 	}
 
-	//Method for toggling the user state
-	function signToggle() {
+	//Method for toggling the user state, at the given time or now
+	function signToggle($time = null) {
 		//Check the current state
 		if($this->udata->signedin == "1") {
 			//Sign the user out
-			return $this->signOut();
+			return $this->signOut($time);
 		} else {
 			//Sign the user in
-			return $this->signIn();
+			return $this->signIn($time);
 		}
 	}
 
 	//Method for signing the user out
-	function signOut() {
+	function signOut($time = null) {
 		//Get the global database object
 		global $database;
 		//Time variable (because something about statment bind security)
-		$time = time();
+		if($time === null) { $time = time(); }
 		//Create the statement
 		$stmt = $database->prepare("UPDATE calendar SET end=? WHERE user=? AND end=0 LIMIT 1");
 		//Bind the parameters
@@ -148,11 +148,11 @@ class User {
 	}
 
 	//Method for signing the user in
-	function signIn() {
+	function signIn($time = null) {
 		//Get the global database object
 		global $database;
 		//Time variable (because something about statment bind security)
-		$time = time();
+		if($time === null) { $time = time(); }
 		//Create the statement
 		$stmt = $database->prepare("INSERT INTO calendar (start,end,user,meta) VALUES (?,0,?,b'00000000')");
 		//Bind the parameters
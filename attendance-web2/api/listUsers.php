@@ -30,6 +30,9 @@ while(($row = $result->fetch_object()) != NULL) {
 	$user['permissions'] = json_decode($row->permissions);
 	$user['time'] = $row->time;
 	$user['signedin'] = $row->signedin;
+	//Summary of this week for the kiosks, in seconds since Monday and the start of the open session
+	$user['week'] = (int) $row->week;
+	$user['since'] = (int) $row->since;
 	//Push to the list
 	array_push($users, $user);
 }
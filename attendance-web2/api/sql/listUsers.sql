@@ -27,6 +27,41 @@ SELECT
 			-- In the event the above statement is 'NULL', this sets the value to use instead
 			,0)
 	) AS 'time',
+	-- This gets the time the user has been signed in since Monday, not counting a session that is still open
+	(
+		-- This replaces 'NULL' with '0' in the case the user has not signed in this week
+		SELECT
+			IFNULL
+			(
+				(
+					-- Sessions that started last week only count from the start of this one
+					SELECT
+						SUM(calendar.end - GREATEST(calendar.start, UNIX_TIMESTAMP(DATE_SUB(CURDATE(), INTERVAL WEEKDAY(CURDATE()) DAY))))
+					FROM calendar
+					WHERE
+						calendar.end > UNIX_TIMESTAMP(DATE_SUB(CURDATE(), INTERVAL WEEKDAY(CURDATE()) DAY)) AND
+						NOT calendar.meta & b'00000001' AND -- This excludes events that are marked as "suspended"
+						calendar.user = users.id
+				)
+			-- In the event the above statement is 'NULL', this sets the value to use instead
+			,0)
+	) AS 'week',
+	-- This gets when the user's open session started, or 0 if they are signed out
+	(
+		SELECT
+			IFNULL
+			(
+				(
+					SELECT
+						MAX(calendar.start)
+					FROM calendar
+					WHERE
+						calendar.end = 0 AND
+						NOT calendar.meta & b'00000001' AND	-- This excludes events that are marked as "suspended"
+						calendar.user = users.id
+				)
+			,0)
+	) AS 'since',
 	-- This gets weather or not the user is currently signed in
 	(
 		SELECT
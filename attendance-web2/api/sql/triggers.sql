@@ -0,0 +1,9 @@
+-- Events the kiosks have sent, so that one sent again after a lost reply is only applied once
+-- A kiosk's sequence numbers start over when its journal is emptied, so the time the event happened is part of the key
+CREATE TABLE IF NOT EXISTS triggers (
+	kiosk VARCHAR(64) NOT NULL,		-- The KIOSK_ID of the kiosk, or its hostname
+	seq INT UNSIGNED NOT NULL,		-- The kiosk's journal sequence number for the event
+	time INT NOT NULL,				-- When the event happened, as sent by the kiosk
+	user INT NOT NULL,				-- The user it was applied to
+	PRIMARY KEY (kiosk, seq, time)
+) ENGINE=InnoDB;
@@ -5,49 +5,145 @@ include("include/api.php");
 //Required permission
 setAccess("event.trigger");
 
-//Get identifiers
-$pin = isSet($_GET['pin']) ? $_GET['pin'] : null;
-$rfid = isSet($_GET['rfid']) ? $_GET['rfid'] : null;
+//Most events accepted in one batch
+define("TRIGGER_BATCH_MAX", 100);
 
-//Check for invalid request
-if($pin == null && $rfid == null) {
-	error("Invalid Request", "Either a PIN or RFID serial number must be included in the request");
+//Method for recording that a kiosk's event has been applied
+//Returns false if it already was, which happens when a kiosk sends an event again after not hearing back
+function recordTrigger($source, $userId) {
+	//Get the global database object
+	global $database;
+	//Create the statement, see sql/triggers.sql for the table
+	$stmt = $database->prepare("INSERT IGNORE INTO triggers (kiosk,seq,time,user) VALUES (?,?,?,?)");
+	//Bind the parameters
+	$stmt->bind_param("siii", $source["kiosk"], $source["seq"], $source["time"], $userId);
+	//Execute the query, and apply the event anyway if it can't be recorded
+	if(!$stmt->execute()) { return true; }
+	//Nothing is inserted if the row was already there
+	return $stmt->affected_rows > 0;
 }
-if($pin != null && $rfid != null) {
-	error("Invalid Request", "Use a PIN or RFID serial number, but not both");
+
+//Method for getting where an event came from, from the kiosk and the event's seq and time
+//Returns null if any of them is missing, as they are from kiosks that don't send them
+function eventSource($kiosk, $event) {
+	if($kiosk === null || !isSet($event['seq']) || !isSet($event['time'])) {
+		return null;
+	}
+	//The time as sent, since a clock running ahead is clamped differently every time
+	return array("kiosk"=>$kiosk, "seq"=>intval($event['seq']), "time"=>intval($event['time']));
 }
 
-//Get the means of identification
-$id = "";
-$selector = 0;
-//Determine the ID and selector
-if($pin != null) {
-	$id = $pin;
-	$selector = USER_SELECTOR_PIN;
-} else {
-	$id = $rfid;
-	$selector = USER_SELECTOR_RFID;
+//Method for triggering the user with the given PIN or RFID serial number
+//Events with a source, the kiosk that sent them with its sequence number and time for the event, are only applied once
+//Returns the result of the event, with "result" set to "error" on failure
+function triggerEvent($pin, $rfid, $time = null, $source = null) {
+	//Check for invalid request
+	if($pin == null && $rfid == null) {
+		return array("result"=>"error","message"=>"Invalid Request","detail"=>"Either a PIN or RFID serial number must be included in the request");
+	}
+	if($pin != null && $rfid != null) {
+		return array("result"=>"error","message"=>"Invalid Request","detail"=>"Use a PIN or RFID serial number, but not both");
+	}
+
+	//Get the means of identification
+	$id = "";
+	$selector = 0;
+	//Determine the ID and selector
+	if($pin != null) {
+		$id = $pin;
+		$selector = USER_SELECTOR_PIN;
+	} else {
+		$id = $rfid;
+		$selector = USER_SELECTOR_RFID;
+	}
+
+	//Get the user
+	$victim = new User($id, $selector);
+	//Check if the user exists
+	if($victim->error !== false) {
+		return array("result"=>"error","message"=>"Invalid User","detail"=>"No user could be found with the ID provided");
+	}
+
+	//Check if this event has been applied before
+	if($source !== null && !recordTrigger($source, $victim->udata->id)) {
+		//Report the state it left the user in, without toggling them again
+		$signedIn = $victim->udata->signedin == "1";
+		return array(
+			"result"=>"success",
+			"state"=>$signedIn ? "1" : "0",
+			"signed_in"=>$signedIn,
+			"duplicate"=>true,
+			"message"=>($signedIn ? "Hello " : "Goodbye ") . $victim->udata->fname
+		);
+	}
+
+	//Trigger the user.
+	$result = $victim->signToggle($time);
+	//Check for error
+	if($result !== "signedIn" && $result !== "signedOut") {
+		//Error
+		return array("result"=>"error","message"=>"Failed to trigger user","detail"=>"Internal error: " . $result);
+	}
+
+	//Build the result
+	$signedIn = $result == "signedIn";
+	return array(
+		"result"=>"success",
+		"state"=>$signedIn ? "1" : "0",
+		"signed_in"=>$signedIn,
+		"message"=>($signedIn ? "Hello " : "Goodbye ") . $victim->udata->fname
+	);
 }
 
-//Get the user
-$victim = new User($id, $selector);
-//Check if the user exists
-if($victim->error !== false) {
-	error("Invalid User", "No user could be found with the ID provided");
+//Check for a batch of events
+if($_SERVER['REQUEST_METHOD'] == "POST") {
+	//Decode the body
+	$body = json_decode(file_get_contents("php://input"), true);
+	if(!is_array($body) || !isSet($body['events']) || !is_array($body['events'])) {
+		error("Invalid Request", "The body must be an object with an events array");
+	}
+	if(count($body['events']) > TRIGGER_BATCH_MAX) {
+		error("Invalid Request", "No more than " . TRIGGER_BATCH_MAX . " events may be sent at once");
+	}
+
+	//Apply every event in one transaction, in the order they happened
+	$database->begin_transaction();
+	$results = array();
+	$now = time();
+	//The kiosk the events came from, if it says
+	$kiosk = isSet($body['kiosk']) ? strval($body['kiosk']) : null;
+	foreach($body['events'] as $event) {
+		$pin = isSet($event['pin']) ? $event['pin'] : null;
+		$rfid = isSet($event['rfid']) ? $event['rfid'] : null;
+		//Events are recorded at the time they happened, but never in the future
+		$time = isSet($event['time']) ? min(intval($event['time']), $now) : null;
+		$result = triggerEvent($pin, $rfid, $time, eventSource($kiosk, $event));
+		//Let the kiosk match the results up with its events
+		if(isSet($event['seq'])) { $result['seq'] = $event['seq']; }
+		$results[] = $result;
+	}
+	$database->commit();
+
+	//Display results
+	success(array("result"=>"success","results"=>$results));
 }
 
-//Trigger the user.
-$result = $victim->signToggle();
+//Get identifiers
+$pin = isSet($_GET['pin']) ? $_GET['pin'] : null;
+$rfid = isSet($_GET['rfid']) ? $_GET['rfid'] : null;
+//Get where and when the event happened, if the kiosk says
+$kiosk = isSet($_GET['kiosk']) ? strval($_GET['kiosk']) : null;
+$time = isSet($_GET['time']) ? min(intval($_GET['time']), time()) : null;
+
+//Trigger the user, recording the event in the same transaction
+$database->begin_transaction();
+$result = triggerEvent($pin, $rfid, $time, eventSource($kiosk, $_GET));
+$database->commit();
 //Check for error
-if($result !== "signedIn" && $result !== "signedOut") {
-	//Error
-	error("Failed to trigger user", "Internal error: " . $result);
+if($result["result"] == "error") {
+	error($result["message"], $result["detail"]);
 }
 
-//Display result
-if($result == "signedOut") {
-	success(array("result"=>"success","state"=>"0"));
-} else {
-	success(array("result"=>"success","state"=>"1"));
-}
-?>
\ No newline at end of file
+//Display result, with the state and greeting the kiosk checks its own against
+success($result);
+?>